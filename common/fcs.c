@@ -0,0 +1,106 @@
+/*
+ * fcs.c - PPP frame check sequence (FCS-16 and FCS-32) computation.
+ *
+ * The FCS is computed 8 bytes at a time with the "slicing-by-8"
+ * method: table[k][b] is the contribution of byte b when it is
+ * followed by k more bytes, so the FCS over 8 bytes is the XOR of
+ * 8 independent lookups instead of a chain of 8 dependent ones.
+ * table[0] is the usual RFC 1662 byte-at-a-time table.  The tables
+ * are built the first time they are needed.
+ *
+ * $Id$
+ */
+
+#include "fcs.h"
+
+#define FCS16_POLY	0x8408		/* x^16 + x^12 + x^5 + 1, reversed */
+#define FCS32_POLY	0xedb88320	/* the Ethernet CRC-32, reversed */
+
+static u_int16_t fcs16_table[8][256];
+static u_int32_t fcs32_table[8][256];
+static int fcs16_ready, fcs32_ready;
+
+static void
+fcs16_init(void)
+{
+    u_int16_t v;
+    int b, i, k;
+
+    for (b = 0; b < 256; ++b) {
+	v = b;
+	for (i = 8; i > 0; --i)
+	    v = (v & 1)? (v >> 1) ^ FCS16_POLY: v >> 1;
+	fcs16_table[0][b] = v;
+    }
+    for (k = 1; k < 8; ++k)
+	for (b = 0; b < 256; ++b) {
+	    v = fcs16_table[k-1][b];
+	    fcs16_table[k][b] = (v >> 8) ^ fcs16_table[0][v & 0xff];
+	}
+    fcs16_ready = 1;
+}
+
+static void
+fcs32_init(void)
+{
+    u_int32_t v;
+    int b, i, k;
+
+    for (b = 0; b < 256; ++b) {
+	v = b;
+	for (i = 8; i > 0; --i)
+	    v = (v & 1)? (v >> 1) ^ FCS32_POLY: v >> 1;
+	fcs32_table[0][b] = v;
+    }
+    for (k = 1; k < 8; ++k)
+	for (b = 0; b < 256; ++b) {
+	    v = fcs32_table[k-1][b];
+	    fcs32_table[k][b] = (v >> 8) ^ fcs32_table[0][v & 0xff];
+	}
+    fcs32_ready = 1;
+}
+
+/*
+ * fcs16 - update an FCS-16 with len bytes from buf.
+ */
+u_int16_t
+fcs16(u_int16_t fcs, const unsigned char *buf, int len)
+{
+    const u_int16_t (*t)[256] = fcs16_table;
+
+    if (!fcs16_ready)
+	fcs16_init();
+
+    for (; len >= 8; len -= 8, buf += 8) {
+	fcs ^= buf[0] | (buf[1] << 8);
+	fcs = t[7][fcs & 0xff] ^ t[6][fcs >> 8]
+	    ^ t[5][buf[2]] ^ t[4][buf[3]] ^ t[3][buf[4]]
+	    ^ t[2][buf[5]] ^ t[1][buf[6]] ^ t[0][buf[7]];
+    }
+    for (; len > 0; --len)
+	fcs = (fcs >> 8) ^ t[0][(fcs ^ *buf++) & 0xff];
+    return fcs;
+}
+
+/*
+ * fcs32 - update an FCS-32 with len bytes from buf.
+ */
+u_int32_t
+fcs32(u_int32_t fcs, const unsigned char *buf, int len)
+{
+    const u_int32_t (*t)[256] = fcs32_table;
+
+    if (!fcs32_ready)
+	fcs32_init();
+
+    for (; len >= 8; len -= 8, buf += 8) {
+	fcs ^= buf[0] | (buf[1] << 8) | (buf[2] << 16)
+	    | ((u_int32_t) buf[3] << 24);
+	fcs = t[7][fcs & 0xff] ^ t[6][(fcs >> 8) & 0xff]
+	    ^ t[5][(fcs >> 16) & 0xff] ^ t[4][fcs >> 24]
+	    ^ t[3][buf[4]] ^ t[2][buf[5]] ^ t[1][buf[6]] ^ t[0][buf[7]];
+    }
+    for (; len > 0; --len)
+	fcs = (fcs >> 8) ^ t[0][(fcs ^ *buf++) & 0xff];
+    return fcs;
+}
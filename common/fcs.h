@@ -0,0 +1,26 @@
+/*
+ * fcs.h - PPP frame check sequence (FCS-16 and FCS-32) computation.
+ *
+ * Used by pppd (for the demand-dial loopback) and pppdump.
+ *
+ * $Id$
+ */
+
+#ifndef __FCS_H__
+#define __FCS_H__
+
+#include <sys/types.h>
+
+#define FCS16_INIT	0xffff		/* Initial FCS-16 value */
+#define FCS16_GOOD	0xf0b8		/* Good final FCS-16 value */
+#define FCS32_INIT	0xffffffff	/* Initial FCS-32 value */
+#define FCS32_GOOD	0xdebb20e3	/* Good final FCS-32 value */
+
+/*
+ * Each of these takes the FCS so far and returns it updated to
+ * include the len bytes at buf.
+ */
+u_int16_t fcs16(u_int16_t fcs, const unsigned char *buf, int len);
+u_int32_t fcs32(u_int32_t fcs, const unsigned char *buf, int len);
+
+#endif /* __FCS_H__ */
@@ -0,0 +1,125 @@
+/*
+ * hdlc.c - async HDLC-like framing (RFC 1662) for user-space code.
+ *
+ * Most of the characters in a frame normally need no escaping, so
+ * rather than going through a state machine for each character we
+ * look for the next one that is special, 8 bytes at a time, and copy
+ * the run before it in one go.
+ *
+ * $Id$
+ */
+
+#include <string.h>
+#include "hdlc.h"
+
+#define HDLC_FLAG	0x7e
+#define HDLC_ESCAPE	0x7d
+#define HDLC_TRANS	0x20
+
+#define ONES		((u_int64_t) 0x0101010101010101ULL)
+#define HIGHS		((u_int64_t) 0x8080808080808080ULL)
+
+/* Non-zero if any byte of v is zero */
+#define HAS_ZERO(v)	(((v) - ONES) & ~(v) & HIGHS)
+
+#define SPECIAL(c)	((c) == HDLC_FLAG || (c) == HDLC_ESCAPE)
+
+/*
+ * The lowest byte HAS_ZERO marks is always a real zero, so on a
+ * little-endian machine the first special character in a word can be
+ * found from the mask without going back over the word.
+ */
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) \
+    && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define FIRST_MARKED(m)	(__builtin_ctzll(m) >> 3)
+#endif
+
+/*
+ * clean_run - return the number of bytes at p, up to n, before the
+ * first flag or escape character.
+ */
+static int
+clean_run(const unsigned char *p, int n)
+{
+    u_int64_t v, m;
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+	memcpy(&v, p + i, 8);
+	m = HAS_ZERO(v ^ (ONES * HDLC_FLAG))
+	    | HAS_ZERO(v ^ (ONES * HDLC_ESCAPE));
+	if (m) {
+#ifdef FIRST_MARKED
+	    return i + FIRST_MARKED(m);
+#else
+	    break;
+#endif
+	}
+    }
+    for (; i < n; ++i)
+	if (SPECIAL(p[i]))
+	    return i;
+    return n;
+}
+
+static void
+put_chars(struct hdlc_decoder *d, const unsigned char *p, int n)
+{
+    if (d->overrun)
+	return;
+    if (n > d->maxlen - d->len) {
+	n = d->maxlen - d->len;
+	d->overrun = 1;
+    }
+    memcpy(d->buf + d->len, p, n);
+    d->len += n;
+}
+
+void
+hdlc_decode(struct hdlc_decoder *d, const unsigned char *p, int n,
+	    hdlc_frame_fn fn, void *arg)
+{
+    const unsigned char *end = p + n;
+    unsigned char c;
+    int run, flags;
+
+    while (p < end) {
+	if (!d->escape) {
+	    run = clean_run(p, end - p);
+	    if (run > 0) {
+		put_chars(d, p, run);
+		p += run;
+		if (p == end)
+		    break;
+	    }
+	}
+	c = *p++;
+	if (c == HDLC_FLAG) {
+	    if (d->len > 0) {
+		flags = (d->escape? HDLC_ABORTED: 0)
+		    | (d->overrun? HDLC_OVERRUN: 0);
+		(*fn)(arg, d->buf, d->len, flags);
+	    }
+	    d->len = 0;
+	    d->escape = 0;
+	    d->overrun = 0;
+	    continue;
+	}
+	if (d->escape) {
+	    c ^= HDLC_TRANS;
+	    d->escape = 0;
+	} else if (c == HDLC_ESCAPE) {
+	    if (p == end || *p == HDLC_FLAG) {
+		/* once it has overrun, the rest of the frame is ignored */
+		d->escape = !d->overrun;
+		continue;
+	    }
+	    /* the usual case: take the escaped character now */
+	    c = *p++ ^ HDLC_TRANS;
+	}
+	if (d->len < d->maxlen)
+	    d->buf[d->len++] = c;
+	else
+	    d->overrun = 1;
+    }
+}
@@ -0,0 +1,40 @@
+/*
+ * hdlc.h - async HDLC-like framing (RFC 1662) for user-space code.
+ *
+ * Used by pppd (for the demand-dial loopback) and pppdump.
+ *
+ * $Id$
+ */
+
+#ifndef __HDLC_H__
+#define __HDLC_H__
+
+#include <sys/types.h>
+
+/*
+ * State for decoding a stream of characters into frames.
+ * The caller supplies buf (maxlen bytes) and zeroes the rest.
+ */
+struct hdlc_decoder {
+    unsigned char *buf;		/* frame being received */
+    int		maxlen;		/* size of buf */
+    int		len;		/* # bytes in buf so far */
+    int		escape;		/* last char was an escape */
+    int		overrun;	/* frame was too long for buf */
+};
+
+/* Flags passed to the frame function */
+#define HDLC_ABORTED	1	/* frame ended with escape-flag */
+#define HDLC_OVERRUN	2	/* frame too long, buf has the start of it */
+
+typedef void (*hdlc_frame_fn)(void *arg, unsigned char *frame, int len,
+			      int flags);
+
+/*
+ * Process n characters from p, calling fn for each complete frame
+ * (including its FCS).  The input may be split at any point.
+ */
+void hdlc_decode(struct hdlc_decoder *d, const unsigned char *p, int n,
+		 hdlc_frame_fn fn, void *arg);
+
+#endif /* __HDLC_H__ */
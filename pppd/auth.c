@@ -971,7 +971,7 @@ auth_peer_success(unit, protocol, prot_flavor, name, namelen)
 	namelen = sizeof(peer_authname) - 1;
     BCOPY(name, peer_authname, namelen);
     peer_authname[namelen] = 0;
-    script_setenv("PEERNAME", peer_authname, 0);
+    script_setenv("PEERNAME", peer_authname, ENV_KEY_SHARED);
 
     /* Save the authentication method for later. */
     auth_done[unit] |= bit;
@@ -1140,7 +1140,8 @@ static void
 check_maxoctets(arg)
     void *arg;
 {
-    unsigned int used;
+    u_int64_t used;
+    char numbuf[32], limbuf[32];
 
     update_link_stats(ifunit);
     link_stats_valid=0;
@@ -1161,7 +1162,10 @@ check_maxoctets(arg)
 	    break;
     }
     if (used > maxoctets) {
-	notice("Traffic limit reached. Limit: %u Used: %u", maxoctets, used);
+	snprintf(numbuf, sizeof(numbuf), "%llu", (unsigned long long) used);
+	snprintf(limbuf, sizeof(limbuf), "%llu",
+		 (unsigned long long) maxoctets);
+	notice("Traffic limit reached. Limit: %s Used: %s", limbuf, numbuf);
 	status = EXIT_TRAFFIC_LIMIT;
 	lcp_close(0, "Traffic limit");
 	need_holdoff = 0;
@@ -2098,6 +2102,262 @@ check_access(f, filename)
 }
 
 
+/*
+ * A secrets file is read once into a table of its lines, which is
+ * indexed by client and server so that a lookup doesn't have to
+ * scan the file.  The table is read again if the file changes.
+ */
+struct auth_line {
+    char *client;
+    char *server;
+    char *secret;
+    char *words;		/* the words after the secret, each ending in NUL */
+    int nwords;
+    int next[4];		/* next line in each chain, or -1 */
+};
+
+/* Chains of lines: three hash tables and the lines of each class. */
+#define AUTH_BY_PAIR	0	/* hashed on client and server */
+#define AUTH_BY_CLIENT	1	/* hashed on client */
+#define AUTH_BY_SERVER	2	/* hashed on server */
+#define AUTH_BY_CLASS	3	/* all lines with the same wildcards */
+
+/* The class of a line is the value scan_authfile returns for it. */
+#define AUTH_CLASS(lp)	((ISWILD((lp)->client)? 0: NONWILD_CLIENT) \
+			 | (ISWILD((lp)->server)? 0: NONWILD_SERVER))
+
+/* The words of the lines are kept in large chunks of memory. */
+struct auth_chunk {
+    struct auth_chunk *next;
+    int size;			/* bytes of data after this header */
+};
+
+#define AUTH_CHUNK	65536
+
+struct auth_table {
+    struct auth_table *next;
+    char *filename;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtim;	/* with nanoseconds, so that two changes */
+    struct timespec ctim;	/* within a second don't look like one */
+    struct auth_chunk *chunks;
+    struct auth_line *lines;
+    int nlines;
+    int *buckets[3];		/* first line in each hash bucket */
+    unsigned int hmask;
+    int classes[4];		/* first line of each class */
+};
+
+static struct auth_table *auth_tables;
+
+static unsigned int
+auth_hash(client, server)
+    char *client, *server;
+{
+    unsigned int h = 5381;
+
+    if (client != NULL)
+	while (*client)
+	    h = h * 33 + (unsigned char) *client++;
+    if (server != NULL) {
+	h = h * 33 + 0x5c;
+	while (*server)
+	    h = h * 33 + (unsigned char) *server++;
+    }
+    return h;
+}
+
+/*
+ * free_auth_table - free a table, wiping the secrets first.
+ */
+static void
+free_auth_table(at)
+    struct auth_table *at;
+{
+    struct auth_chunk *ch;
+    int i;
+
+    while ((ch = at->chunks) != NULL) {
+	at->chunks = ch->next;
+	BZERO(ch + 1, ch->size);
+	free(ch);
+    }
+    for (i = 0; i < 3; ++i)
+	free(at->buckets[i]);
+    free(at->lines);
+    free(at->filename);
+    free(at);
+}
+
+/*
+ * read_auth_table - read the secrets file `f' into a table.
+ * A line is a word at the start of a line and the words after it up
+ * to the next one; lines with fewer than three words can never
+ * match, as in the scan that this replaces, and are left out.
+ */
+static struct auth_table *
+read_auth_table(f, filename)
+    FILE *f;
+    char *filename;
+{
+    struct auth_table *at;
+    struct auth_line *lp;
+    struct auth_chunk *ch;
+    char *line, *p, *end;
+    int newline, more, nw, len, nalloc, i, j, c, h;
+    int *tails[4];
+
+    at = (struct auth_table *) malloc(sizeof(*at));
+    if (at == NULL)
+	novm("secrets table");
+    memset(at, 0, sizeof(*at));
+    nalloc = 0;
+
+    /* words are read straight into the chunks */
+    line = p = end = NULL;
+    nw = 0;
+    for (;;) {
+	if (p == NULL || end - p < MAXWORDLEN) {
+	    /* start a new chunk, taking the words of this line along */
+	    len = (p != NULL)? p - line: 0;
+	    ch = (struct auth_chunk *)
+		malloc(sizeof(struct auth_chunk) + len + AUTH_CHUNK);
+	    if (ch == NULL)
+		novm("secrets table");
+	    ch->next = at->chunks;
+	    ch->size = len + AUTH_CHUNK;
+	    at->chunks = ch;
+	    if (len > 0)
+		memcpy(ch + 1, line, len);
+	    line = (char *) (ch + 1);
+	    p = line + len;
+	    end = line + ch->size;
+	}
+	more = getword(f, p, &newline, filename);
+	if (nw > 0 && (!more || newline)) {
+	    if (nw >= 3) {
+		if (at->nlines >= nalloc) {
+		    nalloc = nalloc? 2 * nalloc: 64;
+		    at->lines = realloc(at->lines,
+					nalloc * sizeof(struct auth_line));
+		    if (at->lines == NULL)
+			novm("secrets table");
+		}
+		lp = &at->lines[at->nlines++];
+		lp->client = line;
+		lp->server = line + strlen(line) + 1;
+		lp->secret = lp->server + strlen(lp->server) + 1;
+		lp->words = lp->secret + strlen(lp->secret) + 1;
+		lp->nwords = nw - 3;
+	    }
+	    line = p;
+	    nw = 0;
+	}
+	if (!more)
+	    break;
+	p += strlen(p) + 1;
+	++nw;
+    }
+
+    /* chain the lines together, keeping them in file order */
+    for (i = 1; i < at->nlines * 2; i <<= 1)
+	;
+    at->hmask = i - 1;
+    for (j = 0; j < 4; ++j) {
+	tails[j] = malloc((j < 3? i: 4) * sizeof(int));
+	if (tails[j] == NULL)
+	    novm("secrets table");
+	if (j < 3) {
+	    at->buckets[j] = malloc(i * sizeof(int));
+	    if (at->buckets[j] == NULL)
+		novm("secrets table");
+	    memset(at->buckets[j], 0xff, i * sizeof(int));
+	}
+    }
+    memset(at->classes, 0xff, sizeof(at->classes));
+    for (i = 0; i < at->nlines; ++i) {
+	lp = &at->lines[i];
+	c = AUTH_CLASS(lp);
+	for (j = 0; j < 4; ++j) {
+	    lp->next[j] = -1;
+	    switch (j) {
+	    case AUTH_BY_PAIR:
+		if (c != (NONWILD_CLIENT | NONWILD_SERVER))
+		    continue;
+		h = auth_hash(lp->client, lp->server) & at->hmask;
+		break;
+	    case AUTH_BY_CLIENT:
+		if (!(c & NONWILD_CLIENT))
+		    continue;
+		h = auth_hash(lp->client, NULL) & at->hmask;
+		break;
+	    case AUTH_BY_SERVER:
+		if (!(c & NONWILD_SERVER))
+		    continue;
+		h = auth_hash(NULL, lp->server) & at->hmask;
+		break;
+	    default:
+		h = c;
+	    }
+	    if (j < 3 && at->buckets[j][h] < 0)
+		at->buckets[j][h] = i;
+	    else if (j == 3 && at->classes[h] < 0)
+		at->classes[h] = i;
+	    else
+		at->lines[tails[j][h]].next[j] = i;
+	    tails[j][h] = i;
+	}
+    }
+    for (j = 0; j < 4; ++j)
+	free(tails[j]);
+
+    return at;
+}
+
+/*
+ * get_auth_table - return the table for the secrets file `f',
+ * reading it if it is new or has changed since it was last read.
+ */
+static struct auth_table *
+get_auth_table(f, filename)
+    FILE *f;
+    char *filename;
+{
+    struct auth_table *at, **atp;
+    struct stat sbuf;
+
+    if (fstat(fileno(f), &sbuf) < 0)
+	return NULL;
+    for (atp = &auth_tables; (at = *atp) != NULL; atp = &at->next)
+	if (strcmp(at->filename, filename) == 0)
+	    break;
+    if (at != NULL && at->dev == sbuf.st_dev && at->ino == sbuf.st_ino
+	&& at->size == sbuf.st_size
+	&& at->mtim.tv_sec == sbuf.st_mtim.tv_sec
+	&& at->mtim.tv_nsec == sbuf.st_mtim.tv_nsec
+	&& at->ctim.tv_sec == sbuf.st_ctim.tv_sec
+	&& at->ctim.tv_nsec == sbuf.st_ctim.tv_nsec)
+	return at;
+
+    /* read the new version in full before dropping the old one */
+    at = read_auth_table(f, filename);
+    if ((at->filename = strdup(filename)) == NULL)
+	novm("secrets table");
+    at->dev = sbuf.st_dev;
+    at->ino = sbuf.st_ino;
+    at->size = sbuf.st_size;
+    at->mtim = sbuf.st_mtim;
+    at->ctim = sbuf.st_ctim;
+    if (*atp != NULL) {
+	at->next = (*atp)->next;
+	free_auth_table(*atp);
+    }
+    *atp = at;
+    return at;
+}
+
 /*
  * scan_authfile - Scan an authorization file for a secret suitable
  * for authenticating `client' on `server'.  The return value is -1
@@ -2111,6 +2371,8 @@ check_access(f, filename)
  * We assume secret is NULL or points to MAXWORDLEN bytes of space.
  * Flags are non-zero if we need two colons in the secret in order to
  * match.
+ * The secret chosen is on the first of the lines with the most
+ * non-wildcard names, not counting lines with unusable secrets.
  */
 static int
 scan_authfile(f, client, server, secret, addrs, opts, filename, flags)
@@ -2123,86 +2385,68 @@ scan_authfile(f, client, server, secret, addrs, opts, filename, flags)
     char *filename;
     int flags;
 {
-    int newline, xxx;
-    int got_flag, best_flag;
+    int xxx, class, chain, i;
     FILE *sf;
-    struct wordlist *ap, *addr_list, *alist, **app;
+    struct auth_table *at;
+    struct auth_line *lp;
+    struct wordlist *ap, *addr_list, **app;
     char word[MAXWORDLEN];
     char atfile[MAXWORDLEN];
-    char lsecret[MAXWORDLEN];
     char *cp;
 
     if (addrs != NULL)
 	*addrs = NULL;
     if (opts != NULL)
 	*opts = NULL;
-    addr_list = NULL;
-    if (!getword(f, word, &newline, filename))
-	return -1;		/* file is empty??? */
-    newline = 1;
-    best_flag = -1;
-    for (;;) {
-	/*
-	 * Skip until we find a word at the start of a line.
-	 */
-	while (!newline && getword(f, word, &newline, filename))
-	    ;
-	if (!newline)
-	    break;		/* got to end of file */
+    if ((at = get_auth_table(f, filename)) == NULL)
+	return -1;
 
+    lp = NULL;
+    for (class = NONWILD_CLIENT | NONWILD_SERVER; class >= 0; --class) {
 	/*
-	 * Got a client - check if it's a match or a wildcard.
+	 * Find the lines that could match through the most
+	 * specific chain we can for this class.
 	 */
-	got_flag = 0;
-	if (client != NULL && strcmp(word, client) != 0 && !ISWILD(word)) {
-	    newline = 0;
-	    continue;
+	if ((class & NONWILD_CLIENT) && client != NULL) {
+	    if ((class & NONWILD_SERVER) && server != NULL) {
+		chain = AUTH_BY_PAIR;
+		i = at->buckets[chain][auth_hash(client, server) & at->hmask];
+	    } else {
+		chain = AUTH_BY_CLIENT;
+		i = at->buckets[chain][auth_hash(client, NULL) & at->hmask];
+	    }
+	} else if ((class & NONWILD_SERVER) && server != NULL) {
+	    chain = AUTH_BY_SERVER;
+	    i = at->buckets[chain][auth_hash(NULL, server) & at->hmask];
+	} else {
+	    chain = AUTH_BY_CLASS;
+	    i = at->classes[class];
 	}
-	if (!ISWILD(word))
-	    got_flag = NONWILD_CLIENT;
 
-	/*
-	 * Now get a server and check if it matches.
-	 */
-	if (!getword(f, word, &newline, filename))
-	    break;
-	if (newline)
-	    continue;
-	if (!ISWILD(word)) {
-	    if (server != NULL && strcmp(word, server) != 0)
+	for (; i >= 0; i = lp->next[chain]) {
+	    lp = &at->lines[i];
+	    if (AUTH_CLASS(lp) != class
+		|| ((class & NONWILD_CLIENT) && client != NULL
+		    && strcmp(lp->client, client) != 0)
+		|| ((class & NONWILD_SERVER) && server != NULL
+		    && strcmp(lp->server, server) != 0))
 		continue;
-	    got_flag |= NONWILD_SERVER;
-	}
 
-	/*
-	 * Got some sort of a match - see if it's better than what
-	 * we have already.
-	 */
-	if (got_flag <= best_flag)
-	    continue;
-
-	/*
-	 * Get the secret.
-	 */
-	if (!getword(f, word, &newline, filename))
-	    break;
-	if (newline)
-	    continue;
-
-	/*
-	 * SRP-SHA1 authenticator should never be reading secrets from
-	 * a file.  (Authenticatee may, though.)
-	 */
-	if (flags && ((cp = strchr(word, ':')) == NULL ||
-	    strchr(cp + 1, ':') == NULL))
-	    continue;
+	    /*
+	     * SRP-SHA1 authenticator should never be reading secrets from
+	     * a file.  (Authenticatee may, though.)
+	     */
+	    if (flags && ((cp = strchr(lp->secret, ':')) == NULL ||
+		strchr(cp + 1, ':') == NULL))
+		continue;
 
-	if (secret != NULL) {
+	    if (secret == NULL)
+		break;
 	    /*
 	     * Special syntax: @/pathname means read secret from file.
 	     */
-	    if (word[0] == '@' && word[1] == '/') {
-		strlcpy(atfile, word+1, sizeof(atfile));
+	    if (lp->secret[0] == '@' && lp->secret[1] == '/') {
+		strlcpy(atfile, lp->secret+1, sizeof(atfile));
 		if ((sf = fopen(atfile, "r")) == NULL) {
 		    warn("can't open indirect secret file %s", atfile);
 		    continue;
@@ -2214,41 +2458,33 @@ scan_authfile(f, client, server, secret, addrs, opts, filename, flags)
 		    continue;
 		}
 		fclose(sf);
-	    }
-	    strlcpy(lsecret, word, sizeof(lsecret));
-	}
-
-	/*
-	 * Now read address authorization info and make a wordlist.
-	 */
-	app = &alist;
-	for (;;) {
-	    if (!getword(f, word, &newline, filename) || newline)
-		break;
-	    ap = (struct wordlist *)
-		    malloc(sizeof(struct wordlist) + strlen(word) + 1);
-	    if (ap == NULL)
-		novm("authorized addresses");
-	    ap->word = (char *) (ap + 1);
-	    strcpy(ap->word, word);
-	    *app = ap;
-	    app = &ap->next;
+		strlcpy(secret, word, MAXWORDLEN);
+		BZERO(word, sizeof(word));
+	    } else
+		strlcpy(secret, lp->secret, MAXWORDLEN);
+	    break;
 	}
-	*app = NULL;
-
-	/*
-	 * This is the best so far; remember it.
-	 */
-	best_flag = got_flag;
-	if (addr_list)
-	    free_wordlist(addr_list);
-	addr_list = alist;
-	if (secret != NULL)
-	    strlcpy(secret, lsecret, MAXWORDLEN);
-
-	if (!newline)
+	if (i >= 0)
 	    break;
     }
+    if (class < 0)
+	return -1;
+
+    /*
+     * Make a wordlist of the address authorization info.
+     */
+    app = &addr_list;
+    for (cp = lp->words, i = 0; i < lp->nwords; ++i, cp += strlen(cp) + 1) {
+	ap = (struct wordlist *)
+		malloc(sizeof(struct wordlist) + strlen(cp) + 1);
+	if (ap == NULL)
+	    novm("authorized addresses");
+	ap->word = (char *) (ap + 1);
+	strcpy(ap->word, cp);
+	*app = ap;
+	app = &ap->next;
+    }
+    *app = NULL;
 
     /* scan for a -- word indicating the start of options */
     for (app = &addr_list; (ap = *app) != NULL; app = &ap->next)
@@ -2269,7 +2505,7 @@ scan_authfile(f, client, server, secret, addrs, opts, filename, flags)
     else if (addr_list != NULL)
 	free_wordlist(addr_list);
 
-    return best_flag;
+    return class;
 }
 
 /*
@@ -100,21 +100,16 @@ static const char rcsid[] = RCSID;
 static void	ascii2unicode __P((char[], int, u_char[]));
 static void	NTPasswordHash __P((u_char *, int, u_char[MD4_SIGNATURE_SIZE]));
 static void	ChallengeResponse __P((u_char *, u_char *, u_char[24]));
-static void	ChapMS_NT __P((u_char *, char *, int, u_char[24]));
-static void	ChapMS2_NT __P((u_char *, u_char[16], char *, char *, int,
-				u_char[24]));
-static void	GenerateAuthenticatorResponsePlain
-			__P((char*, int, u_char[24], u_char[16], u_char *,
-			     char *, u_char[41]));
+static int	NTPasswordHashes __P((char *, int, u_char[MD4_SIGNATURE_SIZE],
+				      u_char[MD4_SIGNATURE_SIZE]));
+static void	ChapMS_NT __P((u_char *, u_char[MD4_SIGNATURE_SIZE],
+			       u_char[24]));
+static void	ChapMS2_NT __P((u_char *, u_char[16], char *,
+				u_char[MD4_SIGNATURE_SIZE], u_char[24]));
 #ifdef MSLANMAN
 static void	ChapMS_LANMan __P((u_char *, char *, int, u_char *));
 #endif
 
-#ifdef MPPE
-static void	Set_Start_Key __P((u_char *, char *, int));
-static void	SetMasterKeys __P((char *, int, u_char[24], int));
-#endif
-
 #ifdef MSLANMAN
 bool	ms_lanman = 0;    	/* Use LanMan password instead of NT */
 			  	/* Has meaning only with MS-CHAP challenges */
@@ -509,6 +504,7 @@ ChallengeResponse(u_char *challenge,
 		  u_char response[24])
 {
     u_char    ZPasswordHash[21];
+    DesKeySchedule ks;
 
     BZERO(ZPasswordHash, sizeof(ZPasswordHash));
     BCOPY(PasswordHash, ZPasswordHash, MD4_SIGNATURE_SIZE);
@@ -518,12 +514,14 @@ ChallengeResponse(u_char *challenge,
 	   sizeof(ZPasswordHash), ZPasswordHash);
 #endif
 
-    (void) DesSetkey(ZPasswordHash + 0);
-    DesEncrypt(challenge, response + 0);
-    (void) DesSetkey(ZPasswordHash + 7);
-    DesEncrypt(challenge, response + 8);
-    (void) DesSetkey(ZPasswordHash + 14);
-    DesEncrypt(challenge, response + 16);
+    DesSetkey(ZPasswordHash + 0, &ks);
+    DesEncrypt(challenge, &ks, response + 0);
+    DesSetkey(ZPasswordHash + 7, &ks);
+    DesEncrypt(challenge, &ks, response + 8);
+    DesSetkey(ZPasswordHash + 14, &ks);
+    DesEncrypt(challenge, &ks, response + 16);
+    BZERO(&ks, sizeof(ks));
+    BZERO(ZPasswordHash, sizeof(ZPasswordHash));
 
 #if 0
     dbglog("ChallengeResponse - response %.24B", response);
@@ -574,54 +572,91 @@ ascii2unicode(char ascii[], int ascii_len, u_char unicode[])
 static void
 NTPasswordHash(u_char *secret, int secret_len, u_char hash[MD4_SIGNATURE_SIZE])
 {
-#ifdef __NetBSD__
-    /* NetBSD uses the libc md4 routines which take bytes instead of bits */
-    int			mdlen = secret_len;
-#else
-    int			mdlen = secret_len * 8;
-#endif
     MD4_CTX		md4Context;
 
-    MD4Init(&md4Context);
-    /* MD4Update can take at most 64 bytes at a time */
-    while (mdlen > 512) {
-	MD4Update(&md4Context, secret, 512);
-	secret += 64;
-	mdlen -= 512;
-    }
-    MD4Update(&md4Context, secret, mdlen);
-    MD4Final(hash, &md4Context);
-
+    MD4_Init(&md4Context);
+    MD4_Update(&md4Context, secret, secret_len);
+    MD4_Final(hash, &md4Context);
+    BZERO(&md4Context, sizeof(md4Context));
 }
 
-static void
-ChapMS_NT(u_char *rchallenge, char *secret, int secret_len,
-	  u_char NTResponse[24])
+/*
+ * NTPasswordHashes - get the NT hash of the secret and the hash of
+ * that.  A secret of the form $NT$<hash>, the hash being 32 hex
+ * digits, gives the NT hash directly, so that the password itself
+ * need not be stored.  $NT$<hash>$<hash of hash> is also accepted,
+ * but the hash of hash is always computed from the NT hash, and one
+ * that doesn't match it is reported and ignored.  Returns 1 if the
+ * secret is a hash, or 0 if it is a password.
+ */
+static int
+NTPasswordHashes(char *secret, int secret_len,
+		 u_char PasswordHash[MD4_SIGNATURE_SIZE],
+		 u_char PasswordHashHash[MD4_SIGNATURE_SIZE])
 {
     u_char	unicodePassword[MAX_NT_PASSWORD * 2];
-    u_char	PasswordHash[MD4_SIGNATURE_SIZE];
+    u_char	StoredHashHash[MD4_SIGNATURE_SIZE];
+    u_char	*h;
+    char	*p;
+    int		i, j, hashes, x;
+
+    hashes = 0;
+    if (secret_len > 4 && strncmp(secret, "$NT$", 4) == 0) {
+	if (secret_len == 4 + 2 * MD4_SIGNATURE_SIZE)
+	    hashes = 1;
+	else if (secret_len == 5 + 4 * MD4_SIGNATURE_SIZE
+		 && secret[4 + 2 * MD4_SIGNATURE_SIZE] == '$')
+	    hashes = 2;
+    }
+    p = secret + 4;
+    h = PasswordHash;
+    for (i = 0; i < hashes * MD4_SIGNATURE_SIZE; ++i, p += 2) {
+	if (i == MD4_SIGNATURE_SIZE) {
+	    h = StoredHashHash;
+	    ++p;			/* skip the '$' */
+	}
+	for (x = j = 0; j < 2; ++j) {
+	    if (!isxdigit((u_char) p[j]))
+		break;
+	    x = (x << 4) + (isdigit((u_char) p[j])? p[j] - '0':
+			    tolower((u_char) p[j]) - 'a' + 10);
+	}
+	if (j < 2)
+	    break;
+	*h++ = x;
+    }
+    if (hashes && i == hashes * MD4_SIGNATURE_SIZE) {
+	NTPasswordHash(PasswordHash, MD4_SIGNATURE_SIZE, PasswordHashHash);
+	if (hashes == 2 && memcmp(StoredHashHash, PasswordHashHash,
+				  MD4_SIGNATURE_SIZE) != 0)
+	    error("MS-CHAP: hash of NT hash in secret doesn't match; "
+		  "ignoring it");
+	return 1;
+    }
 
-    /* Hash the Unicode version of the secret (== password). */
+    /* Hash (x2) the Unicode version of the secret (== password). */
     ascii2unicode(secret, secret_len, unicodePassword);
     NTPasswordHash(unicodePassword, secret_len * 2, PasswordHash);
+    NTPasswordHash(PasswordHash, MD4_SIGNATURE_SIZE, PasswordHashHash);
+    BZERO(unicodePassword, sizeof(unicodePassword));
+    return 0;
+}
 
+static void
+ChapMS_NT(u_char *rchallenge, u_char PasswordHash[MD4_SIGNATURE_SIZE],
+	  u_char NTResponse[24])
+{
     ChallengeResponse(rchallenge, PasswordHash, NTResponse);
 }
 
 static void
 ChapMS2_NT(u_char *rchallenge, u_char PeerChallenge[16], char *username,
-	   char *secret, int secret_len, u_char NTResponse[24])
+	   u_char PasswordHash[MD4_SIGNATURE_SIZE], u_char NTResponse[24])
 {
-    u_char	unicodePassword[MAX_NT_PASSWORD * 2];
-    u_char	PasswordHash[MD4_SIGNATURE_SIZE];
     u_char	Challenge[8];
 
     ChallengeHash(PeerChallenge, rchallenge, username, Challenge);
 
-    /* Hash the Unicode version of the secret (== password). */
-    ascii2unicode(secret, secret_len, unicodePassword);
-    NTPasswordHash(unicodePassword, secret_len * 2, PasswordHash);
-
     ChallengeResponse(Challenge, PasswordHash, NTResponse);
 }
 
@@ -635,15 +670,18 @@ ChapMS_LANMan(u_char *rchallenge, char *secret, int secret_len,
     int			i;
     u_char		UcasePassword[MAX_NT_PASSWORD]; /* max is actually 14 */
     u_char		PasswordHash[MD4_SIGNATURE_SIZE];
+    DesKeySchedule	ks;
 
     /* LANMan password is case insensitive */
     BZERO(UcasePassword, sizeof(UcasePassword));
     for (i = 0; i < secret_len; i++)
        UcasePassword[i] = (u_char)toupper(secret[i]);
-    (void) DesSetkey(UcasePassword + 0);
-    DesEncrypt( StdText, PasswordHash + 0 );
-    (void) DesSetkey(UcasePassword + 7);
-    DesEncrypt( StdText, PasswordHash + 8 );
+    DesSetkey(UcasePassword + 0, &ks);
+    DesEncrypt( StdText, &ks, PasswordHash + 0 );
+    DesSetkey(UcasePassword + 7, &ks);
+    DesEncrypt( StdText, &ks, PasswordHash + 8 );
+    BZERO(&ks, sizeof(ks));
+    BZERO(UcasePassword, sizeof(UcasePassword));
     ChallengeResponse(rchallenge, PasswordHash, &response[MS_CHAP_LANMANRESP]);
 }
 #endif
@@ -695,28 +733,6 @@ GenerateAuthenticatorResponse(u_char PasswordHashHash[MD4_SIGNATURE_SIZE],
 }
 
 
-static void
-GenerateAuthenticatorResponsePlain
-		(char *secret, int secret_len,
-		 u_char NTResponse[24], u_char PeerChallenge[16],
-		 u_char *rchallenge, char *username,
-		 u_char authResponse[MS_AUTH_RESPONSE_LENGTH+1])
-{
-    u_char	unicodePassword[MAX_NT_PASSWORD * 2];
-    u_char	PasswordHash[MD4_SIGNATURE_SIZE];
-    u_char	PasswordHashHash[MD4_SIGNATURE_SIZE];
-
-    /* Hash (x2) the Unicode version of the secret (== password). */
-    ascii2unicode(secret, secret_len, unicodePassword);
-    NTPasswordHash(unicodePassword, secret_len * 2, PasswordHash);
-    NTPasswordHash(PasswordHash, sizeof(PasswordHash),
-		   PasswordHashHash);
-
-    GenerateAuthenticatorResponse(PasswordHashHash, NTResponse, PeerChallenge,
-				  rchallenge, username, authResponse);
-}
-
-
 #ifdef MPPE
 /*
  * Set mppe_xxxx_key from the NTPasswordHashHash.
@@ -741,24 +757,6 @@ mppe_set_keys(u_char *rchallenge, u_char PasswordHashHash[MD4_SIGNATURE_SIZE])
     mppe_keys_set = 1;
 }
 
-/*
- * Set mppe_xxxx_key from MS-CHAP credentials. (see RFC 3079)
- */
-static void
-Set_Start_Key(u_char *rchallenge, char *secret, int secret_len)
-{
-    u_char	unicodePassword[MAX_NT_PASSWORD * 2];
-    u_char	PasswordHash[MD4_SIGNATURE_SIZE];
-    u_char	PasswordHashHash[MD4_SIGNATURE_SIZE];
-
-    /* Hash (x2) the Unicode version of the secret (== password). */
-    ascii2unicode(secret, secret_len, unicodePassword);
-    NTPasswordHash(unicodePassword, secret_len * 2, PasswordHash);
-    NTPasswordHash(PasswordHash, sizeof(PasswordHash), PasswordHashHash);
-
-    mppe_set_keys(rchallenge, PasswordHashHash);
-}
-
 /*
  * Set mppe_xxxx_key from MS-CHAPv2 credentials. (see RFC 3079)
  *
@@ -855,23 +853,6 @@ mppe_set_keys2(u_char PasswordHashHash[MD4_SIGNATURE_SIZE],
 
     mppe_keys_set = 1;
 }
-
-/*
- * Set mppe_xxxx_key from MS-CHAPv2 credentials. (see RFC 3079)
- */
-static void
-SetMasterKeys(char *secret, int secret_len, u_char NTResponse[24], int IsServer)
-{
-    u_char	unicodePassword[MAX_NT_PASSWORD * 2];
-    u_char	PasswordHash[MD4_SIGNATURE_SIZE];
-    u_char	PasswordHashHash[MD4_SIGNATURE_SIZE];
-    /* Hash (x2) the Unicode version of the secret (== password). */
-    ascii2unicode(secret, secret_len, unicodePassword);
-    NTPasswordHash(unicodePassword, secret_len * 2, PasswordHash);
-    NTPasswordHash(PasswordHash, sizeof(PasswordHash), PasswordHashHash);
-    mppe_set_keys2(PasswordHashHash, NTResponse, IsServer);
-}
-
 #endif /* MPPE */
 
 
@@ -879,23 +860,38 @@ void
 ChapMS(u_char *rchallenge, char *secret, int secret_len,
        unsigned char *response)
 {
+    u_char	PasswordHash[MD4_SIGNATURE_SIZE];
+    u_char	PasswordHashHash[MD4_SIGNATURE_SIZE];
+#ifdef MSLANMAN
+    int		hashed;
+#endif
+
     BZERO(response, MS_CHAP_RESPONSE_LEN);
 
-    ChapMS_NT(rchallenge, secret, secret_len, &response[MS_CHAP_NTRESP]);
+#ifdef MSLANMAN
+    hashed =
+#endif
+    NTPasswordHashes(secret, secret_len, PasswordHash, PasswordHashHash);
+    ChapMS_NT(rchallenge, PasswordHash, &response[MS_CHAP_NTRESP]);
 
 #ifdef MSLANMAN
-    ChapMS_LANMan(rchallenge, secret, secret_len,
-		  &response[MS_CHAP_LANMANRESP]);
+    /* the LANMan response needs the password itself */
+    if (!hashed)
+	ChapMS_LANMan(rchallenge, secret, secret_len,
+		      &response[MS_CHAP_LANMANRESP]);
 
     /* preferred method is set by option  */
-    response[MS_CHAP_USENT] = !ms_lanman;
+    response[MS_CHAP_USENT] = !ms_lanman || hashed;
 #else
     response[MS_CHAP_USENT] = 1;
 #endif
 
 #ifdef MPPE
-    Set_Start_Key(rchallenge, secret, secret_len);
+    /* Set mppe_xxxx_key from MS-CHAP credentials. (see RFC 3079) */
+    mppe_set_keys(rchallenge, PasswordHashHash);
 #endif
+    BZERO(PasswordHash, sizeof(PasswordHash));
+    BZERO(PasswordHashHash, sizeof(PasswordHashHash));
 }
 
 
@@ -915,33 +911,38 @@ ChapMS2(u_char *rchallenge, u_char *PeerChallenge,
 	u_char authResponse[], int authenticator)
 {
     /* ARGSUSED */
-    u_char *p = &response[MS_CHAP2_PEER_CHALLENGE];
-    int i;
+    u_char	PasswordHash[MD4_SIGNATURE_SIZE];
+    u_char	PasswordHashHash[MD4_SIGNATURE_SIZE];
 
     BZERO(response, MS_CHAP2_RESPONSE_LEN);
 
     /* Generate the Peer-Challenge if requested, or copy it if supplied. */
     if (!PeerChallenge)
-	for (i = 0; i < MS_CHAP2_PEER_CHAL_LEN; i++)
-	    *p++ = (u_char) (drand48() * 0xff);
+	random_bytes(&response[MS_CHAP2_PEER_CHALLENGE],
+		     MS_CHAP2_PEER_CHAL_LEN);
     else
 	BCOPY(PeerChallenge, &response[MS_CHAP2_PEER_CHALLENGE],
 	      MS_CHAP2_PEER_CHAL_LEN);
 
+    NTPasswordHashes(secret, secret_len, PasswordHash, PasswordHashHash);
+
     /* Generate the NT-Response */
     ChapMS2_NT(rchallenge, &response[MS_CHAP2_PEER_CHALLENGE], user,
-	       secret, secret_len, &response[MS_CHAP2_NTRESP]);
+	       PasswordHash, &response[MS_CHAP2_NTRESP]);
 
     /* Generate the Authenticator Response. */
-    GenerateAuthenticatorResponsePlain(secret, secret_len,
-				       &response[MS_CHAP2_NTRESP],
-				       &response[MS_CHAP2_PEER_CHALLENGE],
-				       rchallenge, user, authResponse);
+    GenerateAuthenticatorResponse(PasswordHashHash,
+				  &response[MS_CHAP2_NTRESP],
+				  &response[MS_CHAP2_PEER_CHALLENGE],
+				  rchallenge, user, authResponse);
 
 #ifdef MPPE
-    SetMasterKeys(secret, secret_len,
-		  &response[MS_CHAP2_NTRESP], authenticator);
+    /* Set mppe_xxxx_key from MS-CHAPv2 credentials. (see RFC 3079) */
+    mppe_set_keys2(PasswordHashHash, &response[MS_CHAP2_NTRESP],
+		   authenticator);
 #endif
+    BZERO(PasswordHash, sizeof(PasswordHash));
+    BZERO(PasswordHashHash, sizeof(PasswordHashHash));
 }
 
 #ifdef MPPE
@@ -32,6 +32,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -43,6 +44,7 @@
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #ifdef PPP_FILTER
 #include <pcap-bpf.h>
 #endif
@@ -51,26 +53,98 @@
 #include "fsm.h"
 #include "ipcp.h"
 #include "lcp.h"
+#include "fcs.h"
+#include "hdlc.h"
 
 static const char rcsid[] = RCSID;
 
-char *frame;
-int framelen;
-int framemax;
-int escape_flag;
-int flush_flag;
-int fcs;
+static struct hdlc_decoder loop_hdlc;	/* framing state for loopback */
+static int loop_rv;			/* return value for loop_chars */
 
+/*
+ * Frames queued while the link is coming up are kept in a ring
+ * buffer of demand_queue_bytes bytes, allocated once, rather than
+ * being malloc'd one at a time.  Each entry starts with a struct
+ * packet header and is rounded up to a multiple of PEND_ALIGN bytes.
+ * The live frames for each network protocol are also chained
+ * together (by offset into the ring) so that demand_rexmit only has
+ * to look at the frames for the protocol that has come up.
+ * Entries which have been sent or dropped are marked dead and the
+ * space is reclaimed once they reach the head of the ring.
+ */
 struct packet {
-    int length;
-    struct packet *next;
+    int length;			/* # bytes of data; 0 = dead, -1 = skip */
+    int size;			/* # bytes this entry uses in the ring */
+    int next;			/* next frame for this protocol, or -1 */
     unsigned char data[1];
 };
 
-struct packet *pend_q;
-struct packet *pend_qtail;
+#define PEND_ALIGN	16
+#define PEND_HDRLEN	offsetof(struct packet, data)
+#define PEND_SIZE(len)	((PEND_HDRLEN + (len) + PEND_ALIGN - 1) \
+			 & ~(PEND_ALIGN - 1))
+#define PEND_PKT(off)	((struct packet *) (pend_buf + (off)))
+
+static unsigned char *pend_buf;	/* the ring */
+static int pend_size;		/* size of pend_buf */
+static int pend_head;		/* offset of oldest entry */
+static int pend_tail;		/* offset at which to add the next entry */
+static int pend_used;		/* # bytes used, including dead entries */
+static int pend_npkts;		/* # live frames */
+
+/* Per-protocol queues of live frames, oldest first */
+#define PEND_NPROTO	8
+static struct pend_proto {
+    int proto;
+    int head;
+    int tail;
+} pend_protos[PEND_NPROTO];
+static int pend_nprotos;
+
+static struct {
+    unsigned int queued;	/* # frames put on the queue */
+    unsigned int dropped;	/* # frames dropped because it was full */
+    unsigned int replayed;	/* # frames sent once the link came up */
+} pend_stats;
+static int pend_warned;		/* have logged that we're dropping */
+
+#ifdef PPP_FILTER
+/*
+ * Cache of pass-filter/active-filter verdicts, keyed by flow
+ * (protocol, addresses and ports), so that we don't have to run
+ * the BPF interpreter over every packet of a flow.  Entries are
+ * tagged with the filter_generation they were computed under, so
+ * changing either filter invalidates the whole cache.
+ */
+#define FLOW_CACHE_SIZE	256	/* must be a power of 2 */
+#define FLOW_KEYLEN	40
+
+static struct flow_verdict {
+    unsigned int gen;		/* filter_generation; 0 = empty */
+    int keylen;
+    unsigned char key[FLOW_KEYLEN];
+    int verdict;		/* 1 if the filters passed the packet */
+} flow_cache[FLOW_CACHE_SIZE];
+
+static struct {
+    unsigned int hits;
+    unsigned int misses;
+} flow_stats;
+
+static int flow_key __P((unsigned char *, int, unsigned char *));
+static int filter_packet __P((unsigned char *, int));
+static int cached_filter_packet __P((unsigned char *, int));
+#endif
 
 static int active_packet __P((unsigned char *, int));
+static void pend_reset __P((void));
+static void pend_reclaim __P((void));
+static struct pend_proto *pend_find __P((int, int));
+static int pend_alloc __P((int));
+static int pend_drop_oldest __P((void));
+static void pend_note_drop __P((char *));
+static int pend_enqueue __P((unsigned char *, int));
+static void loop_hdlc_frame __P((void *, unsigned char *, int, int));
 
 /*
  * demand_conf - configure the interface for doing dial-on-demand.
@@ -81,18 +155,22 @@ demand_conf()
     int i;
     struct protent *protp;
 
-/*    framemax = lcp_allowoptions[0].mru;
-    if (framemax < PPP_MRU) */
-	framemax = PPP_MRU;
-    framemax += PPP_HDRLEN + PPP_FCSLEN;
-    frame = malloc(framemax);
-    if (frame == NULL)
+/*    loop_hdlc.maxlen = lcp_allowoptions[0].mru;
+    if (loop_hdlc.maxlen < PPP_MRU) */
+	loop_hdlc.maxlen = PPP_MRU;
+    loop_hdlc.maxlen += PPP_HDRLEN + PPP_FCSLEN;
+    loop_hdlc.buf = malloc(loop_hdlc.maxlen);
+    if (loop_hdlc.buf == NULL)
 	novm("demand frame");
-    framelen = 0;
-    pend_q = NULL;
-    escape_flag = 0;
-    flush_flag = 0;
-    fcs = PPP_INITFCS;
+    loop_hdlc.len = 0;
+    loop_hdlc.escape = 0;
+    loop_hdlc.overrun = 0;
+
+    pend_size = demand_queue_bytes & ~(PEND_ALIGN - 1);
+    pend_buf = malloc(pend_size);
+    if (pend_buf == NULL)
+	novm("demand queue");
+    pend_reset();
 
     netif_set_mtu(0, MIN(lcp_allowoptions[0].mru, PPP_MRU));
     if (ppp_send_config(0, PPP_MRU, (u_int32_t) 0, 0, 0) < 0
@@ -135,7 +213,6 @@ demand_block()
 void
 demand_discard()
 {
-    struct packet *pkt, *nextpkt;
     int i;
     struct protent *protp;
 
@@ -145,15 +222,10 @@ demand_discard()
     get_loop_output();
 
     /* discard all saved packets */
-    for (pkt = pend_q; pkt != NULL; pkt = nextpkt) {
-	nextpkt = pkt->next;
-	free(pkt);
-    }
-    pend_q = NULL;
-    framelen = 0;
-    flush_flag = 0;
-    escape_flag = 0;
-    fcs = PPP_INITFCS;
+    pend_reset();
+    loop_hdlc.len = 0;
+    loop_hdlc.overrun = 0;
+    loop_hdlc.escape = 0;
 }
 
 /*
@@ -170,44 +242,6 @@ demand_unblock()
 	    sifnpmode(0, protp->protocol & ~0x8000, NPMODE_PASS);
 }
 
-/*
- * FCS lookup table as calculated by genfcstab.
- */
-static u_short fcstab[256] = {
-	0x0000,	0x1189,	0x2312,	0x329b,	0x4624,	0x57ad,	0x6536,	0x74bf,
-	0x8c48,	0x9dc1,	0xaf5a,	0xbed3,	0xca6c,	0xdbe5,	0xe97e,	0xf8f7,
-	0x1081,	0x0108,	0x3393,	0x221a,	0x56a5,	0x472c,	0x75b7,	0x643e,
-	0x9cc9,	0x8d40,	0xbfdb,	0xae52,	0xdaed,	0xcb64,	0xf9ff,	0xe876,
-	0x2102,	0x308b,	0x0210,	0x1399,	0x6726,	0x76af,	0x4434,	0x55bd,
-	0xad4a,	0xbcc3,	0x8e58,	0x9fd1,	0xeb6e,	0xfae7,	0xc87c,	0xd9f5,
-	0x3183,	0x200a,	0x1291,	0x0318,	0x77a7,	0x662e,	0x54b5,	0x453c,
-	0xbdcb,	0xac42,	0x9ed9,	0x8f50,	0xfbef,	0xea66,	0xd8fd,	0xc974,
-	0x4204,	0x538d,	0x6116,	0x709f,	0x0420,	0x15a9,	0x2732,	0x36bb,
-	0xce4c,	0xdfc5,	0xed5e,	0xfcd7,	0x8868,	0x99e1,	0xab7a,	0xbaf3,
-	0x5285,	0x430c,	0x7197,	0x601e,	0x14a1,	0x0528,	0x37b3,	0x263a,
-	0xdecd,	0xcf44,	0xfddf,	0xec56,	0x98e9,	0x8960,	0xbbfb,	0xaa72,
-	0x6306,	0x728f,	0x4014,	0x519d,	0x2522,	0x34ab,	0x0630,	0x17b9,
-	0xef4e,	0xfec7,	0xcc5c,	0xddd5,	0xa96a,	0xb8e3,	0x8a78,	0x9bf1,
-	0x7387,	0x620e,	0x5095,	0x411c,	0x35a3,	0x242a,	0x16b1,	0x0738,
-	0xffcf,	0xee46,	0xdcdd,	0xcd54,	0xb9eb,	0xa862,	0x9af9,	0x8b70,
-	0x8408,	0x9581,	0xa71a,	0xb693,	0xc22c,	0xd3a5,	0xe13e,	0xf0b7,
-	0x0840,	0x19c9,	0x2b52,	0x3adb,	0x4e64,	0x5fed,	0x6d76,	0x7cff,
-	0x9489,	0x8500,	0xb79b,	0xa612,	0xd2ad,	0xc324,	0xf1bf,	0xe036,
-	0x18c1,	0x0948,	0x3bd3,	0x2a5a,	0x5ee5,	0x4f6c,	0x7df7,	0x6c7e,
-	0xa50a,	0xb483,	0x8618,	0x9791,	0xe32e,	0xf2a7,	0xc03c,	0xd1b5,
-	0x2942,	0x38cb,	0x0a50,	0x1bd9,	0x6f66,	0x7eef,	0x4c74,	0x5dfd,
-	0xb58b,	0xa402,	0x9699,	0x8710,	0xf3af,	0xe226,	0xd0bd,	0xc134,
-	0x39c3,	0x284a,	0x1ad1,	0x0b58,	0x7fe7,	0x6e6e,	0x5cf5,	0x4d7c,
-	0xc60c,	0xd785,	0xe51e,	0xf497,	0x8028,	0x91a1,	0xa33a,	0xb2b3,
-	0x4a44,	0x5bcd,	0x6956,	0x78df,	0x0c60,	0x1de9,	0x2f72,	0x3efb,
-	0xd68d,	0xc704,	0xf59f,	0xe416,	0x90a9,	0x8120,	0xb3bb,	0xa232,
-	0x5ac5,	0x4b4c,	0x79d7,	0x685e,	0x1ce1,	0x0d68,	0x3ff3,	0x2e7a,
-	0xe70e,	0xf687,	0xc41c,	0xd595,	0xa12a,	0xb0a3,	0x8238,	0x93b1,
-	0x6b46,	0x7acf,	0x4854,	0x59dd,	0x2d62,	0x3ceb,	0x0e70,	0x1ff9,
-	0xf78f,	0xe606,	0xd49d,	0xc514,	0xb1ab,	0xa022,	0x92b9,	0x8330,
-	0x7bc7,	0x6a4e,	0x58d5,	0x495c,	0x3de3,	0x2c6a,	0x1ef1,	0x0f78
-};
-
 /*
  * loop_chars - process characters received from the loopback.
  * Calls loop_frame when a complete frame has been accumulated.
@@ -218,41 +252,27 @@ loop_chars(p, n)
     unsigned char *p;
     int n;
 {
-    int c, rv;
-
-    rv = 0;
-    for (; n > 0; --n) {
-	c = *p++;
-	if (c == PPP_FLAG) {
-	    if (!escape_flag && !flush_flag
-		&& framelen > 2 && fcs == PPP_GOODFCS) {
-		framelen -= 2;
-		if (loop_frame((unsigned char *)frame, framelen))
-		    rv = 1;
-	    }
-	    framelen = 0;
-	    flush_flag = 0;
-	    escape_flag = 0;
-	    fcs = PPP_INITFCS;
-	    continue;
-	}
-	if (flush_flag)
-	    continue;
-	if (escape_flag) {
-	    c ^= PPP_TRANS;
-	    escape_flag = 0;
-	} else if (c == PPP_ESCAPE) {
-	    escape_flag = 1;
-	    continue;
-	}
-	if (framelen >= framemax) {
-	    flush_flag = 1;
-	    continue;
-	}
-	frame[framelen++] = c;
-	fcs = PPP_FCS(fcs, c);
-    }
-    return rv;
+    loop_rv = 0;
+    hdlc_decode(&loop_hdlc, p, n, loop_hdlc_frame, NULL);
+    return loop_rv;
+}
+
+/*
+ * loop_hdlc_frame - called by hdlc_decode for each frame from the
+ * loopback.  We drop aborted or over-long frames and those with a
+ * bad FCS.
+ */
+static void
+loop_hdlc_frame(arg, frame, len, flags)
+    void *arg;
+    unsigned char *frame;
+    int len, flags;
+{
+    if (flags != 0 || len <= 2
+	|| fcs16(PPP_INITFCS, frame, len) != PPP_GOODFCS)
+	return;
+    if (loop_frame(frame, len - 2))
+	loop_rv = 1;
 }
 
 /*
@@ -270,8 +290,6 @@ loop_frame(frame, len)
     unsigned char *frame;
     int len;
 {
-    struct packet *pkt;
-
     /* dbglog("from loop: %P", frame, len); */
     if (len < PPP_HDRLEN)
 	return 0;
@@ -280,17 +298,10 @@ loop_frame(frame, len)
     if (!active_packet(frame, len))
 	return 0;
 
-    pkt = (struct packet *) malloc(sizeof(struct packet) + len);
-    if (pkt != NULL) {
-	pkt->length = len;
-	pkt->next = NULL;
-	memcpy(pkt->data, frame, len);
-	if (pend_q == NULL)
-	    pend_q = pkt;
-	else
-	    pend_qtail->next = pkt;
-	pend_qtail = pkt;
-    }
+    if (pend_enqueue(frame, len))
+	++pend_stats.queued;
+    else
+	pend_note_drop("new");
     return 1;
 }
 
@@ -302,27 +313,216 @@ void
 demand_rexmit(proto)
     int proto;
 {
-    struct packet *pkt, *prev, *nextpkt;
-
-    prev = NULL;
-    pkt = pend_q;
-    pend_q = NULL;
-    for (; pkt != NULL; pkt = nextpkt) {
-	nextpkt = pkt->next;
-	if (PPP_PROTOCOL(pkt->data) == proto) {
-	    output(0, pkt->data, pkt->length);
-	    free(pkt);
-	} else {
-	    if (prev == NULL)
-		pend_q = pkt;
-	    else
-		prev->next = pkt;
-	    prev = pkt;
+    struct pend_proto *pq;
+    struct packet *pkt;
+    int off, n;
+
+    pq = pend_find(proto, 0);
+    if (pq == NULL)
+	return;
+    n = 0;
+    for (off = pq->head; off >= 0; off = pkt->next) {
+	pkt = PEND_PKT(off);
+	output(0, pkt->data, pkt->length);
+	pkt->length = 0;
+	++n;
+    }
+    pq->head = pq->tail = -1;
+    pend_npkts -= n;
+    pend_stats.replayed += n;
+    pend_reclaim();
+}
+
+/*
+ * demand_print_stats - log what happened to the frames we queued
+ * while bringing up the link, and reset the counts.
+ */
+void
+demand_print_stats()
+{
+    if (pend_stats.queued == 0 && pend_stats.dropped == 0)
+	return;
+    dbglog("Demand queue: %u packets queued, %u dropped, %u replayed",
+	   pend_stats.queued, pend_stats.dropped, pend_stats.replayed);
+    memset(&pend_stats, 0, sizeof(pend_stats));
+    pend_warned = 0;
+#ifdef PPP_FILTER
+    if (flow_stats.hits + flow_stats.misses > 0)
+	dbglog("Filter cache: %u hits, %u misses",
+	       flow_stats.hits, flow_stats.misses);
+    memset(&flow_stats, 0, sizeof(flow_stats));
+#endif
+}
+
+/*
+ * pend_reset - empty the pending queue.
+ */
+static void
+pend_reset()
+{
+    pend_head = pend_tail = pend_used = 0;
+    pend_npkts = 0;
+    pend_nprotos = 0;
+}
+
+/*
+ * pend_reclaim - free up the space used by dead entries at the head
+ * of the ring.
+ */
+static void
+pend_reclaim()
+{
+    struct packet *pkt;
+
+    while (pend_used > 0) {
+	pkt = PEND_PKT(pend_head);
+	if (pkt->length > 0)
+	    break;
+	pend_used -= pkt->size;
+	pend_head += pkt->size;
+	if (pend_head >= pend_size)
+	    pend_head = 0;
+    }
+    if (pend_used == 0)
+	pend_head = pend_tail = 0;
+}
+
+/*
+ * pend_find - find the queue for a protocol, optionally creating it.
+ */
+static struct pend_proto *
+pend_find(proto, create)
+    int proto, create;
+{
+    int i;
+    struct pend_proto *pq;
+
+    for (i = 0; i < pend_nprotos; ++i)
+	if (pend_protos[i].proto == proto)
+	    return &pend_protos[i];
+    if (!create || pend_nprotos >= PEND_NPROTO)
+	return NULL;
+    pq = &pend_protos[pend_nprotos++];
+    pq->proto = proto;
+    pq->head = pq->tail = -1;
+    return pq;
+}
+
+/*
+ * pend_alloc - find size contiguous bytes at the tail of the ring.
+ * Returns the offset, or -1 if there isn't room.
+ */
+static int
+pend_alloc(size)
+    int size;
+{
+    int off;
+    struct packet *skip;
+
+    if (pend_used > 0 && pend_tail <= pend_head) {
+	/* free space is between tail and head */
+	if (pend_head - pend_tail < size)
+	    return -1;
+    } else if (pend_size - pend_tail < size) {
+	/* not enough room before the end; wrap if it fits at the start */
+	if ((pend_used > 0? pend_head: pend_size) < size)
+	    return -1;
+	if (pend_used > 0 && pend_tail < pend_size) {
+	    skip = PEND_PKT(pend_tail);
+	    skip->length = -1;
+	    skip->size = pend_size - pend_tail;
+	    pend_used += skip->size;
 	}
+	if (pend_used == 0)
+	    pend_head = 0;
+	pend_tail = 0;
     }
-    pend_qtail = prev;
-    if (prev != NULL)
-	prev->next = NULL;
+    off = pend_tail;
+    pend_tail += size;
+    pend_used += size;
+    return off;
+}
+
+/*
+ * pend_drop_oldest - drop the oldest live frame.
+ * Returns 0 if there was nothing to drop.
+ */
+static int
+pend_drop_oldest()
+{
+    struct packet *pkt;
+    struct pend_proto *pq;
+
+    pend_reclaim();
+    if (pend_used == 0)
+	return 0;
+    pkt = PEND_PKT(pend_head);
+    /* the oldest frame overall is the oldest for its protocol */
+    pq = pend_find(PPP_PROTOCOL(pkt->data), 0);
+    if (pq != NULL && pq->head == pend_head) {
+	pq->head = pkt->next;
+	if (pq->head < 0)
+	    pq->tail = -1;
+    }
+    pkt->length = 0;
+    --pend_npkts;
+    pend_note_drop("old");
+    pend_reclaim();
+    return 1;
+}
+
+/*
+ * pend_note_drop - count a dropped frame, and warn about the first
+ * one since the queue was last reported on.
+ */
+static void
+pend_note_drop(which)
+    char *which;
+{
+    ++pend_stats.dropped;
+    if (!pend_warned) {
+	warn("Demand queue full, dropping %s packets", which);
+	pend_warned = 1;
+    }
+}
+
+/*
+ * pend_enqueue - copy a frame onto the pending queue, making room
+ * for it if demand-head-drop is set.
+ * Returns 0 if the frame had to be dropped.
+ */
+static int
+pend_enqueue(frame, len)
+    unsigned char *frame;
+    int len;
+{
+    int size, off;
+    struct pend_proto *pq;
+    struct packet *pkt;
+
+    size = PEND_SIZE(len);
+    pq = pend_find(PPP_PROTOCOL(frame), 1);
+    if (pq == NULL || size > pend_size)
+	return 0;
+    for (;;) {
+	if (pend_npkts < demand_queue_pkts
+	    && (off = pend_alloc(size)) >= 0)
+	    break;
+	if (!demand_head_drop || !pend_drop_oldest())
+	    return 0;
+    }
+    pkt = PEND_PKT(off);
+    pkt->length = len;
+    pkt->size = size;
+    pkt->next = -1;
+    memcpy(pkt->data, frame, len);
+    if (pq->tail >= 0)
+	PEND_PKT(pq->tail)->next = off;
+    else
+	pq->head = off;
+    pq->tail = off;
+    ++pend_npkts;
+    return 1;
 }
 
 /*
@@ -341,15 +541,9 @@ active_packet(p, len)
 	return 0;
     proto = PPP_PROTOCOL(p);
 #ifdef PPP_FILTER
-    p[0] = 1;		/* outbound packet indicator */
-    if ((pass_filter.bf_len != 0
-	 && bpf_filter(pass_filter.bf_insns, p, len, len) == 0)
-	|| (active_filter.bf_len != 0
-	    && bpf_filter(active_filter.bf_insns, p, len, len) == 0)) {
-	p[0] = 0xff;
+    if ((pass_filter.bf_len != 0 || active_filter.bf_len != 0)
+	&& !cached_filter_packet(p, len))
 	return 0;
-    }
-    p[0] = 0xff;
 #endif
     for (i = 0; (protp = protocols[i]) != NULL; ++i) {
 	if (protp->protocol < 0xC000 && (protp->protocol & ~0x8000) == proto) {
@@ -362,3 +556,114 @@ active_packet(p, len)
     }
     return 0;			/* not a supported protocol !!?? */
 }
+
+#ifdef PPP_FILTER
+/*
+ * filter_packet - run the pass and active filters over a packet.
+ * Returns 1 if both of them pass it.
+ */
+static int
+filter_packet(p, len)
+    unsigned char *p;
+    int len;
+{
+    int ok = 1;
+
+    p[0] = 1;		/* outbound packet indicator */
+    if ((pass_filter.bf_len != 0
+	 && bpf_filter(pass_filter.bf_insns, p, len, len) == 0)
+	|| (active_filter.bf_len != 0
+	    && bpf_filter(active_filter.bf_insns, p, len, len) == 0))
+	ok = 0;
+    p[0] = 0xff;
+    return ok;
+}
+
+/*
+ * cached_filter_packet - like filter_packet, but look up the flow in
+ * the verdict cache first if filter-cache is set.
+ */
+static int
+cached_filter_packet(p, len)
+    unsigned char *p;
+    int len;
+{
+    struct flow_verdict *fv;
+    unsigned char key[FLOW_KEYLEN];
+    unsigned int h;
+    int i, keylen;
+
+    keylen = filter_cache? flow_key(p, len, key): 0;
+    if (keylen == 0)
+	return filter_packet(p, len);
+
+    /* FNV-1a */
+    h = 2166136261U;
+    for (i = 0; i < keylen; ++i)
+	h = (h ^ key[i]) * 16777619U;
+    fv = &flow_cache[h & (FLOW_CACHE_SIZE - 1)];
+    if (fv->gen == filter_generation && fv->keylen == keylen
+	&& memcmp(fv->key, key, keylen) == 0) {
+	++flow_stats.hits;
+	return fv->verdict;
+    }
+    ++flow_stats.misses;
+    fv->verdict = filter_packet(p, len);
+    fv->gen = filter_generation;
+    fv->keylen = keylen;
+    memcpy(fv->key, key, keylen);
+    return fv->verdict;
+}
+
+/*
+ * flow_key - extract the flow key (PPP protocol, IP protocol,
+ * addresses, and ports for TCP and UDP) from an IPv4 or IPv6 packet.
+ * Returns the length of the key, or 0 if the packet shouldn't be
+ * cached (other protocols, fragments, truncated headers).
+ */
+static int
+flow_key(p, len, key)
+    unsigned char *p;
+    int len;
+    unsigned char *key;
+{
+    int proto, ipproto, hlen, k;
+
+    proto = PPP_PROTOCOL(p);
+    p += PPP_HDRLEN;
+    len -= PPP_HDRLEN;
+    key[0] = proto >> 8;
+    key[1] = proto;
+    switch (proto) {
+    case PPP_IP:
+	if (len < 20 || (p[0] >> 4) != 4)
+	    return 0;
+	if (((p[6] << 8) + p[7]) & 0x3fff)
+	    return 0;		/* fragment (MF set or offset != 0) */
+	hlen = (p[0] & 0xf) * 4;
+	ipproto = p[9];
+	key[2] = ipproto;
+	memcpy(key + 3, p + 12, 8);	/* source and destination */
+	k = 11;
+	break;
+    case PPP_IPV6:
+	if (len < 40 || (p[0] >> 4) != 6)
+	    return 0;
+	hlen = 40;
+	ipproto = p[6];
+	key[2] = ipproto;
+	memcpy(key + 3, p + 8, 32);	/* source and destination */
+	k = 35;
+	break;
+    default:
+	return 0;
+    }
+    if (ipproto == IPPROTO_TCP || ipproto == IPPROTO_UDP) {
+	if (len < hlen + 4)
+	    return 0;
+	memcpy(key + k, p + hlen, 4);	/* source and destination ports */
+	k += 4;
+    }
+    return k;
+}
+#endif
@@ -63,6 +63,7 @@
 #include "pppd.h"
 #include "pathnames.h"
 #include "md5.h"
+#include "magic.h"
 #include "eap.h"
 
 #ifdef USE_SRP
@@ -313,7 +314,7 @@ eap_state *esp;
  * date.
  */
 static bool
-pncrypt_setkey(int timeoffs)
+pncrypt_setkey(int timeoffs, DesKeySchedule *ks)
 {
 	struct tm *tp;
 	char tbuf[9];
@@ -330,7 +331,9 @@ pncrypt_setkey(int timeoffs)
 	strftime(tbuf, sizeof (tbuf), "%Y%m%d", tp);
 	SHA1Update(&ctxt, tbuf, strlen(tbuf));
 	SHA1Final(dig, &ctxt);
-	return (DesSetkey(dig));
+	DesSetkey(dig, ks);
+	BZERO(dig, sizeof (dig));
+	return (1);
 }
 
 static char base64[] =
@@ -435,6 +438,7 @@ int status;
 	int id, i, plen, toffs;
 	u_char vals[2];
 	struct b64state bs;
+	DesKeySchedule ks;
 #endif /* USE_SRP */
 
 	esp->es_server.ea_timeout = esp->es_savedtime;
@@ -470,13 +474,13 @@ int status;
 			    secbuf);
 			toffs = 0;
 			for (i = 0; i < 5; i++) {
-				pncrypt_setkey(toffs);
-				toffs -= 86400;
-				if (!DesDecrypt(secbuf, clear)) {
-					dbglog("no DES here; cannot decode "
-					    "pseudonym");
+				if (!pncrypt_setkey(toffs, &ks)) {
+					dbglog("no pseudonym secret; cannot "
+					    "decode pseudonym");
 					return;
 				}
+				toffs -= 86400;
+				DesDecrypt(secbuf, &ks, clear);
 				id = *(unsigned char *)clear;
 				if (id + 1 <= plen && id + 9 > plen)
 					break;
@@ -496,11 +500,12 @@ int status;
 				dp += i;
 				sp = secbuf + 8;
 				while (plen > 0) {
-					(void) DesDecrypt(sp, dp);
+					DesDecrypt(sp, &ks, dp);
 					sp += 8;
 					dp += 8;
 					plen -= 8;
 				}
+				BZERO(&ks, sizeof (ks));
 				esp->es_server.ea_peer[
 					esp->es_server.ea_peerlen] = '\0';
 				dbglog("decoded pseudonym to \"%.*q\"",
@@ -642,7 +647,6 @@ eap_state *esp;
 {
 	u_char *outp;
 	u_char *lenloc;
-	u_char *ptr;
 	int outlen;
 	int challen;
 	char *str;
@@ -652,6 +656,7 @@ eap_state *esp;
 	int i, j;
 	struct b64state b64;
 	SHA1_CTX ctxt;
+	DesKeySchedule ks;
 #endif /* USE_SRP */
 
 	/* Handle both initial auth and restart */
@@ -709,9 +714,7 @@ eap_state *esp;
 			    MIN_CHALLENGE_LENGTH;
 		PUTCHAR(challen, outp);
 		esp->es_challen = challen;
-		ptr = esp->es_challenge;
-		while (--challen >= 0)
-			*ptr++ = (u_char) (drand48() * 0x100);
+		random_bytes(esp->es_challenge, challen);
 		BCOPY(esp->es_challenge, outp, esp->es_challen);
 		INCPTR(esp->es_challen, outp);
 		BCOPY(esp->es_server.ea_name, outp, esp->es_server.ea_namelen);
@@ -767,7 +770,7 @@ eap_state *esp;
 		BCOPY(t_serverresponse(ts), outp, SHA_DIGESTSIZE);
 		INCPTR(SHA_DIGESTSIZE, outp);
 
-		if (pncrypt_setkey(0)) {
+		if (pncrypt_setkey(0, &ks)) {
 			/* Generate pseudonym */
 			optr = outp;
 			cp = (unsigned char *)esp->es_server.ea_peer;
@@ -777,15 +780,12 @@ eap_state *esp;
 			BCOPY(cp, clear + 1, j);
 			i -= j;
 			cp += j;
-			if (!DesEncrypt(clear, cipher)) {
-				dbglog("no DES here; not generating pseudonym");
-				break;
-			}
+			DesEncrypt(clear, &ks, cipher);
 			BZERO(&b64, sizeof (b64));
 			outp++;		/* space for pseudonym length */
 			outp += b64enc(&b64, cipher, 8, outp);
 			while (i >= 8) {
-				(void) DesEncrypt(cp, cipher);
+				DesEncrypt(cp, &ks, cipher);
 				outp += b64enc(&b64, cipher, 8, outp);
 				cp += 8;
 				i -= 8;
@@ -797,10 +797,11 @@ eap_state *esp;
 					*cp++ = drand48() * 0x100;
 					i++;
 				}
-				(void) DesEncrypt(clear, cipher);
+				DesEncrypt(clear, &ks, cipher);
 				outp += b64enc(&b64, cipher, 8, outp);
 			}
 			outp += b64flush(&b64, outp);
+			BZERO(&ks, sizeof (ks));
 
 			/* Set length and pad out to next 20 octet boundary */
 			i = outp - optr - 1;
@@ -841,9 +842,7 @@ eap_state *esp;
 		challen = MIN_CHALLENGE_LENGTH +
 		    ((MAX_CHALLENGE_LENGTH - MIN_CHALLENGE_LENGTH) * drand48());
 		esp->es_challen = challen;
-		ptr = esp->es_challenge;
-		while (--challen >= 0)
-			*ptr++ = drand48() * 0x100;
+		random_bytes(esp->es_challenge, challen);
 		BCOPY(esp->es_challenge, outp, esp->es_challen);
 		INCPTR(esp->es_challen, outp);
 		break;
@@ -98,6 +98,7 @@ void
 fsm_lowerup(f)
     fsm *f;
 {
+    f->nresent = 0;
     switch( f->state ){
     case INITIAL:
 	f->state = CLOSED;
@@ -299,6 +300,7 @@ fsm_timeout(arg)
 		      (u_char *) f->term_reason, f->term_reason_len);
 	    TIMEOUT(fsm_timeout, f, f->timeouttime);
 	    --f->retransmits;
+	    ++f->nresent;
 	}
 	break;
 
@@ -316,6 +318,7 @@ fsm_timeout(arg)
 	    if (f->callbacks->retransmit)
 		(*f->callbacks->retransmit)(f);
 	    fsm_sconfreq(f, 1);		/* Re-send Configure-Request */
+	    ++f->nresent;
 	    if( f->state == ACKRCVD )
 		f->state = REQSENT;
 	}
@@ -461,6 +464,7 @@ fsm_rconfreq(f, id, inp, len)
 	if (f->state == ACKRCVD) {
 	    UNTIMEOUT(fsm_timeout, f);	/* Cancel timeout */
 	    f->state = OPENED;
+	    setup_event(PROTO_NAME(f), f->nresent);
 	    if (f->callbacks->up)
 		(*f->callbacks->up)(f);	/* Inform upper layers */
 	} else
@@ -520,6 +524,7 @@ fsm_rconfack(f, id, inp, len)
 	UNTIMEOUT(fsm_timeout, f);	/* Cancel timeout */
 	f->state = OPENED;
 	f->retransmits = f->maxconfreqtransmits;
+	setup_event(PROTO_NAME(f), f->nresent);
 	if (f->callbacks->up)
 	    (*f->callbacks->up)(f);	/* Inform upper layers */
 	break;
@@ -74,6 +74,7 @@ typedef struct fsm {
     int timeouttime;		/* Timeout time in milliseconds */
     int maxconfreqtransmits;	/* Maximum Configure-Request transmissions */
     int retransmits;		/* Number of retransmissions left */
+    int nresent;		/* # retransmissions since lower layer up */
     int maxtermtransmits;	/* Maximum Terminate-Request transmissions */
     int nakloops;		/* Number of nak loops since last ack */
     int rnakloops;		/* Number of naks received */
@@ -2060,6 +2060,7 @@ ipcp_script_done(arg)
     ipcp_script_pid = 0;
     switch (ipcp_script_state) {
     case s_up:
+	setup_event("IP_UP", -1);
 	if (ipcp_fsm[0].state != OPENED) {
 	    ipcp_script_state = s_down;
 	    ipcp_script(_PATH_IPDOWN, 0);
@@ -1362,6 +1362,7 @@ ipv6cp_script_done(arg)
     ipv6cp_script_pid = 0;
     switch (ipv6cp_script_state) {
     case s_up:
+	setup_event("IPV6_UP", -1);
 	if (ipv6cp_fsm[0].state != OPENED) {
 	    ipv6cp_script_state = s_down;
 	    ipv6cp_script(_PATH_IPV6DOWN);
@@ -44,9 +44,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include "pppd.h"
 #include "magic.h"
@@ -56,22 +63,213 @@ static const char rcsid[] = RCSID;
 extern long mrand48 __P((void));
 extern void srand48 __P((long));
 
+/*
+ * Random numbers come from ChaCha20 run as a generator, keyed from
+ * the kernel, and made a buffer at a time.  The first 32 bytes of
+ * each buffer become the next key, so nothing that was handed out
+ * can be worked back from the state, and bytes are wiped from the
+ * buffer as they are handed out.  The state lives in a page of its
+ * own which, where the kernel can do it, a child gets zeroed after
+ * fork(), so that a child never repeats its parent's numbers;
+ * otherwise we notice the change of pid.
+ */
+#define RNG_KEYLEN	32
+#define RNG_BUFLEN	(16 * 64)	/* sixteen ChaCha20 blocks */
+#define RNG_RESEED	(1600 * 1024)	/* bytes between reseeds */
+
+struct rng_state {
+    int		seeded;
+    pid_t	pid;
+    int		avail;			/* unused bytes at the end of buf */
+    long	left;			/* bytes until we reseed */
+    u_int32_t	key[RNG_KEYLEN / 4];
+    u_char	buf[RNG_BUFLEN];
+};
+
+static struct rng_state *rng;
+static int rng_wipeonfork;
+
+#define ROTL32(v, n)	((v) << (n) | (v) >> (32 - (n)))
+#define QR(a, b, c, d)						\
+    a += b; d ^= a; d = ROTL32(d, 16);				\
+    c += d; b ^= c; b = ROTL32(b, 12);				\
+    a += b; d ^= a; d = ROTL32(d, 8);				\
+    c += d; b ^= c; b = ROTL32(b, 7)
+
+/*
+ * chacha20_block - one 64-byte block of ChaCha20 (RFC 8439) for the
+ * given 16-word input, which is left alone.
+ */
+static void
+chacha20_block(const u_int32_t in[16], u_char *out)
+{
+    u_int32_t x[16];
+    int i;
+
+    memcpy(x, in, sizeof(x));
+    for (i = 0; i < 10; ++i) {
+	QR(x[0], x[4], x[8], x[12]);
+	QR(x[1], x[5], x[9], x[13]);
+	QR(x[2], x[6], x[10], x[14]);
+	QR(x[3], x[7], x[11], x[15]);
+	QR(x[0], x[5], x[10], x[15]);
+	QR(x[1], x[6], x[11], x[12]);
+	QR(x[2], x[7], x[8], x[13]);
+	QR(x[3], x[4], x[9], x[14]);
+    }
+    for (i = 0; i < 16; ++i) {
+	x[i] += in[i];
+	*out++ = x[i];
+	*out++ = x[i] >> 8;
+	*out++ = x[i] >> 16;
+	*out++ = x[i] >> 24;
+    }
+}
+
+/*
+ * rng_refill - fill the buffer from the current key and take the
+ * next key from the start of it.
+ */
+static void
+rng_refill()
+{
+    u_int32_t in[16];
+    u_char *p;
+    int i;
+
+    in[0] = 0x61707865;		/* "expand 32-byte k" */
+    in[1] = 0x3320646e;
+    in[2] = 0x79622d32;
+    in[3] = 0x6b206574;
+    memcpy(in + 4, rng->key, RNG_KEYLEN);
+    in[13] = in[14] = in[15] = 0;
+    for (i = 0; i < RNG_BUFLEN / 64; ++i) {
+	in[12] = i;
+	chacha20_block(in, rng->buf + i * 64);
+    }
+    p = rng->buf;
+    for (i = 0; i < RNG_KEYLEN / 4; ++i, p += 4)
+	rng->key[i] = p[0] | (p[1] << 8) | (p[2] << 16)
+	    | ((u_int32_t)p[3] << 24);
+    memset(rng->buf, 0, RNG_KEYLEN);
+    memset(in, 0, sizeof(in));
+    rng->avail = RNG_BUFLEN - RNG_KEYLEN;
+}
+
+/*
+ * get_entropy - read len bytes from the kernel.  Returns 0 on failure.
+ */
+static int
+get_entropy(u_char *buf, int len)
+{
+    int fd, n;
+
+#ifdef SYS_getrandom
+    while (len > 0) {
+	n = syscall(SYS_getrandom, buf, len, 0);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	buf += n;
+	len -= n;
+    }
+    if (len == 0)
+	return 1;
+#endif
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0)
+	return 0;
+    while (len > 0) {
+	n = read(fd, buf, len);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    break;
+	buf += n;
+	len -= n;
+    }
+    close(fd);
+    return len == 0;
+}
+
+/*
+ * rng_seed - mix fresh kernel randomness into the key.  If there is
+ * none to be had (no getrandom and no /dev/urandom, say in a chroot),
+ * fall back on what we used to seed from, which is better than
+ * nothing, and say so once.
+ */
+static void
+rng_seed()
+{
+    u_int32_t seed[RNG_KEYLEN / 4];
+    struct timeval t;
+    static int warned;
+    int i;
+
+    if (!get_entropy((u_char *) seed, sizeof(seed))) {
+	if (!warned) {
+	    warn("No kernel random numbers; challenges will be predictable");
+	    warned = 1;
+	}
+	gettimeofday(&t, NULL);
+	seed[0] = get_host_seed();
+	seed[1] = t.tv_sec;
+	seed[2] = t.tv_usec;
+	seed[3] = getpid();
+    }
+    for (i = 0; i < RNG_KEYLEN / 4; ++i)
+	rng->key[i] ^= seed[i];
+    memset(seed, 0, sizeof(seed));
+    rng->pid = getpid();
+    rng->left = RNG_RESEED;
+    rng->seeded = 1;
+    rng_refill();
+}
+
+/*
+ * rng_check - make sure the generator is ready to use, and that this
+ * process isn't carrying on from where its parent left off.
+ */
+static void
+rng_check()
+{
+    static struct rng_state fallback;
+    void *p;
+
+    if (rng == NULL) {
+#ifdef MAP_ANONYMOUS
+	p = mmap(NULL, sizeof(struct rng_state), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#else
+	p = MAP_FAILED;
+#endif
+	if (p == MAP_FAILED) {
+	    rng = &fallback;
+	} else {
+	    rng = p;
+#ifdef MADV_WIPEONFORK
+	    if (madvise(p, sizeof(struct rng_state), MADV_WIPEONFORK) == 0)
+		rng_wipeonfork = 1;
+#endif
+	}
+    }
+    if (!rng->seeded || (!rng_wipeonfork && rng->pid != getpid()))
+	rng_seed();
+}
+
 /*
  * magic_init - Initialize the magic number generator.
  *
- * Attempts to compute a random number seed which will not repeat.
- * The current method uses the current hostid, current process ID
- * and current time, currently.
+ * Seeds the generator from the kernel.  drand48() is still used for
+ * things like packet IDs, so seed that from the generator too.
  */
 void
 magic_init()
 {
-    long seed;
-    struct timeval t;
-
-    gettimeofday(&t, NULL);
-    seed = get_host_seed() ^ t.tv_sec ^ t.tv_usec ^ getpid();
-    srand48(seed);
+    rng_check();
+    srand48((long) magic());
 }
 
 /*
@@ -80,7 +278,10 @@ magic_init()
 u_int32_t
 magic()
 {
-    return (u_int32_t) mrand48();
+    u_int32_t m;
+
+    random_bytes((unsigned char *) &m, sizeof(m));
+    return m;
 }
 
 /*
@@ -89,10 +290,26 @@ magic()
 void
 random_bytes(unsigned char *buf, int len)
 {
-	int i;
+	u_char *p;
+	int n;
 
-	for (i = 0; i < len; ++i)
-		buf[i] = mrand48() >> 24;
+	rng_check();
+	while (len > 0) {
+		if (rng->avail == 0) {
+			if (rng->left <= 0)
+				rng_seed();
+			else
+				rng_refill();
+		}
+		n = len < rng->avail ? len : rng->avail;
+		p = rng->buf + RNG_BUFLEN - rng->avail;
+		memcpy(buf, p, n);
+		memset(p, 0, n);
+		rng->avail -= n;
+		rng->left -= n;
+		buf += n;
+		len -= n;
+	}
 }
 
 #ifdef NO_DRAND48
@@ -81,6 +81,7 @@
 #include <utmp.h>
 #include <pwd.h>
 #include <setjmp.h>
+#include <limits.h>
 #include <sys/param.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -90,6 +91,9 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#ifdef USE_EPOLL
+#include <sys/signalfd.h>
+#endif
 
 #include "pppd.h"
 #include "magic.h"
@@ -155,6 +159,17 @@ int childwait_done;		/* have timed out waiting for children */
 
 #ifdef USE_TDB
 TDB_CONTEXT *pppdb;		/* database for storing status etc. */
+
+/*
+ * Changes to our database entry and lookup keys are noted here
+ * and written out together by flush_db.
+ */
+static int db_dirty;		/* our entry needs rewriting */
+static int db_keys_dirty;	/* lookup keys may need adding/deleting */
+static char **db_keys;		/* lookup keys now in the database */
+static int db_nkeys, db_keys_nalloc;
+static unsigned long db_updates;	/* changes requested */
+static unsigned long db_stores;		/* tdb stores/deletes done */
 #endif
 
 char db_key[32];
@@ -182,6 +197,9 @@ int got_sighup;
 static sigset_t signals_handled;
 static int waiting;
 static sigjmp_buf sigjmp;
+#ifdef USE_EPOLL
+static int signal_fd = -1;	/* signalfd for signals_handled */
+#endif
 
 char **script_env;		/* Env. variable values for scripts */
 int s_env_nalloc;		/* # words avail at script_env */
@@ -202,9 +220,49 @@ int ngroups;			/* How many groups valid in groups */
 static struct timeval start_time;	/* Time when link was started. */
 
 static struct pppd_stats old_link_stats;
+
+/*
+ * Times at which each step of bringing up the link finished, in ms
+ * since the link was started, so we can see where setup time goes.
+ */
+#define MAX_SETUP_EVENTS	16
+
+static struct setup_event {
+    char	name[16];
+    int		msec;
+    int		nresent;	/* # FSM retransmissions, or -1 */
+} setup_events[MAX_SETUP_EVENTS];
+static int n_setup_events;
+static struct timeval setup_start;	/* when the link was started */
+
+/* Counts of packets received per wakeup, for tuning recv-batch */
+static struct {
+    unsigned int wakeups;	/* # calls to get_input that read something */
+    unsigned int packets;	/* total # packets read */
+    unsigned int max_batch;	/* most packets read in one call */
+    unsigned int full_batches;	/* # times we stopped at recv_batch */
+} rx_batch_stats;
 struct pppd_stats link_stats;
 unsigned link_connect_time;
 int link_stats_valid;
+static int link_stats_unexported;	/* env doesn't have link_stats yet */
+
+/*
+ * Samples of the link byte counters, taken every rate_interval
+ * seconds while the link is up, from which get_link_rates works out
+ * the peak and 95th percentile throughput.  Once the ring is full
+ * the oldest sample is overwritten.
+ */
+#define RATE_SAMPLES	128
+
+static struct rate_sample {
+    struct timeval t;
+    u_int64_t	bytes_in;
+    u_int64_t	bytes_out;
+} rate_samples[RATE_SAMPLES];
+static int n_rate_samples;	/* # valid samples */
+static int rate_sample_next;	/* where the next sample goes */
+static int rate_sample_unit;
 
 int error_count;
 
@@ -226,6 +284,9 @@ struct subprocess {
 
 static struct subprocess *children;
 
+static int helper_fd = -1;	/* socket to script helper process */
+static pid_t helper_pid;	/* pid of script helper process */
+
 /* Prototypes for procedures local to this file. */
 
 static void setup_signals __P((void));
@@ -233,6 +294,10 @@ static void create_pidfile __P((int pid));
 static void create_linkpidfile __P((int pid));
 static void cleanup __P((void));
 static void get_input __P((void));
+static void reset_setup_events __P((void));
+static void sample_link_rate __P((void *));
+static void link_stats_setenv __P((void));
+static void input_packet __P((u_char *, int));
 static void calltimeout __P((void));
 static struct timeval *timeleft __P((struct timeval *));
 static void kill_my_pg __P((int));
@@ -244,17 +309,27 @@ static void open_ccp __P((int));
 static void bad_signal __P((int));
 static void holdoff_end __P((void *));
 static void forget_child __P((int pid, int status));
+static void start_script_helper __P((void));
+static pid_t helper_run_program __P((char *, char **, int));
+static int helper_wait __P((pid_t, int *));
+static void helper_reap __P((void));
 static int reap_kids __P((void));
 static void childwait_end __P((void *));
 
 #ifdef USE_TDB
+static void flush_db __P((void));
 static void update_db_entry __P((void));
-static void add_db_key __P((const char *));
-static void delete_db_key __P((const char *));
+static void update_db_keys __P((void));
+static void add_db_key __P((char *));
+static void delete_db_key __P((char *));
+static char *db_list_find __P((TDB_DATA, char *));
 static void cleanup_db __P((void));
 #endif
 
 static void handle_events __P((void));
+#ifdef USE_EPOLL
+static void read_signal_fd __P((void));
+#endif
 void print_link_stats __P((void));
 
 extern	char	*getlogin __P((void));
@@ -428,10 +503,15 @@ main(argc, argv)
     sys_init();
 
 #ifdef USE_TDB
+#ifdef USE_TDB_MUTEX
+    pppdb = tdb_open(_PATH_PPPDB, 0, TDB_MUTEX_LOCKING, O_RDWR|O_CREAT, 0644);
+#else
     pppdb = tdb_open(_PATH_PPPDB, 0, 0, O_RDWR|O_CREAT, 0644);
+#endif
     if (pppdb != NULL) {
 	slprintf(db_key, sizeof(db_key), "pppd%d", getpid());
-	update_db_entry();
+	db_dirty = 1;
+	++db_updates;
     } else {
 	warn("Warning: couldn't open ppp database %s", _PATH_PPPDB);
 	if (multilink) {
@@ -463,6 +543,9 @@ main(argc, argv)
     slprintf(numbuf, sizeof(numbuf), "%d", getpid());
     script_setenv("PPPD_PID", numbuf, 1);
 
+    if (!noscripthelper)
+	start_script_helper();
+
     setup_signals();
 
     create_linkpidfile(getpid());
@@ -522,7 +605,9 @@ main(argc, argv)
 	    info("Starting link");
 	}
 
-	gettimeofday(&start_time, NULL);
+	get_time(&start_time);
+	memset(&rx_batch_stats, 0, sizeof(rx_batch_stats));
+	reset_setup_events();
 	script_unsetenv("CONNECT_TIME");
 	script_unsetenv("BYTES_SENT");
 	script_unsetenv("BYTES_RCVD");
@@ -600,7 +685,24 @@ handle_events()
 {
     struct timeval timo;
 
+#ifdef USE_TDB
+    flush_db();		/* write out this iteration's database changes */
+#endif
     kill_link = open_ccp_flag = 0;
+#ifdef USE_EPOLL
+    if (signal_fd >= 0) {
+	/*
+	 * The signals we care about stay blocked while we wait, so
+	 * they show up as input on signal_fd instead of interrupting
+	 * us, and we don't need the siglongjmp dance below.
+	 */
+	sigprocmask(SIG_BLOCK, &signals_handled, NULL);
+	if (!(got_sighup || got_sigterm || got_sigusr2 || got_sigchld))
+	    wait_input(timeleft(&timo));
+	read_signal_fd();
+	sigprocmask(SIG_UNBLOCK, &signals_handled, NULL);
+    } else
+#endif
     if (sigsetjmp(sigjmp, 1) == 0) {
 	sigprocmask(SIG_BLOCK, &signals_handled, NULL);
 	if (got_sighup || got_sigterm || got_sigusr2 || got_sigchld) {
@@ -632,6 +734,8 @@ handle_events()
 	got_sigchld = 0;
 	reap_kids();	/* Don't leave dead kids lying around */
     }
+    if (helper_fd >= 0)
+	helper_reap();	/* collect exits reported by the script helper */
     if (got_sigusr2) {
 	open_ccp_flag = 1;
 	got_sigusr2 = 0;
@@ -719,7 +823,49 @@ setup_signals()
      * be sufficient.
      */
     signal(SIGPIPE, SIG_IGN);
+
+#ifdef USE_EPOLL
+    /*
+     * The handlers above still catch signals that arrive while we
+     * are outside handle_events (e.g. waiting for a connect script);
+     * inside it, they are delivered through signal_fd.
+     */
+    signal_fd = signalfd(-1, &signals_handled, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd >= 0)
+	add_fd(signal_fd);
+#endif
+}
+
+#ifdef USE_EPOLL
+/*
+ * read_signal_fd - collect any signals queued on signal_fd and
+ * pass them to the same routines that would have caught them.
+ * Called with signals_handled blocked.
+ */
+static void
+read_signal_fd()
+{
+    struct signalfd_siginfo si;
+
+    while (read(signal_fd, &si, sizeof(si)) == sizeof(si)) {
+	switch (si.ssi_signo) {
+	case SIGHUP:
+	    hup(si.ssi_signo);
+	    break;
+	case SIGINT:
+	case SIGTERM:
+	    term(si.ssi_signo);
+	    break;
+	case SIGCHLD:
+	    chld(si.ssi_signo);
+	    break;
+	case SIGUSR2:
+	    open_ccp(si.ssi_signo);
+	    break;
+	}
+    }
 }
+#endif
 
 /*
  * set_ifunit - do things we need to do once we know which ppp
@@ -769,6 +915,23 @@ detach()
 	    create_linkpidfile(pid);
 	exit(0);		/* parent dies */
     }
+#ifdef USE_TDB
+    /*
+     * fcntl locks aren't inherited over fork, and the database's
+     * ACTIVE_LOCK tells others that we are using its chain mutexes,
+     * so open it again to take the locks as ourselves.  Until we do,
+     * we hold no chain lock, so nothing is lost if a new pppd sees
+     * nobody using the database meanwhile and resets the mutexes.
+     */
+    if (pppdb != NULL && tdb_reopen(pppdb) != 0) {
+	warn("Warning: couldn't reopen ppp database %s", _PATH_PPPDB);
+	pppdb = NULL;
+	if (multilink) {
+	    warn("Warning: disabling multilink");
+	    multilink = 0;
+	}
+    }
+#endif
     setsid();
     chdir("/");
     dup2(fd_devnull, 0);
@@ -1013,35 +1176,64 @@ protocol_name(proto)
 
 /*
  * get_input - called when incoming data is available.
+ * We read and process up to recv_batch packets, stopping early
+ * once there is nothing more to read or the link has gone down,
+ * so that a burst of control packets costs one trip round the
+ * event loop rather than one per packet.
  */
 static void
 get_input()
 {
-    int len, i;
-    u_char *p;
-    u_short protocol;
-    struct protent *protp;
-
-    p = inpacket_buf;	/* point to beginning of packet buffer */
+    int len, n;
 
-    len = read_packet(inpacket_buf);
-    if (len < 0)
-	return;
+    for (n = 0; n < recv_batch; ) {
+	len = read_packet(inpacket_buf);
+	if (len < 0)
+	    break;
 
-    if (len == 0) {
-	if (bundle_eof && multilink_master) {
-	    notice("Last channel has disconnected");
-	    mp_bundle_terminated();
-	    return;
+	if (len == 0) {
+	    if (bundle_eof && multilink_master) {
+		notice("Last channel has disconnected");
+		mp_bundle_terminated();
+		break;
+	    }
+	    notice("Modem hangup");
+	    hungup = 1;
+	    status = EXIT_HANGUP;
+	    lcp_lowerdown(0);	/* serial link is no longer available */
+	    link_terminated(0);
+	    break;
 	}
-	notice("Modem hangup");
-	hungup = 1;
-	status = EXIT_HANGUP;
-	lcp_lowerdown(0);	/* serial link is no longer available */
-	link_terminated(0);
-	return;
+
+	++n;
+	input_packet(inpacket_buf, len);
+	if (phase == PHASE_DEAD || kill_link || asked_to_quit)
+	    break;
     }
 
+    if (n > 0) {
+	++rx_batch_stats.wakeups;
+	rx_batch_stats.packets += n;
+	if (n > rx_batch_stats.max_batch)
+	    rx_batch_stats.max_batch = n;
+	if (n >= recv_batch)
+	    ++rx_batch_stats.full_batches;
+    }
+}
+
+/*
+ * input_packet - process one received packet and pass it to the
+ * appropriate protocol's input routine.
+ */
+static void
+input_packet(p, len)
+    u_char *p;
+    int len;
+{
+    int i;
+    u_short protocol;
+    struct protent *protp;
+
     if (len < PPP_HDRLEN) {
 	dbglog("received short packet:%.*B", len, p);
 	return;
@@ -1150,11 +1342,119 @@ new_phase(p)
     int p;
 {
     phase = p;
+    switch (p) {
+    case PHASE_ESTABLISH:
+	setup_event("ESTABLISH", -1);
+	break;
+    case PHASE_AUTHENTICATE:
+	setup_event("AUTH_START", -1);
+	break;
+    case PHASE_NETWORK:
+	setup_event("AUTH_DONE", -1);
+	break;
+    }
     if (new_phase_hook)
 	(*new_phase_hook)(p);
     notify(phasechange, p);
 }
 
+/*
+ * setup_event - note that a step in bringing up the link, such as
+ * a protocol reaching the Opened state, has finished.  Only the
+ * first occurrence of each step after the link is started counts.
+ * The time taken, and the number of retransmissions if nresent is
+ * not negative, are put in the script environment.
+ */
+void
+setup_event(name, nresent)
+    char *name;
+    int nresent;
+{
+    struct setup_event *ep;
+    struct timeval now;
+    char var[32], numbuf[16], *p;
+    int i;
+
+    if (setup_start.tv_sec == 0 && setup_start.tv_usec == 0)
+	return;
+    if (n_setup_events >= MAX_SETUP_EVENTS || get_time(&now) < 0)
+	return;
+
+    ep = &setup_events[n_setup_events];
+    strlcpy(ep->name, name, sizeof(ep->name));
+    for (p = ep->name; *p != 0; ++p) {
+	if (islower((unsigned char) *p))
+	    *p = toupper((unsigned char) *p);
+	else if (!isalnum((unsigned char) *p))
+	    *p = '_';
+    }
+    for (i = 0; i < n_setup_events; ++i)
+	if (strcmp(setup_events[i].name, ep->name) == 0)
+	    return;
+    ++n_setup_events;
+    ep->msec = (now.tv_sec - setup_start.tv_sec) * 1000
+	+ (now.tv_usec - setup_start.tv_usec) / 1000;
+    ep->nresent = nresent;
+
+    slprintf(var, sizeof(var), "SETUP_%s_MS", ep->name);
+    slprintf(numbuf, sizeof(numbuf), "%d", ep->msec);
+    script_setenv(var, numbuf, 0);
+    if (nresent >= 0) {
+	slprintf(var, sizeof(var), "SETUP_%s_RESENT", ep->name);
+	slprintf(numbuf, sizeof(numbuf), "%d", nresent);
+	script_setenv(var, numbuf, 0);
+    }
+}
+
+/*
+ * reset_setup_events - forget the setup times for the previous link.
+ */
+static void
+reset_setup_events()
+{
+    char var[32];
+    int i;
+
+    for (i = 0; i < n_setup_events; ++i) {
+	slprintf(var, sizeof(var), "SETUP_%s_MS", setup_events[i].name);
+	script_unsetenv(var);
+	if (setup_events[i].nresent >= 0) {
+	    slprintf(var, sizeof(var), "SETUP_%s_RESENT",
+		     setup_events[i].name);
+	    script_unsetenv(var);
+	}
+    }
+    n_setup_events = 0;
+    get_time(&setup_start);
+}
+
+/*
+ * format_setup_times - put a summary of the setup times so far in
+ * buf, as space-separated NAME=ms entries, with /n appended for
+ * the number of retransmissions where that is known.
+ */
+void
+format_setup_times(buf, len)
+    char *buf;
+    int len;
+{
+    struct setup_event *ep;
+    int i, n;
+
+    *buf = 0;
+    for (i = 0; i < n_setup_events && len > 1; ++i) {
+	ep = &setup_events[i];
+	if (ep->nresent >= 0)
+	    n = slprintf(buf, len, "%s%s=%d/%d", (i? " ": ""), ep->name,
+			 ep->msec, ep->nresent);
+	else
+	    n = slprintf(buf, len, "%s%s=%d", (i? " ": ""), ep->name,
+			 ep->msec);
+	buf += n;
+	len -= n;
+    }
+}
+
 /*
  * die - clean up state and exit with the specified status.
  */
@@ -1198,13 +1498,40 @@ print_link_stats()
     /*
      * Print connect time and statistics.
      */
+    struct link_rates r;
+    char sent[32], rcvd[32];
+
+    UNTIMEOUT(sample_link_rate, NULL);
     if (link_stats_valid) {
        int t = (link_connect_time + 5) / 6;    /* 1/10ths of minutes */
        info("Connect time %d.%d minutes.", t/10, t%10);
-       info("Sent %u bytes, received %u bytes.",
-	    link_stats.bytes_out, link_stats.bytes_in);
+       snprintf(sent, sizeof(sent), "%llu",
+		(unsigned long long) link_stats.bytes_out);
+       snprintf(rcvd, sizeof(rcvd), "%llu",
+		(unsigned long long) link_stats.bytes_in);
+       info("Sent %s bytes, received %s bytes.", sent, rcvd);
+       if (get_link_rates(&r)) {
+	   snprintf(sent, sizeof(sent), "%llu/%llu",
+		    (unsigned long long) r.peak_out,
+		    (unsigned long long) r.p95_out);
+	   snprintf(rcvd, sizeof(rcvd), "%llu/%llu",
+		    (unsigned long long) r.peak_in,
+		    (unsigned long long) r.p95_in);
+	   info("Peak/95th percentile bytes per second: sent %s, received %s.",
+		sent, rcvd);
+       }
+       link_stats_setenv();
        link_stats_valid = 0;
     }
+    if (rx_batch_stats.wakeups > 0) {
+	dbglog("Received %u control packets in %u wakeups "
+	       "(max %u per wakeup, %u reached recv-batch limit)",
+	       rx_batch_stats.packets, rx_batch_stats.wakeups,
+	       rx_batch_stats.max_batch, rx_batch_stats.full_batches);
+	memset(&rx_batch_stats, 0, sizeof(rx_batch_stats));
+    }
+    if (demand)
+	demand_print_stats();
 }
 
 /*
@@ -1216,7 +1543,85 @@ reset_link_stats(u)
 {
     if (!get_ppp_stats(u, &old_link_stats))
 	return;
-    gettimeofday(&start_time, NULL);
+    get_time(&start_time);
+
+    n_rate_samples = rate_sample_next = 0;
+    rate_sample_unit = u;
+    UNTIMEOUT(sample_link_rate, NULL);
+    if (rate_interval > 0)
+	sample_link_rate(NULL);
+}
+
+/*
+ * sample_link_rate - add the current counters to the rate sample ring.
+ */
+static void
+sample_link_rate(arg)
+    void *arg;
+{
+    struct pppd_stats s;
+    struct rate_sample *rs;
+
+    if (get_ppp_stats(rate_sample_unit, &s)) {
+	rs = &rate_samples[rate_sample_next];
+	get_time(&rs->t);
+	rs->bytes_in = s.bytes_in;
+	rs->bytes_out = s.bytes_out;
+	rate_sample_next = (rate_sample_next + 1) % RATE_SAMPLES;
+	if (n_rate_samples < RATE_SAMPLES)
+	    ++n_rate_samples;
+    }
+    TIMEOUT(sample_link_rate, NULL, rate_interval);
+}
+
+static int
+rate_cmp(a, b)
+    const void *a, *b;
+{
+    u_int64_t x = *(const u_int64_t *) a, y = *(const u_int64_t *) b;
+
+    return x < y? -1: x > y;
+}
+
+/*
+ * get_link_rates - work out the peak and 95th percentile throughput,
+ * in bytes per second, over the intervals between the samples we
+ * have for this session.  Returns 0 if we don't have enough samples.
+ */
+int
+get_link_rates(r)
+    struct link_rates *r;
+{
+    u_int64_t in[RATE_SAMPLES], out[RATE_SAMPLES];
+    struct rate_sample *a, *b;
+    long ms;
+    int i, n, first;
+
+    if (n_rate_samples < 2)
+	return 0;
+    first = (rate_sample_next - n_rate_samples + RATE_SAMPLES) % RATE_SAMPLES;
+    n = 0;
+    for (i = 1; i < n_rate_samples; ++i) {
+	a = &rate_samples[(first + i - 1) % RATE_SAMPLES];
+	b = &rate_samples[(first + i) % RATE_SAMPLES];
+	ms = (b->t.tv_sec - a->t.tv_sec) * 1000
+	    + (b->t.tv_usec - a->t.tv_usec) / 1000;
+	if (ms <= 0)
+	    continue;
+	in[n] = (b->bytes_in - a->bytes_in) * 1000 / ms;
+	out[n] = (b->bytes_out - a->bytes_out) * 1000 / ms;
+	++n;
+    }
+    if (n == 0)
+	return 0;
+    qsort(in, n, sizeof(in[0]), rate_cmp);
+    qsort(out, n, sizeof(out[0]), rate_cmp);
+    r->nsamples = n;
+    r->peak_in = in[n-1];
+    r->peak_out = out[n-1];
+    r->p95_in = in[(n * 95 - 1) / 100];
+    r->p95_out = out[(n * 95 - 1) / 100];
+    return 1;
 }
 
 /*
@@ -1227,10 +1632,9 @@ update_link_stats(u)
     int u;
 {
     struct timeval now;
-    char numbuf[32];
 
     if (!get_ppp_stats(u, &link_stats)
-	|| gettimeofday(&now, NULL) < 0)
+	|| get_time(&now) < 0)
 	return;
     link_connect_time = now.tv_sec - start_time.tv_sec;
     link_stats_valid = 1;
@@ -1240,25 +1644,203 @@ update_link_stats(u)
     link_stats.pkts_in   -= old_link_stats.pkts_in;
     link_stats.pkts_out  -= old_link_stats.pkts_out;
 
+    /*
+     * This gets called periodically (e.g. for maxoctets and RADIUS
+     * interim updates), so leave putting the values in the script
+     * environment, which also updates the database, until a script
+     * runs or the link goes down.
+     */
+    link_stats_unexported = 1;
+}
+
+/*
+ * link_stats_setenv - put the latest link statistics into the
+ * environment for scripts, if they have changed.
+ */
+static void
+link_stats_setenv()
+{
+    struct link_rates r;
+    char numbuf[32];
+
+    if (!link_stats_unexported)
+	return;
+    link_stats_unexported = 0;
     slprintf(numbuf, sizeof(numbuf), "%u", link_connect_time);
     script_setenv("CONNECT_TIME", numbuf, 0);
-    slprintf(numbuf, sizeof(numbuf), "%u", link_stats.bytes_out);
+    snprintf(numbuf, sizeof(numbuf), "%llu",
+	     (unsigned long long) link_stats.bytes_out);
     script_setenv("BYTES_SENT", numbuf, 0);
-    slprintf(numbuf, sizeof(numbuf), "%u", link_stats.bytes_in);
+    snprintf(numbuf, sizeof(numbuf), "%llu",
+	     (unsigned long long) link_stats.bytes_in);
     script_setenv("BYTES_RCVD", numbuf, 0);
+    if (get_link_rates(&r)) {
+	snprintf(numbuf, sizeof(numbuf), "%llu", (unsigned long long) r.peak_out);
+	script_setenv("PEAK_RATE_SENT", numbuf, 0);
+	snprintf(numbuf, sizeof(numbuf), "%llu", (unsigned long long) r.peak_in);
+	script_setenv("PEAK_RATE_RCVD", numbuf, 0);
+	snprintf(numbuf, sizeof(numbuf), "%llu", (unsigned long long) r.p95_out);
+	script_setenv("P95_RATE_SENT", numbuf, 0);
+	snprintf(numbuf, sizeof(numbuf), "%llu", (unsigned long long) r.p95_in);
+	script_setenv("P95_RATE_RCVD", numbuf, 0);
+    }
 }
 
 
+/*
+ * Pending timeouts are kept in a binary min-heap ordered on expiry
+ * time, so that adding or removing one is O(log n) and finding the
+ * next one due is O(1).  Each entry is also on a hash chain keyed
+ * on (func, arg) so that untimeout doesn't have to search the heap.
+ * Entries are allocated in chunks and recycled through a free list.
+ * Times come from get_time(), which is monotonic where the system
+ * supports it, so stepping the clock doesn't disturb the timers.
+ */
 struct	callout {
     struct timeval	c_time;		/* time at which to call routine */
     void		*c_arg;		/* argument to routine */
     void		(*c_func) __P((void *)); /* routine */
-    struct		callout *c_next;
+    unsigned long	c_seq;		/* orders entries with equal c_time */
+    int			c_index;	/* position in callout_heap */
+    struct		callout *c_next; /* hash chain or free list link */
 };
 
-static struct callout *callout = NULL;	/* Callout list */
+#define CALLOUT_HASH_INIT	64	/* initial # hash chains, power of 2 */
+#define CALLOUT_CHUNK		32	/* # entries allocated at once,
+					   and initial heap size */
+
+static struct callout **callout_heap;	/* heap of pending timeouts */
+static int n_callouts;			/* # entries in callout_heap */
+static int callout_heap_size;		/* # slots allocated */
+static struct callout **callout_hash;	/* hash chains by (func, arg) */
+static unsigned callout_hash_size;	/* # chains, always a power of 2 */
+static struct callout *callout_free;	/* free list of entries */
+static unsigned long callout_seq;	/* next c_seq value */
 static struct timeval timenow;		/* Current time */
 
+#define CALLOUT_BEFORE(a, b) \
+    ((a)->c_time.tv_sec < (b)->c_time.tv_sec \
+     || ((a)->c_time.tv_sec == (b)->c_time.tv_sec \
+	 && ((a)->c_time.tv_usec < (b)->c_time.tv_usec \
+	     || ((a)->c_time.tv_usec == (b)->c_time.tv_usec \
+		 && (a)->c_seq - (b)->c_seq > ULONG_MAX / 2))))
+
+/*
+ * callout_hashfn - hash chain for a given (func, arg) pair.
+ */
+static struct callout **
+callout_hashfn(func, arg)
+    void (*func) __P((void *));
+    void *arg;
+{
+    unsigned long h;
+
+    h = ((unsigned long) func >> 2) ^ (unsigned long) arg;
+    h *= 0x9e3779b1UL;
+    h ^= h >> 15;
+    return &callout_hash[h & (callout_hash_size - 1)];
+}
+
+/*
+ * callout_rehash - resize the hash table to have `size' chains.
+ */
+static void
+callout_rehash(size)
+    unsigned size;
+{
+    struct callout **oldhash = callout_hash;
+    struct callout *p, *next, **pp;
+    unsigned i, oldsize = callout_hash_size;
+
+    callout_hash = (struct callout **) calloc(size, sizeof(struct callout *));
+    if (callout_hash == NULL)
+	fatal("Out of memory in timeout()!");
+    callout_hash_size = size;
+    for (i = 0; i < oldsize; ++i) {
+	for (p = oldhash[i]; p != NULL; p = next) {
+	    next = p->c_next;
+	    pp = callout_hashfn(p->c_func, p->c_arg);
+	    p->c_next = *pp;
+	    *pp = p;
+	}
+    }
+    free(oldhash);
+}
+
+/*
+ * callout_sift_up, callout_sift_down - restore the heap property
+ * after the entry at index i has been made earlier or later.
+ */
+static void
+callout_sift_up(i)
+    int i;
+{
+    struct callout *p = callout_heap[i];
+    int parent;
+
+    while (i > 0) {
+	parent = (i - 1) / 2;
+	if (!CALLOUT_BEFORE(p, callout_heap[parent]))
+	    break;
+	callout_heap[i] = callout_heap[parent];
+	callout_heap[i]->c_index = i;
+	i = parent;
+    }
+    callout_heap[i] = p;
+    p->c_index = i;
+}
+
+static void
+callout_sift_down(i)
+    int i;
+{
+    struct callout *p = callout_heap[i];
+    int child;
+
+    for (;;) {
+	child = 2 * i + 1;
+	if (child >= n_callouts)
+	    break;
+	if (child + 1 < n_callouts
+	    && CALLOUT_BEFORE(callout_heap[child + 1], callout_heap[child]))
+	    ++child;
+	if (!CALLOUT_BEFORE(callout_heap[child], p))
+	    break;
+	callout_heap[i] = callout_heap[child];
+	callout_heap[i]->c_index = i;
+	i = child;
+    }
+    callout_heap[i] = p;
+    p->c_index = i;
+}
+
+/*
+ * callout_remove - take an entry off the heap and its hash chain,
+ * and put it on the free list.
+ */
+static void
+callout_remove(p)
+    struct callout *p;
+{
+    struct callout **pp;
+    int i = p->c_index;
+
+    for (pp = callout_hashfn(p->c_func, p->c_arg); *pp != p;
+	 pp = &(*pp)->c_next)
+	;
+    *pp = p->c_next;
+
+    if (--n_callouts > i) {
+	callout_heap[i] = callout_heap[n_callouts];
+	callout_heap[i]->c_index = i;
+	callout_sift_down(i);
+	callout_sift_up(callout_heap[i]->c_index);
+    }
+
+    p->c_next = callout_free;
+    callout_free = p;
+}
+
 /*
  * timeout - Schedule a timeout.
  */
@@ -1268,16 +1850,43 @@ timeout(func, arg, secs, usecs)
     void *arg;
     int secs, usecs;
 {
-    struct callout *newp, *p, **pp;
+    struct callout *newp, **pp;
+    int i;
 
     /*
      * Allocate timeout.
      */
-    if ((newp = (struct callout *) malloc(sizeof(struct callout))) == NULL)
-	fatal("Out of memory in timeout()!");
+    if (callout_free == NULL) {
+	newp = (struct callout *) malloc(CALLOUT_CHUNK * sizeof(struct callout));
+	if (newp == NULL)
+	    fatal("Out of memory in timeout()!");
+	for (i = 0; i < CALLOUT_CHUNK; ++i) {
+	    newp[i].c_next = callout_free;
+	    callout_free = &newp[i];
+	}
+    }
+    if (n_callouts >= callout_heap_size) {
+	/* double it, so that growing to n entries copies O(n) pointers */
+	int new_size = callout_heap_size? 2 * callout_heap_size: CALLOUT_CHUNK;
+	struct callout **newheap;
+
+	newheap = realloc(callout_heap, new_size * sizeof(struct callout *));
+	if (newheap == NULL)
+	    fatal("Out of memory in timeout()!");
+	callout_heap = newheap;
+	callout_heap_size = new_size;
+    }
+    if (callout_hash_size == 0)
+	callout_rehash(CALLOUT_HASH_INIT);
+    else if (n_callouts >= 2 * callout_hash_size)
+	callout_rehash(2 * callout_hash_size);
+    newp = callout_free;
+    callout_free = newp->c_next;
+
     newp->c_arg = arg;
     newp->c_func = func;
-    gettimeofday(&timenow, NULL);
+    newp->c_seq = callout_seq++;
+    get_time(&timenow);
     newp->c_time.tv_sec = timenow.tv_sec + secs;
     newp->c_time.tv_usec = timenow.tv_usec + usecs;
     if (newp->c_time.tv_usec >= 1000000) {
@@ -1286,15 +1895,13 @@ timeout(func, arg, secs, usecs)
     }
 
     /*
-     * Find correct place and link it in.
+     * Link it into its hash chain and the heap.
      */
-    for (pp = &callout; (p = *pp); pp = &p->c_next)
-	if (newp->c_time.tv_sec < p->c_time.tv_sec
-	    || (newp->c_time.tv_sec == p->c_time.tv_sec
-		&& newp->c_time.tv_usec < p->c_time.tv_usec))
-	    break;
-    newp->c_next = p;
+    pp = callout_hashfn(func, arg);
+    newp->c_next = *pp;
     *pp = newp;
+    callout_heap[n_callouts] = newp;
+    callout_sift_up(n_callouts++);
 }
 
 
@@ -1306,17 +1913,21 @@ untimeout(func, arg)
     void (*func) __P((void *));
     void *arg;
 {
-    struct callout **copp, *freep;
+    struct callout *p, *first;
+
+    if (n_callouts == 0)
+	return;
 
     /*
-     * Find first matching timeout and remove it from the list.
+     * Find the first matching timeout to expire and remove it.
      */
-    for (copp = &callout; (freep = *copp); copp = &freep->c_next)
-	if (freep->c_func == func && freep->c_arg == arg) {
-	    *copp = freep->c_next;
-	    free((char *) freep);
-	    break;
-	}
+    first = NULL;
+    for (p = *callout_hashfn(func, arg); p != NULL; p = p->c_next)
+	if (p->c_func == func && p->c_arg == arg
+	    && (first == NULL || CALLOUT_BEFORE(p, first)))
+	    first = p;
+    if (first != NULL)
+	callout_remove(first);
 }
 
 
@@ -1327,21 +1938,24 @@ static void
 calltimeout()
 {
     struct callout *p;
+    void (*func) __P((void *));
+    void *arg;
 
-    while (callout != NULL) {
-	p = callout;
-
-	if (gettimeofday(&timenow, NULL) < 0)
-	    fatal("Failed to get time of day: %m");
+    if (n_callouts == 0)
+	return;
+    if (get_time(&timenow) < 0)
+	fatal("Failed to get time of day: %m");
+    while (n_callouts > 0) {
+	p = callout_heap[0];
 	if (!(p->c_time.tv_sec < timenow.tv_sec
 	      || (p->c_time.tv_sec == timenow.tv_sec
 		  && p->c_time.tv_usec <= timenow.tv_usec)))
 	    break;		/* no, it's not time yet */
 
-	callout = p->c_next;
-	(*p->c_func)(p->c_arg);
-
-	free((char *) p);
+	func = p->c_func;
+	arg = p->c_arg;
+	callout_remove(p);
+	(*func)(arg);
     }
 }
 
@@ -1353,12 +1967,15 @@ static struct timeval *
 timeleft(tvp)
     struct timeval *tvp;
 {
-    if (callout == NULL)
+    struct callout *p;
+
+    if (n_callouts == 0)
 	return NULL;
 
-    gettimeofday(&timenow, NULL);
-    tvp->tv_sec = callout->c_time.tv_sec - timenow.tv_sec;
-    tvp->tv_usec = callout->c_time.tv_usec - timenow.tv_usec;
+    p = callout_heap[0];
+    get_time(&timenow);
+    tvp->tv_sec = p->c_time.tv_sec - timenow.tv_sec;
+    tvp->tv_usec = p->c_time.tv_usec - timenow.tv_usec;
     if (tvp->tv_usec < 0) {
 	tvp->tv_usec += 1000000;
 	tvp->tv_sec -= 1;
@@ -1566,7 +2183,8 @@ safe_fork(int infd, int outfd, int errfd)
 	/* Executing in the child */
 	sys_close();
 #ifdef USE_TDB
-	tdb_close(pppdb);
+	if (pppdb != NULL)
+		tdb_close(pppdb);
 #endif
 
 	/* make sure infd, outfd and errfd won't get tromped on below */
@@ -1595,6 +2213,12 @@ safe_fork(int infd, int outfd, int errfd)
 		close(devfd);	/* some plugins don't have a close function */
 	close(fd_ppp);
 	close(fd_devnull);
+#ifdef USE_EPOLL
+	if (signal_fd >= 0)
+		close(signal_fd);
+#endif
+	if (helper_fd >= 0)
+		close(helper_fd);
 	if (infd != 0)
 		close(infd);
 	if (outfd != 1)
@@ -1777,8 +2401,14 @@ run_program(prog, args, must_exist, done, arg, wait)
     int wait;
 {
     int pid, status;
+    int via_helper = 0;
     struct stat sbuf;
 
+    link_stats_setenv();
+#ifdef USE_TDB
+    flush_db();
+#endif
+
     /*
      * First check if the file exists and is executable.
      * We don't use access() because that would use the
@@ -1793,7 +2423,13 @@ run_program(prog, args, must_exist, done, arg, wait)
 	return 0;
     }
 
-    pid = safe_fork(fd_devnull, fd_devnull, fd_devnull);
+    pid = -2;
+    if (helper_fd >= 0)
+	pid = helper_run_program(prog, args, must_exist);
+    if (pid == -2)
+	pid = safe_fork(fd_devnull, fd_devnull, fd_devnull);
+    else
+	via_helper = 1;
     if (pid == -1) {
 	error("Failed to create child process for %s: %m", prog);
 	return -1;
@@ -1803,10 +2439,18 @@ run_program(prog, args, must_exist, done, arg, wait)
 	    dbglog("Script %s started (pid %d)", prog, pid);
 	record_child(pid, prog, done, arg, 0);
 	if (wait) {
-	    while (waitpid(pid, &status, 0) < 0) {
-		if (errno == EINTR)
-		    continue;
-		fatal("error waiting for script %s: %m", prog);
+	    if (via_helper) {
+		if (helper_wait(pid, &status) < 0) {
+		    /* helper went away; we'll never hear about it now */
+		    forget_child(pid, 0);
+		    return pid;
+		}
+	    } else {
+		while (waitpid(pid, &status, 0) < 0) {
+		    if (errno == EINTR)
+			continue;
+		    fatal("error waiting for script %s: %m", prog);
+		}
 	    }
 	    forget_child(pid, status);
 	}
@@ -1840,6 +2484,425 @@ run_program(prog, args, must_exist, done, arg, wait)
 }
 
 
+/*
+ * The script helper.  Forking all of pppd for each script gets
+ * expensive as pppd grows, so early on we fork a small helper
+ * process, and afterwards run_program asks it to start scripts for
+ * us over a socketpair.  The helper vforks and execs each script
+ * and sends back its pid, and later its wait status, which we hand
+ * to forget_child() just as though we had reaped it ourselves.
+ * If the helper can't be started or dies, we fall back to forking
+ * scripts from pppd directly.
+ */
+#define HELPER_MAXMSG	65536	/* max size of a request to the helper */
+
+/* Header of a request; followed by prog, args and env strings */
+struct helper_request {
+    int		must_exist;
+    int		nargs;
+    int		nenv;
+};
+
+/* Reply from the helper */
+struct helper_reply {
+    int		type;
+    int		pid;
+    int		status;		/* wait status, or errno for HELPER_STARTED */
+};
+
+#define HELPER_STARTED	1	/* script was started (or couldn't be) */
+#define HELPER_EXITED	2	/* script has exited */
+
+/* Exits reported while we were waiting for something else */
+struct helper_exit {
+    int		pid;
+    int		status;
+    struct helper_exit *next;
+};
+
+static struct helper_exit *helper_exits;
+static volatile int helper_exec_errno;
+
+static void helper_main __P((int));
+
+/*
+ * start_script_helper - create the helper process.
+ */
+static void
+start_script_helper()
+{
+    int fds[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0) {
+	dbglog("Couldn't create script helper socket: %m");
+	return;
+    }
+    pid = safe_fork(fd_devnull, fd_devnull, fd_devnull);
+    if (pid < 0) {
+	warn("Couldn't start script helper: %m");
+	close(fds[0]);
+	close(fds[1]);
+	return;
+    }
+    if (pid == 0) {
+	close(fds[0]);
+	helper_main(fds[1]);
+    }
+    close(fds[1]);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    helper_fd = fds[0];
+    helper_pid = pid;
+    add_fd(helper_fd);
+}
+
+/*
+ * helper_lost - the helper has gone away; stop using it.
+ */
+static void
+helper_lost()
+{
+    warn("Script helper exited; running scripts directly");
+    remove_fd(helper_fd);
+    close(helper_fd);
+    helper_fd = -1;
+}
+
+/*
+ * helper_run_program - ask the helper to run prog with the current
+ * script environment.  Returns the pid, -1 if the helper couldn't
+ * create the process, or -2 if the helper isn't available.
+ */
+static pid_t
+helper_run_program(prog, args, must_exist)
+    char *prog;
+    char **args;
+    int must_exist;
+{
+    struct helper_request *req;
+    struct helper_reply rep;
+    struct helper_exit *ep;
+    struct userenv *uep;
+    char *buf, *p, *q;
+    int i, n, nlen;
+    size_t len;
+
+    buf = malloc(HELPER_MAXMSG);
+    if (buf == NULL)
+	return -2;
+    req = (struct helper_request *) buf;
+    req->must_exist = must_exist;
+    req->nargs = 0;
+    req->nenv = 0;
+    p = buf + sizeof(*req);
+
+#define HELPER_PUT(s)	do { \
+	len = strlen(s) + 1; \
+	if (p + len > buf + HELPER_MAXMSG) \
+	    goto toobig; \
+	memcpy(p, (s), len); \
+	p += len; \
+    } while (0)
+
+    HELPER_PUT(prog);
+    for (i = 0; args[i] != NULL; ++i) {
+	HELPER_PUT(args[i]);
+	++req->nargs;
+    }
+
+    /*
+     * Send the script environment with the user's set/unset
+     * options layered on top, as update_script_environment does.
+     */
+    for (i = 0; script_env != NULL && (q = script_env[i]) != NULL; ++i) {
+	for (uep = userenv_list; uep != NULL; uep = uep->ue_next) {
+	    nlen = strlen(uep->ue_name);
+	    if (strncmp(q, uep->ue_name, nlen) == 0 && q[nlen] == '=')
+		break;
+	}
+	if (uep != NULL)
+	    continue;
+	HELPER_PUT(q);
+	++req->nenv;
+    }
+    for (uep = userenv_list; uep != NULL; uep = uep->ue_next) {
+	if (!uep->ue_isset)
+	    continue;
+	len = strlen(uep->ue_name) + strlen(uep->ue_value) + 2;
+	if (p + len > buf + HELPER_MAXMSG)
+	    goto toobig;
+	slprintf(p, len, "%s=%s", uep->ue_name, uep->ue_value);
+	p += len;
+	++req->nenv;
+    }
+#undef HELPER_PUT
+
+    n = send(helper_fd, buf, p - buf, 0);
+    free(buf);
+    if (n < 0) {
+	helper_lost();
+	return -2;
+    }
+
+    for (;;) {
+	n = recv(helper_fd, &rep, sizeof(rep), 0);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n != sizeof(rep)) {
+	    helper_lost();
+	    return -2;
+	}
+	if (rep.type == HELPER_STARTED)
+	    break;
+	ep = malloc(sizeof(*ep));
+	if (ep == NULL) {
+	    warn("losing track of script process %d", rep.pid);
+	    continue;
+	}
+	ep->pid = rep.pid;
+	ep->status = rep.status;
+	ep->next = helper_exits;
+	helper_exits = ep;
+    }
+
+    if (rep.pid < 0) {
+	errno = rep.status;
+	return -1;
+    }
+    if (rep.status != 0 && (must_exist || rep.status != ENOENT)) {
+	errno = rep.status;
+	error("Can't execute %s: %m", prog);
+    }
+    return rep.pid;
+
+ toobig:
+    free(buf);
+    dbglog("Script environment too large for script helper");
+    return -2;
+}
+
+/*
+ * helper_wait - wait for the helper to report that pid has exited.
+ * Returns 0 and sets *statusp, or -1 if the helper has gone away.
+ */
+static int
+helper_wait(pid, statusp)
+    pid_t pid;
+    int *statusp;
+{
+    struct helper_reply rep;
+    struct helper_exit *ep, **epp;
+    int n;
+
+    for (epp = &helper_exits; (ep = *epp) != NULL; epp = &ep->next) {
+	if (ep->pid == pid) {
+	    *statusp = ep->status;
+	    *epp = ep->next;
+	    free(ep);
+	    return 0;
+	}
+    }
+    for (;;) {
+	n = recv(helper_fd, &rep, sizeof(rep), 0);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n != sizeof(rep)) {
+	    helper_lost();
+	    return -1;
+	}
+	if (rep.type != HELPER_EXITED)
+	    continue;
+	if (rep.pid == pid) {
+	    *statusp = rep.status;
+	    return 0;
+	}
+	ep = malloc(sizeof(*ep));
+	if (ep == NULL) {
+	    warn("losing track of script process %d", rep.pid);
+	    continue;
+	}
+	ep->pid = rep.pid;
+	ep->status = rep.status;
+	ep->next = helper_exits;
+	helper_exits = ep;
+    }
+}
+
+/*
+ * helper_reap - process any exits reported by the helper.
+ */
+static void
+helper_reap()
+{
+    struct helper_reply rep;
+    struct helper_exit *ep;
+    int n;
+
+    while ((ep = helper_exits) != NULL) {
+	helper_exits = ep->next;
+	forget_child(ep->pid, ep->status);
+	free(ep);
+    }
+    while (helper_fd >= 0) {
+	n = recv(helper_fd, &rep, sizeof(rep), MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    break;
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n != sizeof(rep)) {
+	    helper_lost();
+	    break;
+	}
+	if (rep.type == HELPER_EXITED)
+	    forget_child(rep.pid, rep.status);
+    }
+}
+
+/*
+ * helper_sigchld - nothing to do here; the signal just gets us out
+ * of pselect so we can reap the child.
+ */
+static void
+helper_sigchld(sig)
+    int sig;
+{
+}
+
+/*
+ * helper_main - the body of the helper process.  We stay here
+ * until pppd closes its end of the socket.
+ */
+static void
+helper_main(fd)
+    int fd;
+{
+    struct helper_request *req;
+    struct helper_reply rep;
+    struct sigaction sa;
+    sigset_t chld, omask;
+    fd_set ready;
+    char *buf, *p, *end, *prog;
+    char **argv, **envp;
+    int i, n, status;
+    pid_t pid;
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    buf = malloc(HELPER_MAXMSG);
+    if (buf == NULL)
+	_exit(1);
+
+    /*
+     * Our process group gets pppd's signals; we only want to go
+     * away when pppd closes the socket.
+     */
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGHUP, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR2, &sa, NULL);
+    sigaction(SIGPIPE, &sa, NULL);
+    sa.sa_handler = helper_sigchld;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &omask);
+    sigdelset(&omask, SIGCHLD);
+
+    for (;;) {
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+	    rep.type = HELPER_EXITED;
+	    rep.pid = pid;
+	    rep.status = status;
+	    if (send(fd, &rep, sizeof(rep), 0) < 0)
+		_exit(0);
+	}
+
+	FD_ZERO(&ready);
+	FD_SET(fd, &ready);
+	if (pselect(fd + 1, &ready, NULL, NULL, NULL, &omask) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    _exit(1);
+	}
+	n = recv(fd, buf, HELPER_MAXMSG, 0);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= (int) sizeof(*req) || buf[n-1] != 0)
+	    _exit(0);	/* pppd has gone away */
+
+	/*
+	 * Unpack the request.
+	 */
+	req = (struct helper_request *) buf;
+	end = buf + n;
+	argv = malloc((req->nargs + 1) * sizeof(char *));
+	envp = malloc((req->nenv + 1) * sizeof(char *));
+	if (argv == NULL || envp == NULL) {
+	    free(argv);
+	    free(envp);
+	    rep.type = HELPER_STARTED;
+	    rep.pid = -1;
+	    rep.status = ENOMEM;
+	    send(fd, &rep, sizeof(rep), 0);
+	    continue;
+	}
+	p = buf + sizeof(*req);
+	prog = p;
+	for (i = 0; i < req->nargs + req->nenv; ++i) {
+	    p += strlen(p) + 1;
+	    if (p >= end)
+		_exit(1);
+	    if (i < req->nargs)
+		argv[i] = p;
+	    else
+		envp[i - req->nargs] = p;
+	}
+	argv[req->nargs] = NULL;
+	envp[req->nenv] = NULL;
+
+	/*
+	 * Start the script.  The child shares our memory until it
+	 * execs, so it only touches helper_exec_errno.
+	 */
+	helper_exec_errno = 0;
+	pid = vfork();
+	if (pid == 0) {
+	    sa.sa_handler = SIG_DFL;
+	    sigaction(SIGHUP, &sa, NULL);
+	    sigaction(SIGINT, &sa, NULL);
+	    sigaction(SIGTERM, &sa, NULL);
+	    sigaction(SIGUSR2, &sa, NULL);
+	    sigaction(SIGPIPE, &sa, NULL);
+	    sigaction(SIGCHLD, &sa, NULL);
+	    sigprocmask(SIG_SETMASK, &omask, NULL);
+
+	    /* Leave the current location */
+	    (void) setsid();	/* No controlling tty. */
+	    (void) umask (S_IRWXG|S_IRWXO);
+	    (void) chdir ("/");	/* no current directory. */
+	    setuid(0);		/* set real UID = root */
+	    setgid(getegid());
+#ifdef BSD
+	    /* Force the priority back to zero if pppd is running higher. */
+	    (void) setpriority (PRIO_PROCESS, 0, 0);
+#endif
+	    execve(prog, argv, envp);
+	    helper_exec_errno = errno;
+	    _exit(99);
+	}
+	rep.type = HELPER_STARTED;
+	rep.pid = pid;
+	rep.status = (pid < 0)? errno: helper_exec_errno;
+	free(argv);
+	free(envp);
+	if (send(fd, &rep, sizeof(rep), 0) < 0)
+	    _exit(0);
+    }
+}
+
 /*
  * record_child - add a child process to the list for reap_kids
  * to use.
@@ -1928,7 +2991,13 @@ reap_kids()
 
     if (n_children == 0)
 	return 0;
+    if (helper_fd >= 0)
+	helper_reap();
     while ((pid = waitpid(-1, &status, WNOHANG)) != -1 && pid != 0) {
+	if (pid == helper_pid) {
+	    helper_pid = 0;
+	    continue;
+	}
         forget_child(pid, status);
     }
     if (pid == -1) {
@@ -2031,19 +3100,18 @@ script_setenv(var, value, iskey)
     if (script_env != 0) {
 	for (i = 0; (p = script_env[i]) != 0; ++i) {
 	    if (strncmp(p, var, varl) == 0 && p[varl] == '=') {
-#ifdef USE_TDB
-		if (p[-1] && pppdb != NULL)
-		    delete_db_key(p);
-#endif
-		free(p-1);
-		script_env[i] = newstring;
 #ifdef USE_TDB
 		if (pppdb != NULL) {
-		    if (iskey)
-			add_db_key(newstring);
-		    update_db_entry();
+		    if (p[-1] || iskey) {
+			db_keys_dirty = 1;
+			db_updates += (p[-1] != 0) + (iskey != 0);
+		    }
+		    db_dirty = 1;
+		    ++db_updates;
 		}
 #endif
+		free(p-1);
+		script_env[i] = newstring;
 		return;
 	    }
 	}
@@ -2063,9 +3131,12 @@ script_setenv(var, value, iskey)
 
 #ifdef USE_TDB
     if (pppdb != NULL) {
-	if (iskey)
-	    add_db_key(newstring);
-	update_db_entry();
+	if (iskey) {
+	    db_keys_dirty = 1;
+	    ++db_updates;
+	}
+	db_dirty = 1;
+	++db_updates;
     }
 #endif
 }
@@ -2087,16 +3158,20 @@ script_unsetenv(var)
     for (i = 0; (p = script_env[i]) != 0; ++i) {
 	if (strncmp(p, var, vl) == 0 && p[vl] == '=') {
 #ifdef USE_TDB
-	    if (p[-1] && pppdb != NULL)
-		delete_db_key(p);
+	    if (p[-1] && pppdb != NULL) {
+		db_keys_dirty = 1;
+		++db_updates;
+	    }
 #endif
 	    remove_script_env(i);
 	    break;
 	}
     }
 #ifdef USE_TDB
-    if (pppdb != NULL)
-	update_db_entry();
+    if (pppdb != NULL) {
+	db_dirty = 1;
+	++db_updates;
+    }
 #endif
 }
 
@@ -2123,12 +3198,15 @@ void lock_db()
 
 /*
  * unlock_db - remove the exclusive lock obtained by lock_db.
+ * Any changes to our own entry are written out first, so that
+ * they are seen together with whatever was done under the lock.
  */
 void unlock_db()
 {
 #ifdef USE_TDB
 	TDB_DATA key;
 
+	flush_db();
 	key.dptr = PPPD_LOCK_KEY;
 	key.dsize = strlen(key.dptr);
 	tdb_chainunlock(pppdb, key);
@@ -2136,6 +3214,27 @@ void unlock_db()
 }
 
 #ifdef USE_TDB
+/*
+ * flush_db - write out the changes to our database entry and lookup
+ * keys made since the last flush, all under the database lock.
+ */
+static void
+flush_db()
+{
+    if (pppdb == NULL || !(db_dirty || db_keys_dirty))
+	return;
+    lock_db();
+    if (db_keys_dirty) {
+	db_keys_dirty = 0;
+	update_db_keys();
+    }
+    if (db_dirty) {
+	db_dirty = 0;
+	update_db_entry();
+    }
+    unlock_db();
+}
+
 /*
  * update_db_entry - update our entry in the database.
  */
@@ -2162,6 +3261,7 @@ update_db_entry()
     key.dsize = strlen(db_key);
     dbuf.dptr = vbuf;
     dbuf.dsize = vlen;
+    ++db_stores;
     if (tdb_store(pppdb, key, dbuf, TDB_REPLACE))
 	error("tdb_store failed: %s", tdb_errorstr(pppdb));
 
@@ -2171,34 +3271,152 @@ update_db_entry()
 }
 
 /*
- * add_db_key - add a key that we can use to look up our database entry.
+ * update_db_keys - bring the keys we can use to look up our database
+ * entry into line with the key variables now in script_env.
+ * Like script_env, db_keys[] keeps the kind of key in the byte
+ * before each string.
+ */
+static void
+update_db_keys()
+{
+    int i, j;
+    char *p, *k;
+
+    if (script_env == NULL)
+	return;
+
+    /* delete the keys that have gone or changed */
+    for (j = 0; j < db_nkeys; ) {
+	k = db_keys[j];
+	for (i = 0; (p = script_env[i]) != 0; ++i)
+	    if (p[-1] == k[-1] && strcmp(p, k) == 0)
+		break;
+	if (p != 0) {
+	    ++j;
+	    continue;
+	}
+	++db_stores;
+	delete_db_key(k);
+	free(k - 1);
+	db_keys[j] = db_keys[--db_nkeys];
+    }
+
+    /* and add the new ones */
+    for (i = 0; (p = script_env[i]) != 0; ++i) {
+	if (!p[-1])
+	    continue;
+	for (j = 0; j < db_nkeys; ++j)
+	    if (p[-1] == db_keys[j][-1] && strcmp(p, db_keys[j]) == 0)
+		break;
+	if (j < db_nkeys)
+	    continue;
+	if (db_nkeys >= db_keys_nalloc) {
+	    db_keys_nalloc += 8;
+	    db_keys = realloc(db_keys, db_keys_nalloc * sizeof(char *));
+	    if (db_keys == NULL)
+		novm("database key list");
+	}
+	if ((k = malloc(strlen(p) + 2)) == NULL)
+	    novm("database key");
+	*k++ = p[-1];
+	strcpy(k, p);
+	db_keys[db_nkeys++] = k;
+	++db_stores;
+	add_db_key(k);
+    }
+}
+
+/*
+ * add_db_key - make the key `str' (VAR=value) find our entry.
+ * The value of a shared key is a list of the pppds with that
+ * value, each followed by a semicolon.
  */
 static void
 add_db_key(str)
-    const char *str;
+    char *str;
 {
     TDB_DATA key, dbuf;
+    char entry[sizeof(db_key) + 1];
+    int found;
 
-    key.dptr = (char *) str;
+    key.dptr = str;
     key.dsize = strlen(str);
-    dbuf.dptr = db_key;
-    dbuf.dsize = strlen(db_key);
-    if (tdb_store(pppdb, key, dbuf, TDB_REPLACE))
-	error("tdb_store key failed: %s", tdb_errorstr(pppdb));
+    if (str[-1] != ENV_KEY_SHARED) {
+	dbuf.dptr = db_key;
+	dbuf.dsize = strlen(db_key);
+	if (tdb_store(pppdb, key, dbuf, TDB_REPLACE))
+	    error("tdb_store key failed: %s", tdb_errorstr(pppdb));
+	return;
+    }
+
+    slprintf(entry, sizeof(entry), "%s;", db_key);
+    dbuf = tdb_fetch(pppdb, key);
+    if (dbuf.dptr != NULL) {
+	found = db_list_find(dbuf, entry) != NULL;
+	free(dbuf.dptr);
+	if (found)
+	    return;
+    }
+    dbuf.dptr = entry;
+    dbuf.dsize = strlen(entry);
+    if (tdb_append(pppdb, key, dbuf))
+	error("tdb_append key failed: %s", tdb_errorstr(pppdb));
 }
 
 /*
- * delete_db_key - delete a key for looking up our database entry.
+ * delete_db_key - stop the key `str' from finding our entry.
  */
 static void
 delete_db_key(str)
-    const char *str;
+    char *str;
 {
-    TDB_DATA key;
+    TDB_DATA key, dbuf;
+    char entry[sizeof(db_key) + 1];
+    char *p;
+    int l;
 
-    key.dptr = (char *) str;
+    key.dptr = str;
     key.dsize = strlen(str);
-    tdb_delete(pppdb, key);
+    if (str[-1] != ENV_KEY_SHARED) {
+	tdb_delete(pppdb, key);
+	return;
+    }
+
+    slprintf(entry, sizeof(entry), "%s;", db_key);
+    dbuf = tdb_fetch(pppdb, key);
+    if (dbuf.dptr == NULL)
+	return;
+    if ((p = db_list_find(dbuf, entry)) != NULL) {
+	l = strlen(entry);
+	memmove(p, p + l, dbuf.dptr + dbuf.dsize - (p + l));
+	dbuf.dsize -= l;
+	if (dbuf.dsize == 0)
+	    tdb_delete(pppdb, key);
+	else if (tdb_store(pppdb, key, dbuf, TDB_REPLACE))
+	    error("tdb_store key failed: %s", tdb_errorstr(pppdb));
+    }
+    free(dbuf.dptr);
+}
+
+/*
+ * db_list_find - find `entry', which ends in a semicolon, in the
+ * value of a shared key.
+ */
+static char *
+db_list_find(list, entry)
+    TDB_DATA list;
+    char *entry;
+{
+    char *p = list.dptr, *end = list.dptr + list.dsize;
+    int l = strlen(entry);
+
+    while (p != NULL && end - p >= l) {
+	if (memcmp(p, entry, l) == 0)
+	    return p;
+	if ((p = memchr(p, ';', end - p)) != NULL)
+	    ++p;
+    }
+    return NULL;
 }
 
 /*
@@ -2209,13 +3427,21 @@ cleanup_db()
 {
     TDB_DATA key;
     int i;
-    char *p;
 
+    /* shared keys are read, changed and written back */
+    db_dirty = db_keys_dirty = 0;
+    lock_db();
     key.dptr = db_key;
     key.dsize = strlen(db_key);
     tdb_delete(pppdb, key);
-    for (i = 0; (p = script_env[i]) != 0; ++i)
-	if (p[-1])
-	    delete_db_key(p);
+    for (i = 0; i < db_nkeys; ++i) {
+	delete_db_key(db_keys[i]);
+	free(db_keys[i] - 1);
+    }
+    db_nkeys = 0;
+    unlock_db();
+    if (db_updates > db_stores)
+	dbglog("pppdb: %lu updates written with %lu stores (%lu saved)",
+	       db_updates, db_stores, db_updates - db_stores);
 }
 #endif /* USE_TDB */
@@ -9,34 +9,24 @@
 /*
 ** To use MD4:
 **   -- Include md4.h in your program
-**   -- Declare an MDstruct MD to hold the state of the digest
+**   -- Declare an MD4_CTX MD to hold the state of the digest
 **          computation.
-**   -- Initialize MD using MDbegin(&MD)
-**   -- For each full block (64 bytes) X you wish to process, call
-**          MD4Update(&MD,X,512)
-**      (512 is the number of bits in a full block.)
-**   -- For the last block (less than 64 bytes) you wish to process,
-**          MD4Update(&MD,X,n)
-**      where n is the number of bits in the partial block. A partial
-**      block terminates the computation, so every MD computation
-**      should terminate by processing a partial block, even if it
-**      has n = 0.
-**   -- The message digest is available in MD.buffer[0] ...
-**      MD.buffer[3].  (Least-significant byte of each word
-**      should be output first.)
-**   -- You can print out the digest using MDprint(&MD)
+**   -- Initialize MD using MD4_Init(&MD)
+**   -- Feed in the message with as many calls as you like of
+**          MD4_Update(&MD,X,n)
+**      where n is the number of bytes at X.
+**   -- Get the message digest with MD4_Final(buf,&MD).
+**   -- You can print out the digest using MD4Print(&MD)
 */
 
 /* Implementation notes:
 ** This implementation assumes that ints are 32-bit quantities.
 */
 
-#define TRUE  1
-#define FALSE 0
-
 /* Compile-time includes
 */
 #include <stdio.h>
+#include <string.h>
 #include "md4.h"
 #include "pppd.h"
 
@@ -96,40 +86,37 @@ MD4_CTX *MDp;
       printf("%02x",(MDp->buffer[i]>>j) & 0xFF);
 }
 
-/* MD4Init(MDp)
+/* MD4_Init(MDp)
 ** Initialize message digest buffer MDp.
 ** This is a user-callable routine.
 */
 void
-MD4Init(MDp)
+MD4_Init(MDp)
 MD4_CTX *MDp;
 {
-  int i;
   MDp->buffer[0] = I0;
   MDp->buffer[1] = I1;
   MDp->buffer[2] = I2;
   MDp->buffer[3] = I3;
-  for (i=0;i<8;i++) MDp->count[i] = 0;
-  MDp->done = 0;
+  MDp->count[0] = MDp->count[1] = 0;
 }
 
 /* MDblock(MDp,X)
-** Update message digest buffer MDp->buffer using 16-word data block X.
-** Assumes all 16 words of X are full of data.
+** Update message digest buffer MDp->buffer using the 64-byte block X.
 ** Does not update MDp->count.
 ** This routine is not user-callable.
 */
 static void
 MDblock(MDp,Xb)
 MD4_CTX *MDp;
-unsigned char *Xb;
+const unsigned char *Xb;
 {
   register unsigned int tmp, A, B, C, D;
   unsigned int X[16];
   int i;
 
   for (i = 0; i < 16; ++i) {
-    X[i] = Xb[0] + (Xb[1] << 8) + (Xb[2] << 16) + (Xb[3] << 24);
+    X[i] = Xb[0] | (Xb[1] << 8) | (Xb[2] << 16) | ((unsigned int)Xb[3] << 24);
     Xb += 4;
   }
 
@@ -192,99 +179,73 @@ unsigned char *Xb;
   MDp->buffer[3] += D;
 }
 
-/* MD4Update(MDp,X,count)
+/* MD4_Update(MDp,X,count)
 ** Input: X -- a pointer to an array of unsigned characters.
-**        count -- the number of bits of X to use.
-**          (if not a multiple of 8, uses high bits of last byte.)
-** Update MDp using the number of bits of X given by count.
+**        count -- the number of bytes of X to use.
+** Update MDp with the next count bytes of the message.
+** Whole blocks are hashed straight from X; what is left over waits
+** in MDp->in for the next call or for MD4_Final.
 ** This is the basic input routine for an MD4 user.
-** The routine completes the MD computation when count < 512, so
-** every MD computation should end with one call to MD4Update with a
-** count less than 512.  A call with count 0 will be ignored if the
-** MD has already been terminated (done != 0), so an extra call with
-** count 0 can be given as a "courtesy close" to force termination
-** if desired.
 */
 void
-MD4Update(MDp,X,count)
+MD4_Update(MDp,X,count)
 MD4_CTX *MDp;
 unsigned char *X;
 unsigned int count;
 {
-  unsigned int i, tmp, bit, byte, mask;
-  unsigned char XX[64];
-  unsigned char *p;
+  unsigned int used, n;
 
-  /* return with no error if this is a courtesy close with count
-  ** zero and MDp->done is true.
-  */
-  if (count == 0 && MDp->done) return;
-  /* check to see if MD is already done and report error */
-  if (MDp->done)
-  { printf("\nError: MD4Update MD already done."); return; }
+  used = MDp->count[0] & 63;
+  if ((MDp->count[0] += count) < count)
+    MDp->count[1]++;
 
-  /* Add count to MDp->count */
-  tmp = count;
-  p = MDp->count;
-  while (tmp)
-  { tmp += *p;
-  *p++ = tmp;
-  tmp = tmp >> 8;
-  }
-
-  /* Process data */
-  if (count == 512)
-  { /* Full block of data to handle */
-    MDblock(MDp,X);
-  }
-  else if (count > 512) /* Check for count too large */
-  {
-    printf("\nError: MD4Update called with illegal count value %d.",
-	   count);
-    return;
-  }
-  else /* partial block -- must be last block so finish up */
-  {
-    /* Find out how many bytes and residual bits there are */
-    byte = count >> 3;
-    bit =  count & 7;
-    /* Copy X into XX since we need to modify it */
-    if (count)
-      for (i=0;i<=byte;i++) XX[i] = X[i];
-    for (i=byte+1;i<64;i++) XX[i] = 0;
-    /* Add padding '1' bit and low-order zeros in last byte */
-    mask = 1 << (7 - bit);
-    XX[byte] = (XX[byte] | mask) & ~( mask - 1);
-    /* If room for bit count, finish up with this block */
-    if (byte <= 55)
-    {
-      for (i=0;i<8;i++) XX[56+i] = MDp->count[i];
-      MDblock(MDp,XX);
-    }
-    else /* need to do two blocks to finish up */
-    {
-      MDblock(MDp,XX);
-      for (i=0;i<56;i++) XX[i] = 0;
-      for (i=0;i<8;i++)  XX[56+i] = MDp->count[i];
-      MDblock(MDp,XX);
+  if (used) {
+    n = 64 - used;
+    if (count < n) {
+      memcpy(MDp->in + used, X, count);
+      return;
     }
-    /* Set flag saying we're done with MD computation */
-    MDp->done = 1;
+    memcpy(MDp->in + used, X, n);
+    MDblock(MDp,MDp->in);
+    X += n;
+    count -= n;
   }
+  for (; count >= 64; X += 64, count -= 64)
+    MDblock(MDp,X);
+  memcpy(MDp->in, X, count);
 }
 
 /*
 ** Finish up MD4 computation and return message digest.
+** The message is padded with a '1' bit, zeros, and its length in
+** bits as a 64-bit little-endian number, out to a whole block.
 */
 void
-MD4Final(buf, MD)
+MD4_Final(buf, MD)
 unsigned char *buf;
 MD4_CTX *MD;
 {
   int i, j;
-  unsigned int w;
+  unsigned int w, used;
+  unsigned char *p;
+
+  used = MD->count[0] & 63;
+  MD->in[used++] = 0x80;
+  if (used > 56) {
+    memset(MD->in + used, 0, 64 - used);
+    MDblock(MD,MD->in);
+    used = 0;
+  }
+  memset(MD->in + used, 0, 56 - used);
+  p = MD->in + 56;
+  w = MD->count[0] << 3;
+  for (j = 0; j < 4; ++j, w >>= 8)
+    *p++ = w;
+  w = (MD->count[1] << 3) | (MD->count[0] >> 29);
+  for (j = 0; j < 4; ++j, w >>= 8)
+    *p++ = w;
+  MDblock(MD,MD->in);
 
-  MD4Update(MD, NULL, 0);
   for (i = 0; i < 4; ++i) {
     w = MD->buffer[i];
     for (j = 0; j < 4; ++j) {
@@ -21,29 +21,32 @@
 */
 typedef struct {
 	unsigned int buffer[4]; /* Holds 4-word result of MD computation */
-	unsigned char count[8]; /* Number of bits processed so far */
-	unsigned int done;      /* Nonzero means MD computation finished */
+	unsigned int count[2];  /* Number of bytes processed so far */
+	unsigned char in[64];   /* Bytes not yet making up a whole block */
 } MD4_CTX;
 
-/* MD4Init(MD4_CTX *)
+/* These were MD4Init, MD4Update and MD4Final, but that MD4Update
+** took its count in bits and had to be given whole 64-byte blocks.
+** The names have changed with the meaning of the count, so that code
+** written for the old interface fails to build or load rather than
+** quietly computing the wrong digest.
+*/
+
+/* MD4_Init(MD4_CTX *)
 ** Initialize the MD4_CTX prepatory to doing a message digest
 ** computation.
 */
-extern void MD4Init __P((MD4_CTX *MD));
+extern void MD4_Init __P((MD4_CTX *MD));
 
-/* MD4Update(MD,X,count)
+/* MD4_Update(MD,X,count)
 ** Input: X -- a pointer to an array of unsigned characters.
-**        count -- the number of bits of X to use (an unsigned int).
-** Updates MD using the first "count" bits of X.
+**        count -- the number of bytes of X to use (an unsigned int).
+** Updates MD using the first "count" bytes of X.
 ** The array pointed to by X is not modified.
-** If count is not a multiple of 8, MD4Update uses high bits of
-** last byte.
-** This is the basic input routine for a user.
-** The routine terminates the MD computation when count < 512, so
-** every MD computation should end with one call to MD4Update with a
-** count less than 512.  Zero is OK for a count.
+** This is the basic input routine for a user, and may be called
+** any number of times with any count before MD4_Final.
 */
-extern void MD4Update __P((MD4_CTX *MD, unsigned char *X, unsigned int count));
+extern void MD4_Update __P((MD4_CTX *MD, unsigned char *X, unsigned int count));
 
 /* MD4Print(MD)
 ** Prints message digest buffer MD as 32 hexadecimal digits.
@@ -53,11 +56,11 @@ extern void MD4Update __P((MD4_CTX *MD, unsigned char *X, unsigned int count));
 */
 extern void MD4Print __P((MD4_CTX *));
 
-/* MD4Final(buf, MD)
-** Returns message digest from MD and terminates the message
-** digest computation.
+/* MD4_Final(buf, MD)
+** Pads the message, terminates the message digest computation and
+** returns the 16-byte message digest in buf.
 */
-extern void MD4Final __P((unsigned char *, MD4_CTX *));
+extern void MD4_Final __P((unsigned char *, MD4_CTX *));
 
 /*
 ** End of md4.h
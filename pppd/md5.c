@@ -126,7 +126,8 @@ unsigned int inLen;
 {
   UINT4 in[16];
   int mdi;
-  unsigned int i, ii;
+  unsigned int i, ii, n;
+  unsigned char *p;
 
   /* compute number of bytes mod 64 */
   mdi = (int)((mdContext->i[0] >> 3) & 0x3F);
@@ -137,20 +138,31 @@ unsigned int inLen;
   mdContext->i[0] += ((UINT4)inLen << 3);
   mdContext->i[1] += ((UINT4)inLen >> 29);
 
-  while (inLen--) {
-    /* add new character to buffer, increment mdi */
-    mdContext->in[mdi++] = *inBuf++;
-
-    /* transform if necessary */
-    if (mdi == 0x40) {
-      for (i = 0, ii = 0; i < 16; i++, ii += 4)
-        in[i] = (((UINT4)mdContext->in[ii+3]) << 24) |
-                (((UINT4)mdContext->in[ii+2]) << 16) |
-                (((UINT4)mdContext->in[ii+1]) << 8) |
-                ((UINT4)mdContext->in[ii]);
-      Transform (mdContext->buf, in);
+  while (inLen > 0) {
+    /* whole blocks are transformed straight from inBuf */
+    if (mdi == 0 && inLen >= 64) {
+      p = inBuf;
+      inBuf += 64;
+      inLen -= 64;
+    } else {
+      n = 64 - mdi;
+      if (n > inLen)
+        n = inLen;
+      memcpy(&mdContext->in[mdi], inBuf, n);
+      mdi += n;
+      inBuf += n;
+      inLen -= n;
+      if (mdi < 64)
+        break;
+      p = mdContext->in;
       mdi = 0;
     }
+    for (i = 0, ii = 0; i < 16; i++, ii += 4)
+      in[i] = (((UINT4)p[ii+3]) << 24) |
+              (((UINT4)p[ii+2]) << 16) |
+              (((UINT4)p[ii+1]) << 8) |
+              ((UINT4)p[ii]);
+    Transform (mdContext->buf, in);
   }
 }
 
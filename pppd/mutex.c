@@ -0,0 +1,134 @@
+/*
+   trivial database library - robust mutex chain locks
+
+   The chain locks live in an allocated record near the start of the
+   database, which is mapped on its own so that it stays put when the
+   main mapping is redone after the file grows: a robust mutex must
+   not move while it is held.
+
+     ** NOTE! The following LGPL license applies to the tdb
+     ** library. This does NOT imply that all of Samba is released
+     ** under the LGPL
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include "tdb.h"
+#include "mutex.h"
+
+#ifdef USE_TDB_MUTEX
+
+#define MUTEX_ALIGN 8
+
+tdb_len tdb_mutex_size(unsigned int hash_size)
+{
+	return (hash_size + 1) * sizeof(pthread_mutex_t) + MUTEX_ALIGN;
+}
+
+tdb_off tdb_mutex_offset(tdb_off off)
+{
+	return (off + MUTEX_ALIGN - 1) & ~(tdb_off)(MUTEX_ALIGN - 1);
+}
+
+/* map the mutexes that the header points at */
+int tdb_mutex_open(TDB_CONTEXT *tdb)
+{
+	tdb_off start;
+	size_t len;
+	void *p;
+
+	if (tdb->mutex_map)
+		return 0;
+	start = tdb->header.mutexes & ~(tdb_off)(getpagesize() - 1);
+	len = tdb->header.mutexes - start
+		+ (tdb->header.hash_size + 1) * sizeof(pthread_mutex_t);
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, tdb->fd, start);
+	if (p == MAP_FAILED)
+		return -1;
+	tdb->mutex_map = p;
+	tdb->mutex_map_size = len;
+	tdb->mutexes = (char *)p + (tdb->header.mutexes - start);
+	return 0;
+}
+
+/* set up the mutexes of a new database, or of one nobody has open */
+int tdb_mutex_init(TDB_CONTEXT *tdb)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutex_t *m = tdb->mutexes;
+	unsigned int i;
+	int ret = 0;
+
+	if (pthread_mutexattr_init(&attr) != 0)
+		return -1;
+	if (pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0
+	    || pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) != 0)
+		ret = -1;
+	for (i = 0; ret == 0 && i < tdb->header.hash_size + 1; i++)
+		if (pthread_mutex_init(&m[i], &attr) != 0)
+			ret = -1;
+	pthread_mutexattr_destroy(&attr);
+	return ret;
+}
+
+void tdb_mutex_close(TDB_CONTEXT *tdb)
+{
+	if (tdb->mutex_map)
+		munmap(tdb->mutex_map, tdb->mutex_map_size);
+	tdb->mutex_map = tdb->mutexes = NULL;
+	tdb->mutex_map_size = 0;
+}
+
+/* lock a list (-1 being the alloc list); `try' means don't wait */
+int tdb_mutex_lock(TDB_CONTEXT *tdb, int list, int try)
+{
+	pthread_mutex_t *m = (pthread_mutex_t *)tdb->mutexes + list + 1;
+	int ret;
+
+	ret = try ? pthread_mutex_trylock(m) : pthread_mutex_lock(m);
+	if (ret == EOWNERDEAD) {
+		/* The holder died.  It may have been part way through
+		   changing the chain, just as it could with fcntl locks,
+		   but at least we don't hang. */
+		pthread_mutex_consistent(m);
+		return 1;
+	}
+	if (ret != 0) {
+		errno = ret;
+		return ret == EBUSY ? -1 : TDB_ERRCODE(TDB_ERR_LOCK, -1);
+	}
+	return 0;
+}
+
+int tdb_mutex_unlock(TDB_CONTEXT *tdb, int list)
+{
+	pthread_mutex_t *m = (pthread_mutex_t *)tdb->mutexes + list + 1;
+	int ret;
+
+	if ((ret = pthread_mutex_unlock(m)) != 0) {
+		errno = ret;
+		return TDB_ERRCODE(TDB_ERR_LOCK, -1);
+	}
+	return 0;
+}
+
+#endif /* USE_TDB_MUTEX */
@@ -0,0 +1,30 @@
+#ifndef __TDB_MUTEX_H__
+#define __TDB_MUTEX_H__
+
+#include "tdb.h"
+
+#ifdef USE_TDB_MUTEX
+
+/*
+ * Chain locks kept as process-shared robust mutexes in the database
+ * file.  Taking an uncontended lock needs no system call, and a lock
+ * held by a process that dies is given to the next locker instead of
+ * wedging the database.
+ */
+
+/* bytes needed in the file for the mutexes, including alignment */
+tdb_len tdb_mutex_size(unsigned int hash_size);
+/* offset of the first mutex in an area starting at offset `off' */
+tdb_off tdb_mutex_offset(tdb_off off);
+
+int tdb_mutex_open(TDB_CONTEXT *tdb);
+int tdb_mutex_init(TDB_CONTEXT *tdb);
+void tdb_mutex_close(TDB_CONTEXT *tdb);
+
+/* 0 on success, 1 if the previous holder died, -1 on failure */
+int tdb_mutex_lock(TDB_CONTEXT *tdb, int list, int try);
+int tdb_mutex_unlock(TDB_CONTEXT *tdb, int list);
+
+#endif /* USE_TDB_MUTEX */
+
+#endif
@@ -96,6 +96,8 @@ int	default_device = 1;	/* Using /dev/tty or equivalent */
 char	devnam[MAXPATHLEN];	/* Device name */
 bool	nodetach = 0;		/* Don't detach from controlling tty */
 bool	updetach = 0;		/* Detach once link is up */
+bool	noscripthelper = 0;	/* Fork scripts from pppd, not via helper */
+bool	async_wtmp = 0;		/* Have a shared writer write utmp/wtmp */
 bool	master_detach;		/* Detach when we're (only) multilink master */
 int	maxconnect = 0;		/* Maximum connect time */
 char	user[MAXNAMELEN];	/* Username for PAP */
@@ -114,6 +116,7 @@ char	linkname[MAXPATHLEN];	/* logical name for link */
 bool	tune_kernel;		/* may alter kernel settings */
 int	connect_delay = 1000;	/* wait this many ms after connect script */
 int	req_unit = -1;		/* requested interface unit */
+int	unit_pool_size = 0;	/* # ppp units to create in advance */
 char	req_ifname[MAXIFNAMELEN];	/* requested interface name */
 bool	multilink = 0;		/* Enable multilink operation */
 char	*bundle_name = NULL;	/* bundle name for multilink */
@@ -121,11 +124,16 @@ bool	dump_options;		/* print out option values */
 bool	dryrun;			/* print out option values and exit */
 char	*domain;		/* domain name set by domain option */
 int	child_wait = 5;		/* # seconds to wait for children at exit */
+int	recv_batch = 32;	/* max # packets to read per wakeup */
+int	demand_queue_bytes = 262144; /* space for frames queued on demand */
+int	demand_queue_pkts = 1024; /* max # frames queued on demand */
+bool	demand_head_drop;	/* drop oldest queued frame when full */
 struct userenv *userenv_list;	/* user environment variables */
+int	rate_interval = 0;	/* secs between link rate samples, 0 = off */
 int	dfl_route_metric = -1;	/* metric of the default route to set over the PPP link */
 
 #ifdef MAXOCTETS
-unsigned int  maxoctets = 0;    /* default - no limit */
+u_int64_t maxoctets = 0;    /* default - no limit */
 int maxoctets_dir = 0;       /* default - sum of traffic */
 int maxoctets_timeout = 1;   /* default 1 second */ 
 #endif
@@ -137,6 +145,8 @@ extern struct stat devstat;
 #ifdef PPP_FILTER
 struct	bpf_program pass_filter;/* Filter program for packets to pass */
 struct	bpf_program active_filter; /* Filter program for link-active pkts */
+unsigned int filter_generation = 1; /* bumped when the filters change */
+bool	filter_cache;		/* cache filter verdicts per flow */
 #endif
 
 static option_t *curopt;	/* pointer to option being processed */
@@ -169,6 +179,8 @@ static int setactivefilter __P((char **));
 #endif
 
 #ifdef MAXOCTETS
+static int setmaxoctets __P((char **));
+static void printmaxoctets __P((option_t *, printer_func, void *));
 static int setmodir __P((char **));
 #endif
 
@@ -213,6 +225,12 @@ option_t general_options[] = {
       "Detach from controlling tty once link is up",
       OPT_PRIOSUB | OPT_A2CLR | 1, &nodetach },
 
+    { "noscripthelper", o_bool, &noscripthelper,
+      "Don't use a helper process to run scripts", 1 },
+
+    { "async-wtmp", o_bool, &async_wtmp,
+      "Have a process shared by all pppds write utmp and wtmp records", 1 },
+
     { "master_detach", o_bool, &master_detach,
       "Detach when we're multilink master but have no link", 1 },
 
@@ -227,6 +245,10 @@ option_t general_options[] = {
       "Set connection time limit",
       OPT_PRIO | OPT_LLIMIT | OPT_NOINCR | OPT_ZEROINF },
 
+    { "rate-interval", o_int, &rate_interval,
+      "Set time in seconds between link throughput samples",
+      OPT_PRIO | OPT_LLIMIT, NULL, 0, 0 },
+
     { "domain", o_special, (void *)setdomain,
       "Add given domain name to hostname",
       OPT_PRIO | OPT_PRIV | OPT_A2STRVAL, &domain },
@@ -243,6 +265,17 @@ option_t general_options[] = {
 
     { "demand", o_bool, &demand,
       "Dial on demand", OPT_INITONLY | 1, &persist },
+    { "demand-queue-bytes", o_int, &demand_queue_bytes,
+      "Space for packets queued while bringing up the link",
+      OPT_INITONLY | OPT_LLIMIT, NULL, 0, 4096 },
+    { "demand-queue-packets", o_int, &demand_queue_pkts,
+      "Maximum number of packets queued while bringing up the link",
+      OPT_INITONLY | OPT_LLIMIT, NULL, 0, 1 },
+    { "demand-head-drop", o_bool, &demand_head_drop,
+      "Drop oldest queued packet when demand queue is full",
+      OPT_PRIO | 1 },
+    { "demand-tail-drop", o_bool, &demand_head_drop,
+      "Drop new packets when demand queue is full", OPT_PRIOSUB },
 
     { "--version", o_special_noarg, (void *)showversion,
       "Show version number" },
@@ -285,6 +318,10 @@ option_t general_options[] = {
       "PPP interface unit number to use if possible",
       OPT_PRIO | OPT_LLIMIT, 0, 0 },
 
+    { "unit-pool", o_int, &unit_pool_size,
+      "Number of PPP units to create in advance",
+      OPT_PRIO | OPT_LIMITS, NULL, MAX_UNIT_POOL, 0 },
+
     { "ifname", o_string, req_ifname,
       "Set PPP interface name",
       OPT_PRIO | OPT_PRIV | OPT_STATIC, NULL, MAXIFNAMELEN },
@@ -298,6 +335,10 @@ option_t general_options[] = {
       "Number of seconds to wait for child processes at exit",
       OPT_PRIO },
 
+    { "recv-batch", o_int, &recv_batch,
+      "Maximum number of packets to read per wakeup",
+      OPT_PRIO | OPT_LLIMIT, NULL, 0, 1 },
+
     { "set", o_special, (void *)user_setenv,
       "Set user environment variable",
       OPT_A2PRINTER | OPT_NOPRINT, (void *)user_setprint },
@@ -334,15 +375,20 @@ option_t general_options[] = {
 
     { "active-filter", o_special, setactivefilter,
       "set filter for active pkts", OPT_PRIO },
+
+    { "filter-cache", o_bool, &filter_cache,
+      "Cache pass/active filter results per flow", 1 },
+    { "nofilter-cache", o_bool, &filter_cache,
+      "Run the filters on every packet", 0 },
 #endif
 
 #ifdef MAXOCTETS
-    { "maxoctets", o_int, &maxoctets,
+    { "maxoctets", o_special, (void *)setmaxoctets,
       "Set connection traffic limit",
-      OPT_PRIO | OPT_LLIMIT | OPT_NOINCR | OPT_ZEROINF },
-    { "mo", o_int, &maxoctets,
+      OPT_PRIO | OPT_A2PRINTER, (void *)printmaxoctets },
+    { "mo", o_special, (void *)setmaxoctets,
       "Set connection traffic limit",
-      OPT_ALIAS | OPT_PRIO | OPT_LLIMIT | OPT_NOINCR | OPT_ZEROINF },
+      OPT_ALIAS | OPT_PRIO | OPT_A2PRINTER, (void *)printmaxoctets },
     { "mo-direction", o_special, setmodir,
       "Set direction for limit traffic (sum,in,out,max)" },
     { "mo-timeout", o_int, &maxoctets_timeout,
@@ -1503,6 +1549,7 @@ setpassfilter(argv)
 	ret = 0;
     }
     pcap_close(pc);
+    ++filter_generation;
 
     return ret;
 }
@@ -1524,6 +1571,7 @@ setactivefilter(argv)
 	ret = 0;
     }
     pcap_close(pc);
+    ++filter_generation;
 
     return ret;
 }
@@ -1580,6 +1628,46 @@ setlogfile(argv)
 }
 
 #ifdef MAXOCTETS
+/*
+ * setmaxoctets - set the traffic limit, which may be more than 4GB.
+ * As for other limits, 0 means none, and an unprivileged user can
+ * only lower it.
+ */
+static int
+setmaxoctets(argv)
+    char **argv;
+{
+    unsigned long long v;
+    char *ptr;
+
+    errno = 0;
+    v = strtoull(*argv, &ptr, 0);
+    if (ptr == *argv || *ptr != 0 || **argv == '-' || errno == ERANGE) {
+	option_error("invalid numeric parameter '%s' for %s option",
+		     *argv, current_option);
+	return 0;
+    }
+    if (!privileged_option && maxoctets != 0
+	&& (v == 0 || v > maxoctets)) {
+	option_error("%s value cannot be increased", current_option);
+	return 0;
+    }
+    maxoctets = v;
+    return 1;
+}
+
+static void
+printmaxoctets(opt, printer, arg)
+    option_t *opt;
+    printer_func printer;
+    void *arg;
+{
+    char numbuf[32];
+
+    snprintf(numbuf, sizeof(numbuf), "%llu", (unsigned long long) maxoctets);
+    printer(arg, "%s", numbuf);
+}
+
 static int
 setmodir(argv)
     char **argv;
@@ -55,6 +55,16 @@
 #endif
 #endif /* __STDC__ */
 
+#ifdef __STDC__
+#define _PATH_WTMPSOCK	_ROOT_PATH _PATH_VARRUN "pppd-wtmp.sock"
+#else /* __STDC__ */
+#ifdef HAVE_PATHS_H
+#define _PATH_WTMPSOCK	"/var/run/pppd-wtmp.sock"
+#else
+#define _PATH_WTMPSOCK	"/etc/ppp/pppd-wtmp.sock"
+#endif
+#endif /* __STDC__ */
+
 #ifdef PLUGIN
 #ifdef __STDC__
 #define _PATH_PLUGIN	DESTDIR "/lib/pppd/" VERSION
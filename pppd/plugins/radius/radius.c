@@ -545,6 +545,11 @@ radius_setparams(VALUE_PAIR *vp, char *msg, REQUEST_INFO *req_info,
     int mppe_enc_policy = 0;
     int mppe_enc_types = 0;
 #endif
+#ifdef MAXOCTETS
+    u_int32_t octets_limit = 0;	/* Session-Octets-Limit, low 32 bits */
+    u_int32_t gigawords_limit = 0; /* and Session-Gigawords-Limit, high */
+    int got_octets_limit = 0;
+#endif
 #ifdef MSDNS
     ipcp_options *wo = &ipcp_wantoptions[0];
     ipcp_options *ao = &ipcp_allowoptions[0];
@@ -606,7 +611,13 @@ radius_setparams(VALUE_PAIR *vp, char *msg, REQUEST_INFO *req_info,
 #ifdef MAXOCTETS
 	    case PW_SESSION_OCTETS_LIMIT:
 		/* Session traffic limit */
-		maxoctets = vp->lvalue;
+		octets_limit = vp->lvalue;
+		got_octets_limit = 1;
+		break;
+	    case PW_SESSION_GIGAWORDS_LIMIT:
+		/* How many times 2^32 to add to the traffic limit */
+		gigawords_limit = vp->lvalue;
+		got_octets_limit = 1;
 		break;
 	    case PW_OCTETS_DIRECTION:
 		/* Session traffic limit direction check */
@@ -730,6 +741,11 @@ radius_setparams(VALUE_PAIR *vp, char *msg, REQUEST_INFO *req_info,
 	vp = vp->next;
     }
 
+#ifdef MAXOCTETS
+    if (got_octets_limit)
+	maxoctets = ((u_int64_t) gigawords_limit << 32) | octets_limit;
+#endif
+
     /* Require a valid MS-CHAP2-SUCCESS for MS-CHAPv2 auth */
     if (digest && (digest->code == CHAP_MICROSOFT_V2) && !ms_chap2_success)
 	return -1;
@@ -891,6 +907,7 @@ radius_acct_start(void)
     VALUE_PAIR *send = NULL;
     ipcp_options *ho = &ipcp_hisoptions[0];
     u_int32_t hisaddr;
+    char setup_info[AUTH_STRING_LEN + 1];
 
     if (!rstate.initialized) {
 	return;
@@ -935,6 +952,17 @@ radius_acct_start(void)
     av_type = htonl(hisaddr);
     rc_avpair_add(&send, PW_FRAMED_IP_ADDRESS , &av_type , 0, VENDOR_NONE);
 
+    /*
+     * Report how long each step of bringing up the link took.  Only
+     * if the dictionary knows the attribute, so that one installed
+     * before it was added doesn't give an error on every link.
+     */
+    format_setup_times(setup_info, sizeof(setup_info));
+    if (setup_info[0]
+	&& rc_dict_getattr(PW_RP_SETUP_TIMES, VENDOR_ROARING_PENGUIN) != NULL)
+	rc_avpair_add(&send, PW_RP_SETUP_TIMES, setup_info, 0,
+		      VENDOR_ROARING_PENGUIN);
+
     /* Add user specified vp's */
     if (rstate.avp)
 	rc_avpair_insert(&send, NULL, rc_avpair_copy(rstate.avp));
@@ -1013,12 +1041,21 @@ radius_acct_stop(void)
 	av_type = link_connect_time;
 	rc_avpair_add(&send, PW_ACCT_SESSION_TIME, &av_type, 0, VENDOR_NONE);
 
-	av_type = link_stats.bytes_out;
+	av_type = (UINT4) link_stats.bytes_out;
 	rc_avpair_add(&send, PW_ACCT_OUTPUT_OCTETS, &av_type, 0, VENDOR_NONE);
 
-	av_type = link_stats.bytes_in;
+	av_type = (UINT4) link_stats.bytes_in;
 	rc_avpair_add(&send, PW_ACCT_INPUT_OCTETS, &av_type, 0, VENDOR_NONE);
 
+	/* RFC 2869: the number of times the octet counts have wrapped */
+	av_type = (UINT4) (link_stats.bytes_out >> 32);
+	if (av_type)
+	    rc_avpair_add(&send, PW_ACCT_OUTPUT_GIGAWORDS, &av_type, 0, VENDOR_NONE);
+
+	av_type = (UINT4) (link_stats.bytes_in >> 32);
+	if (av_type)
+	    rc_avpair_add(&send, PW_ACCT_INPUT_GIGAWORDS, &av_type, 0, VENDOR_NONE);
+
 	av_type = link_stats.pkts_out;
 	rc_avpair_add(&send, PW_ACCT_OUTPUT_PACKETS, &av_type, 0, VENDOR_NONE);
 
@@ -1161,12 +1198,21 @@ radius_acct_interim(void *ignored)
 	av_type = link_connect_time;
 	rc_avpair_add(&send, PW_ACCT_SESSION_TIME, &av_type, 0, VENDOR_NONE);
 
-	av_type = link_stats.bytes_out;
+	av_type = (UINT4) link_stats.bytes_out;
 	rc_avpair_add(&send, PW_ACCT_OUTPUT_OCTETS, &av_type, 0, VENDOR_NONE);
 
-	av_type = link_stats.bytes_in;
+	av_type = (UINT4) link_stats.bytes_in;
 	rc_avpair_add(&send, PW_ACCT_INPUT_OCTETS, &av_type, 0, VENDOR_NONE);
 
+	/* RFC 2869: the number of times the octet counts have wrapped */
+	av_type = (UINT4) (link_stats.bytes_out >> 32);
+	if (av_type)
+	    rc_avpair_add(&send, PW_ACCT_OUTPUT_GIGAWORDS, &av_type, 0, VENDOR_NONE);
+
+	av_type = (UINT4) (link_stats.bytes_in >> 32);
+	if (av_type)
+	    rc_avpair_add(&send, PW_ACCT_INPUT_GIGAWORDS, &av_type, 0, VENDOR_NONE);
+
 	av_type = link_stats.pkts_out;
 	rc_avpair_add(&send, PW_ACCT_OUTPUT_PACKETS, &av_type, 0, VENDOR_NONE);
 
@@ -156,6 +156,7 @@ typedef struct pw_auth_hdr
 #define PW_MS_SECONDARY_DNS_SERVER	29	/* ipaddr */
 #define PW_MS_PRIMARY_NBNS_SERVER	30	/* ipaddr */
 #define PW_MS_SECONDARY_NBNS_SERVER	31	/* ipaddr */
+#define PW_RP_SETUP_TIMES		6	/* string */
 
 /*	Accounting */
 
@@ -171,8 +172,11 @@ typedef struct pw_auth_hdr
 #define PW_ACCT_TERMINATE_CAUSE		49	/* integer */
 #define PW_ACCT_MULTI_SESSION_ID	50	/* string */
 #define PW_ACCT_LINK_COUNT		51	/* integer */
+#define PW_ACCT_INPUT_GIGAWORDS		52	/* integer */
+#define PW_ACCT_OUTPUT_GIGAWORDS	53	/* integer */
 
 /* From RFC 2869 */
+#define PW_CONNECT_INFO			77	/* string */
 #define PW_ACCT_INTERIM_INTERVAL        85	/* integer */
 
 /*	Merit Experimental Extensions */
@@ -184,6 +188,7 @@ typedef struct pw_auth_hdr
 /*      Session limits */
 #define PW_SESSION_OCTETS_LIMIT		227    /* integer */
 #define PW_OCTETS_DIRECTION		228    /* integer */
+#define PW_SESSION_GIGAWORDS_LIMIT	229    /* integer */
 
 /*	Integer Translations */
 
@@ -296,6 +301,7 @@ typedef struct pw_auth_hdr
 /* Vendor codes */
 #define VENDOR_NONE     (-1)
 #define VENDOR_MICROSOFT	311
+#define VENDOR_ROARING_PENGUIN	10055
 
 /* Server data structures */
 
@@ -482,39 +482,7 @@ static int rc_check_reply (AUTH_HDR *auth, int bufferlen, char *secret,
 
 static void rc_random_vector (unsigned char *vector)
 {
-	int             randno;
-	int             i;
-	int		fd;
-
-/* well, I added this to increase the security for user passwords.
-   we use /dev/urandom here, as /dev/random might block and we don't
-   need that much randomness. BTW, great idea, Ted!     -lf, 03/18/95	*/
-
-	if ((fd = open(_PATH_DEV_URANDOM, O_RDONLY)) >= 0)
-	{
-		unsigned char *pos;
-		int readcount;
-
-		i = AUTH_VECTOR_LEN;
-		pos = vector;
-		while (i > 0)
-		{
-			readcount = read(fd, (char *)pos, i);
-			pos += readcount;
-			i -= readcount;
-		}
-
-		close(fd);
-		return;
-	} /* else fall through */
-
-	for (i = 0; i < AUTH_VECTOR_LEN;)
-	{
-		randno = magic();
-		memcpy ((char *) vector, (char *) &randno, sizeof (int));
-		vector += sizeof (int);
-		i += sizeof (int);
-	}
-
-	return;
+	/* pppd's generator is keyed from the kernel, so this needn't
+	   open /dev/urandom for every request any more */
+	random_bytes(vector, AUTH_VECTOR_LEN);
 }
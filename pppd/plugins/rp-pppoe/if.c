@@ -46,6 +46,10 @@ static char const RCSID[] =
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
 #ifdef HAVE_NET_IF_ARP_H
 #include <net/if_arp.h>
 #endif
@@ -189,6 +193,44 @@ openInterface(char const *ifname, UINT16_t type, unsigned char *hwaddr)
 }
 
 
+/***********************************************************************
+*%FUNCTION: stopReceiving
+*%ARGUMENTS:
+* sock -- raw socket to stop receiving on
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Once discovery is done we only send on the discovery socket (a PADT
+* at the end), and the kernel deals with a PADT from the peer.  But
+* the socket still gets a copy of every discovery frame on the
+* interface, queued until its receive buffer is full, so with many
+* sessions up each PADI broadcast is copied once per session and the
+* copies pin a buffer's worth of kernel memory per session.  A filter
+* that takes nothing stops that; we then throw away what was queued.
+***********************************************************************/
+void
+stopReceiving(int sock)
+{
+#ifdef SO_ATTACH_FILTER
+    static struct sock_filter drop_all[] = {
+	BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+    struct sock_fprog prog;
+    char buf[64];
+
+    prog.len = sizeof(drop_all) / sizeof(drop_all[0]);
+    prog.filter = drop_all;
+    if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER,
+		   &prog, sizeof(prog)) < 0) {
+	warn("Can't filter the PPPoE discovery socket: %m");
+	return;
+    }
+    while (recv(sock, buf, sizeof(buf), MSG_DONTWAIT | MSG_TRUNC) >= 0)
+	;
+#endif
+}
+
+
 /***********************************************************************
 *%FUNCTION: sendPacket
 *%ARGUMENTS:
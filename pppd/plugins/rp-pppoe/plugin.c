@@ -189,6 +189,8 @@ PPPOEConnectDevice(void)
 	    error("Unable to complete PPPoE Discovery");
 	    goto errout;
 	}
+	/* Kept only for sending a PADT; see stopReceiving() */
+	stopReceiving(conn->discoverySocket);
     }
 
     /* Set PPPoE session-number for further consumption */
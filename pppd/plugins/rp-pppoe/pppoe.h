@@ -264,6 +264,7 @@ UINT16_t etherType(PPPoEPacket *packet);
 int openInterface(char const *ifname, UINT16_t type, unsigned char *hwaddr);
 int sendPacket(PPPoEConnection *conn, int sock, PPPoEPacket *pkt, int size);
 int receivePacket(int sock, PPPoEPacket *pkt, int *size);
+void stopReceiving(int sock);
 void fatalSys(char const *str);
 void rp_fatal(char const *str);
 void printErr(char const *str);
@@ -30,10 +30,163 @@
  * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <errno.h>
+#include <string.h>
 #include "pppd.h"
 #include "pppcrypt.h"
 
+/*
+ * A plain DES/ECB, so we needn't depend on the deprecated and
+ * non-reentrant setkey()/encrypt() in libc, or on libdes.  The key
+ * schedule belongs to the caller.  Nothing is looked up by a secret
+ * index: each output bit of an S-box is kept as a 64-bit truth table
+ * which is shifted by the input rather than indexed by it, and the
+ * permutations are either written out as code or done as a fixed
+ * series of bit swaps.
+ *
+ * That costs some speed.  S-box lookups by table index would be
+ * quicker, and so is crypt(3): an MS-CHAP ChallengeResponse (three
+ * keys, a block each) took 2.47us this way against 1.96us with
+ * setkey()/encrypt() when this was written.  At a few
+ * microseconds a login that doesn't matter, and not leaking the NT
+ * hash through cache timing does.  test/desbench compares the two.
+ */
+
+/* Bit n of the w-bit word x, counting from 1 at the top as FIPS 46 does */
+#define BIT(x, w, n)	(((x) >> ((w) - (n))) & 1)
+
+/* Seven bits of C or D, by PC1 from the 64-bit key k */
+#define PC1(a, b, c, d, e, f, g)					\
+	(u_int32_t)(BIT(k, 64, a) << 6 | BIT(k, 64, b) << 5 |		\
+	 BIT(k, 64, c) << 4 | BIT(k, 64, d) << 3 | BIT(k, 64, e) << 2 |	\
+	 BIT(k, 64, f) << 1 | BIT(k, 64, g))
+
+static const u_char Shifts[16] = {
+	1, 1, 2, 2, 2, 2, 2, 2, 1, 2, 2, 2, 2, 2, 2, 1
+};
+
+/* One S-box's six bits of a subkey, by PC2 from the 56-bit C|D */
+#define PC2(a, b, c, d, e, f)						\
+	(BIT(cd, 56, a) << 5 | BIT(cd, 56, b) << 4 | BIT(cd, 56, c) << 3 |	\
+	 BIT(cd, 56, d) << 2 | BIT(cd, 56, e) << 1 | BIT(cd, 56, f))
+
+/* Bits n+1 .. n+6 of the expansion E of r, wrapping round */
+#define E(r, n)							\
+	(((r) << (((n) + 31) & 31) | (r) >> ((33 - (n)) & 31)) >> 26)
+
+/* Exchange the bits of b selected by m with those of a n places up */
+#define SWAP(a, b, n, m)						\
+	(t = ((a) >> (n) ^ (b)) & (m), (b) ^= t, (a) ^= t << (n))
+
+/*
+ * Bit b of SP[i][j] is bit j+1 of what S-box i+1 gives for the six
+ * input bits b, the outer two choosing the row and the inner four the
+ * column as usual.
+ */
+static const u_int64_t SP[8][4] = {
+	{ 0x869d497a86e67619ULL, 0xb0c7871b497826bdULL,
+	  0x27e9d492609f1f29ULL, 0x917be9066f81b478ULL },
+	{ 0xe196196e69c3a659ULL, 0x68f93c169346c3e9ULL,
+	  0x746a8b7462949fc3ULL, 0xcd235ad2b865168fULL },
+	{ 0x96692d696b9c90d3ULL, 0xd96a863526f4794aULL,
+	  0x76b9960c39c2b749ULL, 0x4b8d9c63a965569aULL },
+	{ 0x92c3e719ed90583eULL, 0xcb69718c74ca0e97ULL,
+	  0xacd1168f692cce71ULL, 0x09b77c1ac34998e7ULL },
+	{ 0x429dcd6a79e1348eULL, 0x695b9ca191666b96ULL,
+	  0xc70b39c692f05d2bULL, 0xa4cd96d24b76b948ULL },
+	{ 0xb44ab695c9a4695bULL, 0xc69938d615e69a69ULL,
+	  0x52cbe13c6d9216daULL, 0x95a36a597c3ca34cULL },
+	{ 0x92c761f82c96d966ULL, 0x869cd96699e643c3ULL,
+	  0x6a95f41a9e4b81f4ULL, 0x348e9679497969a6ULL },
+	{ 0xc17abd2438c716b9ULL, 0x394e96b1596aa569ULL,
+	  0xa71658a7c8f13f0cULL, 0x9f6281cd619c7c2bULL }
+};
+
+/*
+ * S-box i+1 on bits n+1 .. n+6 of E(r) and the subkey, with its output
+ * bits going to bits a, b, c and d of the result, which is where P
+ * would put them.
+ */
+#define SBOX(i, n, a, b, c, d)						\
+	(x = E(r, n) ^ k[i],						\
+	 (u_int32_t)(SP[i][0] >> x & 1) << (32 - (a)) |		\
+	 (u_int32_t)(SP[i][1] >> x & 1) << (32 - (b)) |		\
+	 (u_int32_t)(SP[i][2] >> x & 1) << (32 - (c)) |		\
+	 (u_int32_t)(SP[i][3] >> x & 1) << (32 - (d)))
+
+static u_int32_t
+F(r, k)
+u_int32_t r;
+u_char *k;
+{
+	u_int32_t f, x;
+
+	f  = SBOX(0,  0,  9, 17, 23, 31);
+	f |= SBOX(1,  4, 13, 28,  2, 18);
+	f |= SBOX(2,  8, 24, 16, 30,  6);
+	f |= SBOX(3, 12, 26, 20, 10,  1);
+	f |= SBOX(4, 16,  8, 14, 25,  3);
+	f |= SBOX(5, 20,  4, 29, 11, 19);
+	f |= SBOX(6, 24, 32, 12, 22,  7);
+	f |= SBOX(7, 28,  5, 27, 15, 21);
+	return f;
+}
+
+static u_int32_t
+Load(p)
+u_char *p;
+{
+	return (u_int32_t)p[0] << 24 | (u_int32_t)p[1] << 16
+	    | (u_int32_t)p[2] << 8 | p[3];
+}
+
+static void
+Store(v, p)
+u_int32_t v;
+u_char *p;
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void
+DesCrypt(in, ks, out, decrypt)
+u_char *in;
+DesKeySchedule *ks;
+u_char *out;
+int decrypt;
+{
+	u_int32_t l, r, t;
+	int i;
+
+	l = Load(in);
+	r = Load(in + 4);
+
+	/* IP */
+	SWAP(l, r, 4, 0x0f0f0f0f);
+	SWAP(l, r, 16, 0x0000ffff);
+	SWAP(r, l, 2, 0x33333333);
+	SWAP(r, l, 8, 0x00ff00ff);
+	SWAP(l, r, 1, 0x55555555);
+
+	for (i = 0; i < 16; i++) {
+		t = r;
+		r = l ^ F(r, ks->subkey[decrypt ? 15 - i : i]);
+		l = t;
+	}
+
+	/* FP, the inverse of IP, on R16 L16 */
+	SWAP(r, l, 1, 0x55555555);
+	SWAP(l, r, 8, 0x00ff00ff);
+	SWAP(l, r, 2, 0x33333333);
+	SWAP(r, l, 16, 0x0000ffff);
+	SWAP(r, l, 4, 0x0f0f0f0f);
+
+	Store(r, out);
+	Store(l, out + 4);
+}
+
 static u_char
 Get7Bits(input, startBit)
 u_char *input;
@@ -62,132 +215,63 @@ u_char *des_key;	/* OUT 64 bit DES key with parity bits added */
 	des_key[5] = Get7Bits(key, 35);
 	des_key[6] = Get7Bits(key, 42);
 	des_key[7] = Get7Bits(key, 49);
-
-#ifndef USE_CRYPT
-	des_set_odd_parity((des_cblock *)des_key);
-#endif
 }
 
-#ifdef USE_CRYPT
 /*
- * in == 8-byte string (expanded version of the 56-bit key)
- * out == 64-byte string where each byte is either 1 or 0
- * Note that the low-order "bit" is always ignored by by setkey()
- */
-static void
-Expand(in, out)
-u_char *in;
-u_char *out;
-{
-        int j, c;
-        int i;
-
-        for (i = 0; i < 64; in++){
-		c = *in;
-                for (j = 7; j >= 0; j--)
-                        *out++ = (c >> j) & 01;
-                i += 8;
-        }
-}
-
-/* The inverse of Expand
+ * Build the key schedule for a 56-bit key given as 7 octets; the
+ * parity bits DES would ignore anyway are never put in.
  */
-static void
-Collapse(in, out)
-u_char *in;
-u_char *out;
-{
-        int j;
-        int i;
-	unsigned int c;
-
-	for (i = 0; i < 64; i += 8, out++) {
-	    c = 0;
-	    for (j = 7; j >= 0; j--, in++)
-		c |= *in << j;
-	    *out = c & 0xff;
-	}
-}
-
-bool
-DesSetkey(key)
+void
+DesSetkey(key, ks)
 u_char *key;
+DesKeySchedule *ks;
 {
 	u_char des_key[8];
-	u_char crypt_key[66];
+	u_int32_t c, d;
+	u_int64_t k, cd;
+	int i;
 
 	MakeKey(key, des_key);
-	Expand(des_key, crypt_key);
-	errno = 0;
-	setkey((const char *)crypt_key);
-	if (errno != 0)
-		return (0);
-	return (1);
-}
-
-bool
-DesEncrypt(clear, cipher)
-u_char *clear;	/* IN  8 octets */
-u_char *cipher;	/* OUT 8 octets */
-{
-	u_char des_input[66];
-
-	Expand(clear, des_input);
-	errno = 0;
-	encrypt((char *)des_input, 0);
-	if (errno != 0)
-		return (0);
-	Collapse(des_input, cipher);
-	return (1);
-}
-
-bool
-DesDecrypt(cipher, clear)
-u_char *cipher;	/* IN  8 octets */
-u_char *clear;	/* OUT 8 octets */
-{
-	u_char des_input[66];
-
-	Expand(cipher, des_input);
-	errno = 0;
-	encrypt((char *)des_input, 1);
-	if (errno != 0)
-		return (0);
-	Collapse(des_input, clear);
-	return (1);
-}
-
-#else /* USE_CRYPT */
-static des_key_schedule	key_schedule;
-
-bool
-DesSetkey(key)
-u_char *key;
-{
-	des_cblock des_key;
-	MakeKey(key, des_key);
-	des_set_key(&des_key, key_schedule);
-	return (1);
+	for (i = 0, k = 0; i < 8; i++)
+		k = (k << 8) | des_key[i];
+	c = PC1(57, 49, 41, 33, 25, 17,  9) << 21
+	  | PC1( 1, 58, 50, 42, 34, 26, 18) << 14
+	  | PC1(10,  2, 59, 51, 43, 35, 27) << 7
+	  | PC1(19, 11,  3, 60, 52, 44, 36);
+	d = PC1(63, 55, 47, 39, 31, 23, 15) << 21
+	  | PC1( 7, 62, 54, 46, 38, 30, 22) << 14
+	  | PC1(14,  6, 61, 53, 45, 37, 29) << 7
+	  | PC1(21, 13,  5, 28, 20, 12,  4);
+	for (i = 0; i < 16; i++) {
+		c = ((c << Shifts[i]) | (c >> (28 - Shifts[i]))) & 0xfffffff;
+		d = ((d << Shifts[i]) | (d >> (28 - Shifts[i]))) & 0xfffffff;
+		cd = ((u_int64_t)c << 28) | d;
+		ks->subkey[i][0] = PC2(14, 17, 11, 24,  1,  5);
+		ks->subkey[i][1] = PC2( 3, 28, 15,  6, 21, 10);
+		ks->subkey[i][2] = PC2(23, 19, 12,  4, 26,  8);
+		ks->subkey[i][3] = PC2(16,  7, 27, 20, 13,  2);
+		ks->subkey[i][4] = PC2(41, 52, 31, 37, 47, 55);
+		ks->subkey[i][5] = PC2(30, 40, 51, 45, 33, 48);
+		ks->subkey[i][6] = PC2(44, 49, 39, 56, 34, 53);
+		ks->subkey[i][7] = PC2(46, 42, 50, 36, 29, 32);
+	}
+	BZERO(des_key, sizeof(des_key));
 }
 
-bool
-DesEncrypt(clear, key, cipher)
+void
+DesEncrypt(clear, ks, cipher)
 u_char *clear;	/* IN  8 octets */
+DesKeySchedule *ks;
 u_char *cipher;	/* OUT 8 octets */
 {
-	des_ecb_encrypt((des_cblock *)clear, (des_cblock *)cipher,
-	    key_schedule, 1);
-	return (1);
+	DesCrypt(clear, ks, cipher, 0);
 }
 
-bool
-DesDecrypt(cipher, clear)
+void
+DesDecrypt(cipher, ks, clear)
 u_char *cipher;	/* IN  8 octets */
+DesKeySchedule *ks;
 u_char *clear;	/* OUT 8 octets */
 {
-	des_ecb_encrypt((des_cblock *)cipher, (des_cblock *)clear,
-	    key_schedule, 0);
-	return (1);
+	DesCrypt(cipher, ks, clear, 1);
 }
-
-#endif /* USE_CRYPT */
@@ -33,16 +33,13 @@
 #ifndef PPPCRYPT_H
 #define	PPPCRYPT_H
 
-#ifdef HAVE_CRYPT_H
-#include <crypt.h>
-#endif
+/* The expanded form of a DES key; see DesSetkey() */
+typedef struct {
+	u_char	subkey[16][8];		/* round keys, six bits per S-box */
+} DesKeySchedule;
 
-#ifndef USE_CRYPT
-#include <des.h>
-#endif
-
-extern bool	DesSetkey __P((u_char *));
-extern bool	DesEncrypt __P((u_char *, u_char *));
-extern bool	DesDecrypt __P((u_char *, u_char *));
+extern void	DesSetkey __P((u_char *, DesKeySchedule *));
+extern void	DesEncrypt __P((u_char *, DesKeySchedule *, u_char *));
+extern void	DesDecrypt __P((u_char *, DesKeySchedule *, u_char *));
 
 #endif /* PPPCRYPT_H */
@@ -82,6 +82,7 @@
 #define MAXSECRETLEN	256	/* max length of password or secret */
 #define MAXIFNAMELEN	32	/* max length of interface name; or use IFNAMSIZ, can we
 				   always include net/if.h? */
+#define MAX_UNIT_POOL	8	/* max # ppp units to create in advance */
 
 /*
  * If PPP_DRV_NAME is not defined, use the default "ppp" as the device name.
@@ -178,12 +179,25 @@ struct permitted_ip {
  * for statistics from the rest of the ports.
  * This structure serves as a common representation for the bits
  * pppd needs.
+ *
+ * The counters here (and maxoctets) were 32 bits wide before 64-bit
+ * counters came in, and plugins that use link_stats or maxoctets
+ * have to be rebuilt against this header.
  */
 struct pppd_stats {
-    unsigned int	bytes_in;
-    unsigned int	bytes_out;
-    unsigned int	pkts_in;
-    unsigned int	pkts_out;
+    u_int64_t		bytes_in;
+    u_int64_t		bytes_out;
+    u_int64_t		pkts_in;
+    u_int64_t		pkts_out;
+};
+
+/* Throughput figures for the current session, in bytes per second. */
+struct link_rates {
+    u_int64_t		peak_in;
+    u_int64_t		peak_out;
+    u_int64_t		p95_in;
+    u_int64_t		p95_out;
+    int			nsamples;	/* # intervals they are based on */
 };
 
 /* Used for storing a sequence of words.  Usually malloced. */
@@ -296,6 +310,8 @@ extern u_int32_t netmask;	/* IP netmask to set on interface */
 extern bool	lockflag;	/* Create lock file to lock the serial dev */
 extern bool	nodetach;	/* Don't detach from controlling tty */
 extern bool	updetach;	/* Detach from controlling tty when link up */
+extern bool	noscripthelper;	/* Don't run scripts via the helper process */
+extern bool	async_wtmp;	/* Have a shared writer write utmp/wtmp */
 extern bool	master_detach;	/* Detach when multilink master without link */
 extern char	*initializer;	/* Script to initialize physical link */
 extern char	*connect_script; /* Script to establish physical link */
@@ -303,6 +319,7 @@ extern char	*disconnect_script; /* Script to disestablish physical link */
 extern char	*welcomer;	/* Script to welcome client after connection */
 extern char	*ptycommand;	/* Command to run on other side of pty */
 extern int	maxconnect;	/* Maximum connect time (seconds) */
+extern int	rate_interval;	/* Secs between link rate samples, 0 = off */
 extern char	user[MAXNAMELEN];/* Our name for authenticating ourselves */
 extern char	passwd[MAXSECRETLEN];	/* Password for PAP or CHAP */
 extern bool	auth_required;	/* Peer is required to authenticate */
@@ -328,6 +345,7 @@ extern bool	tune_kernel;	/* May alter kernel settings as necessary */
 extern int	connect_delay;	/* Time to delay after connect script */
 extern int	max_data_rate;	/* max bytes/sec through charshunt */
 extern int	req_unit;	/* interface unit number to use */
+extern int	unit_pool_size;	/* # ppp units to create in advance */
 extern char	req_ifname[MAXIFNAMELEN]; /* interface name to use */
 extern bool	multilink;	/* enable multilink operation */
 extern bool	noendpoint;	/* don't send or accept endpt. discrim. */
@@ -335,9 +353,13 @@ extern char	*bundle_name;	/* bundle name for multilink */
 extern bool	dump_options;	/* print out option values */
 extern bool	dryrun;		/* check everything, print options, exit */
 extern int	child_wait;	/* # seconds to wait for children at end */
+extern int	recv_batch;	/* max # packets to read per wakeup */
+extern int	demand_queue_bytes; /* space for frames queued on demand */
+extern int	demand_queue_pkts; /* max # frames queued on demand */
+extern bool	demand_head_drop; /* drop oldest frame when queue full */
 
 #ifdef MAXOCTETS
-extern unsigned int maxoctets;	     /* Maximum octetes per session (in bytes) */
+extern u_int64_t maxoctets;	     /* Maximum octets per session (in bytes) */
 extern int       maxoctets_dir;      /* Direction :
 				      0 - in+out (default)
 				      1 - in 
@@ -355,6 +377,8 @@ extern int       maxoctets_timeout;  /* Timeout for check of octets limit */
 #ifdef PPP_FILTER
 extern struct	bpf_program pass_filter;   /* Filter for pkts to pass */
 extern struct	bpf_program active_filter; /* Filter for link-active pkts */
+extern unsigned int filter_generation; /* bumped when the filters change */
+extern bool	filter_cache;	/* cache filter verdicts per flow */
 #endif
 
 #ifdef MSLANMAN
@@ -515,9 +539,15 @@ void reopen_log __P((void));	/* (re)open the connection to syslog */
 void print_link_stats __P((void)); /* Print stats, if available */
 void reset_link_stats __P((int)); /* Reset (init) stats when link goes up */
 void update_link_stats __P((int)); /* Get stats at link termination */
+int  get_link_rates __P((struct link_rates *)); /* Peak/95th pct throughput */
 void script_setenv __P((char *, char *, int));	/* set script env var */
+/* values for the last argument of script_setenv */
+#define ENV_KEY		1	/* pppdb entry can be found by VAR=value */
+#define ENV_KEY_SHARED	2	/* ditto, for a value several pppds may have */
 void script_unsetenv __P((char *));		/* unset script env var */
 void new_phase __P((int));	/* signal start of new phase */
+void setup_event __P((char *, int)); /* note time a setup step finished */
+void format_setup_times __P((char *, int)); /* summarize setup times */
 void add_notifier __P((struct notifier **, notify_func, void *));
 void remove_notifier __P((struct notifier **, notify_func, void *));
 void notify __P((struct notifier *, int));
@@ -595,6 +625,7 @@ void demand_block __P((void));	/* set all NPs to queue up packets */
 void demand_unblock __P((void)); /* set all NPs to pass packets */
 void demand_discard __P((void)); /* set all NPs to discard packets */
 void demand_rexmit __P((int));	/* retransmit saved frames for an NP */
+void demand_print_stats __P((void)); /* log queued/dropped/replayed counts */
 int  loop_chars __P((unsigned char *, int)); /* process chars from loopback */
 int  loop_frame __P((unsigned char *, int)); /* should we bring link up? */
 
@@ -691,6 +722,7 @@ void unlock __P((void));	/* Delete previously-created lock file */
 void logwtmp __P((const char *, const char *, const char *));
 				/* Write entry to wtmp file */
 int  get_host_seed __P((void));	/* Get host-dependent random number seed */
+int  get_time __P((struct timeval *)); /* Get current time, monotonic if poss. */
 int  have_route_to __P((u_int32_t)); /* Check if route to addr exists */
 #ifdef PPP_FILTER
 int  set_filters __P((struct bpf_program *pass, struct bpf_program *active));
@@ -80,8 +80,18 @@
 #include <utmp.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include "pppd.h"
+#include "fsm.h"
+#include "ipcp.h"
 #include "session.h"
+#include "pathnames.h"
 
 #ifdef USE_PAM
 #include <security/pam_appl.h>
@@ -100,6 +110,12 @@
 /* We have successfully started a session */
 static bool logged_in = 0;
 
+static void record_session(const char *line, const char *name,
+			   const char *host, int uid);
+static int send_record(struct session_record *rec);
+static int start_writer(void);
+static void writer_main(int fd);
+
 #ifdef USE_PAM
 /*
  * Static variables used to communicate between the conversation function
@@ -363,34 +379,21 @@ session_start(flags, user, passwd, ttyName, msg)
      */
 
     if (SESS_ACCT & flags) {
+	int uid = -1;
+
 	if (strncmp(ttyName, "/dev/", 5) == 0)
 	    ttyName += 5;
-	logwtmp(ttyName, user, ifname); /* Add wtmp login entry */
-	logged_in = 1;
-
 #if defined(_PATH_LASTLOG) && !defined(USE_PAM)
 	/*
 	 * Enter the user in lastlog only if he has been authenticated using
 	 * local system services.  If he has not, then we don't know what his
 	 * UID might be, and lastlog is indexed by UID.
 	 */
-	if (pw != NULL) {
-            struct lastlog ll;
-            int fd;
-	    time_t tnow;
-
-            if ((fd = open(_PATH_LASTLOG, O_RDWR, 0)) >= 0) {
-                (void)lseek(fd, (off_t)(pw->pw_uid * sizeof(ll)), SEEK_SET);
-                memset((void *)&ll, 0, sizeof(ll));
-		(void)time(&tnow);
-                ll.ll_time = tnow;
-                (void)strncpy(ll.ll_line, ttyName, sizeof(ll.ll_line));
-                (void)strncpy(ll.ll_host, ifname, sizeof(ll.ll_host));
-                (void)write(fd, (char *)&ll, sizeof(ll));
-                (void)close(fd);
-            }
-	}
+	if (pw != NULL)
+	    uid = pw->pw_uid;
 #endif /* _PATH_LASTLOG and not USE_PAM */
+	record_session(ttyName, user, ifname, uid); /* Add wtmp login entry */
+	logged_in = 1;
 	info("user %s logged in on tty %s intf %s", user, ttyName, ifname);
     }
 
@@ -418,7 +421,259 @@ session_end(const char* ttyName)
     if (logged_in) {
 	if (strncmp(ttyName, "/dev/", 5) == 0)
 	    ttyName += 5;
-	logwtmp(ttyName, "", ""); /* Wipe out utmp logout entry */
+	record_session(ttyName, "", "", -1); /* Wipe out utmp logout entry */
 	logged_in = 0;
     }
 }
+
+/*
+ * record_session - note a login, or a logout if name and host are
+ * empty, for utmp, wtmp and lastlog.  With the async-wtmp option we
+ * hand it to the shared writer, so we don't wait for other pppds'
+ * locks on those files while our link is coming up.
+ */
+static void
+record_session(const char *line, const char *name, const char *host, int uid)
+{
+    struct session_record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.pid = getpid();
+    time(&rec.when);
+    if (ipcp_protent.enabled_flag && ipcp_hisoptions[0].neg_addr)
+	rec.addr = ipcp_hisoptions[0].hisaddr;
+    rec.uid = uid;
+    strlcpy(rec.line, line, sizeof(rec.line));
+    strlcpy(rec.name, name, sizeof(rec.name));
+    strlcpy(rec.host, host, sizeof(rec.host));
+
+    if (async_wtmp && send_record(&rec) == 0)
+	return;
+    session_write_records(&rec, 1);
+}
+
+/*
+ * The wtmp writer.  With async-wtmp, every pppd on the system sends
+ * its records, as datagrams, to one writer process listening on
+ * _PATH_WTMPSOCK.  The writer takes whatever has arrived, from all
+ * of them, and writes it out as one batch: a single pass over utmp
+ * and a single append to wtmp, under one lock each, instead of a
+ * lock and a write per pppd.  The first pppd that finds no writer
+ * starts one; the writer exits once it has been idle for a while.
+ */
+#define WRITER_BATCH	256	/* most records written at once */
+#define WRITER_IDLE	60	/* seconds idle before the writer exits */
+#define WRITER_LINGER	1	/* seconds to wait for late senders */
+
+static int writer_sock = -1;	/* our socket for sending to the writer */
+
+static void
+writer_addr(struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strlcpy(addr->sun_path, _PATH_WTMPSOCK, sizeof(addr->sun_path));
+}
+
+/*
+ * send_record - send a record to the writer, starting it if need be.
+ * Returns -1 if it couldn't be sent, in which case we write the
+ * record ourselves.
+ */
+static int
+send_record(struct session_record *rec)
+{
+    struct sockaddr_un addr;
+    struct timeval tv;
+    int tries;
+
+    if (writer_sock < 0) {
+	writer_sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (writer_sock < 0)
+	    return -1;
+	fcntl(writer_sock, F_SETFD, FD_CLOEXEC);
+	/* if the writer is badly backed up, don't hold up the link */
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	setsockopt(writer_sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+    writer_addr(&addr);
+    for (tries = 0; tries < 2; ++tries) {
+	if (sendto(writer_sock, rec, sizeof(*rec), 0,
+		   (struct sockaddr *) &addr, sizeof(addr)) == sizeof(*rec))
+	    return 0;
+	if (errno != ENOENT && errno != ECONNREFUSED)
+	    break;
+	if (tries > 0 || start_writer() < 0)
+	    break;
+    }
+    dbglog("Couldn't send session record to wtmp writer: %m");
+    return -1;
+}
+
+/*
+ * start_writer - bind the writer's socket and fork the writer.
+ * Returns 0 if there is now a writer, ours or another pppd's.
+ */
+static int
+start_writer(void)
+{
+    struct sockaddr_un addr;
+    int fd, status;
+    pid_t pid;
+
+    fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0)
+	return -1;
+    writer_addr(&addr);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+	if (errno != EADDRINUSE)
+	    goto fail;
+	/*
+	 * Either another pppd has just started a writer, or one died
+	 * and left its socket behind, in which case nobody is
+	 * listening and we can take the name over.
+	 */
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0
+	    || errno != ECONNREFUSED) {
+	    close(fd);
+	    return 0;
+	}
+	unlink(_PATH_WTMPSOCK);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+	    goto fail;
+    }
+    chmod(_PATH_WTMPSOCK, 0600);
+
+    pid = safe_fork(fd_devnull, fd_devnull, fd_devnull);
+    if (pid < 0) {
+	unlink(_PATH_WTMPSOCK);
+	goto fail;
+    }
+    if (pid == 0) {
+	/* fork again, so the writer isn't our child and outlives us */
+	setsid();
+	if (fork() != 0)
+	    _exit(0);
+	writer_main(fd);
+    }
+    close(fd);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+	;
+    return 0;
+
+ fail:
+    error("Couldn't start wtmp writer: %m");
+    close(fd);
+    return -1;
+}
+
+/*
+ * writer_recv - take up to WRITER_BATCH records that have already
+ * arrived, without waiting for more.
+ */
+static int
+writer_recv(int fd, struct session_record *batch)
+{
+    int n = 0, r;
+
+    while (n < WRITER_BATCH) {
+	r = recv(fd, &batch[n], sizeof(batch[n]), MSG_DONTWAIT);
+	if (r < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	if (r == sizeof(batch[n]))
+	    ++n;
+    }
+    return n;
+}
+
+/*
+ * writer_main - the body of the writer process.
+ */
+static void
+writer_main(int fd)
+{
+    struct session_record *batch;
+    struct pollfd pfd;
+    sigset_t mask;
+    int n, idle = WRITER_IDLE;
+
+    /* we have nothing of pppd's to log to but syslog */
+    log_to_fd = -1;
+    if (writer_sock >= 0)
+	close(writer_sock);
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGINT, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGUSR1, SIG_DFL);
+    signal(SIGUSR2, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGALRM, SIG_DFL);
+
+    batch = malloc(WRITER_BATCH * sizeof(*batch));
+    if (batch == NULL) {
+	unlink(_PATH_WTMPSOCK);
+	_exit(1);
+    }
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for (;;) {
+	/* write out whatever has come in since the last batch */
+	while ((n = writer_recv(fd, batch)) > 0)
+	    session_write_records(batch, n);
+	n = poll(&pfd, 1, idle * 1000);
+	if (n < 0 && errno != EINTR)
+	    break;
+	if (n != 0)
+	    continue;
+	if (idle == WRITER_LINGER)
+	    _exit(0);
+	/*
+	 * Idle: stop new senders finding us, then give any that
+	 * found us just before that time to finish sending.
+	 */
+	unlink(_PATH_WTMPSOCK);
+	idle = WRITER_LINGER;
+    }
+    if (idle != WRITER_LINGER)
+	unlink(_PATH_WTMPSOCK);
+    _exit(1);
+}
+
+/*
+ * session_write_records - write out a batch of logins and logouts.
+ */
+void
+session_write_records(struct session_record *recs, int n)
+{
+#if defined(_PATH_LASTLOG) && !defined(USE_PAM)
+    int i;
+#endif
+
+    logwtmp_records(recs, n);
+
+#if defined(_PATH_LASTLOG) && !defined(USE_PAM)
+    for (i = 0; i < n; ++i) {
+	struct lastlog ll;
+	int fd;
+
+	if (recs[i].uid < 0)
+	    continue;
+	if ((fd = open(_PATH_LASTLOG, O_RDWR, 0)) >= 0) {
+	    (void)lseek(fd, (off_t)(recs[i].uid * sizeof(ll)), SEEK_SET);
+	    memset((void *)&ll, 0, sizeof(ll));
+	    ll.ll_time = recs[i].when;
+	    (void)strncpy(ll.ll_line, recs[i].line, sizeof(ll.ll_line));
+	    (void)strncpy(ll.ll_host, recs[i].host, sizeof(ll.ll_host));
+	    (void)write(fd, (char *)&ll, sizeof(ll));
+	    (void)close(fd);
+	}
+    }
+#endif /* _PATH_LASTLOG and not USE_PAM */
+}
@@ -88,4 +88,26 @@ session_start(const int flags, const char* user, const char* passwd, const char*
 void
 session_end(const char* tty);
 
+/*
+ * A login or logout to be written to utmp, wtmp and lastlog.  These
+ * are filled in when the session starts or ends, but may be written
+ * later, by the wtmp writer process shared by all pppds.
+ */
+struct session_record {
+    int		pid;		/* pid of the pppd the session belongs to */
+    time_t	when;
+    u_int32_t	addr;		/* peer's IP address, or 0 */
+    int		uid;		/* for lastlog, or -1 */
+    char	line[32];	/* tty, without /dev/ */
+    char	name[32];	/* user name, or "" for a logout */
+    char	host[64];	/* interface name, or "" for a logout */
+};
+
+void
+session_write_records(struct session_record *recs, int n);
+
+/* in sys-*.c */
+void
+logwtmp_records(struct session_record *recs, int n);
+
 #endif
@@ -143,15 +143,15 @@ SHA1_Final(unsigned char digest[20], SHA1_CTX *context)
 {
     u_int32_t i, j;
     unsigned char finalcount[8];
+    static unsigned char padding[64] = { 0200 };
 
     for (i = 0; i < 8; i++) {
         finalcount[i] = (unsigned char)((context->count[(i >= 4 ? 0 : 1)]
          >> ((3-(i & 3)) * 8) ) & 255);  /* Endian independent */
     }
-    SHA1_Update(context, (unsigned char *) "\200", 1);
-    while ((context->count[0] & 504) != 448) {
-	SHA1_Update(context, (unsigned char *) "\0", 1);
-    }
+    /* a 1 bit and enough zeros to leave 8 bytes of room in the block */
+    j = (context->count[0] >> 3) & 63;
+    SHA1_Update(context, padding, (j < 56 ? 56 : 120) - j);
     SHA1_Update(context, finalcount, 8);  /* Should cause a SHA1Transform() */
     for (i = 0; i < 20; i++) {
 	digest[i] = (unsigned char)
@@ -92,6 +92,13 @@
 #include <ctype.h>
 #include <termios.h>
 #include <unistd.h>
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+#ifdef USE_NETLINK
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
 
 /* This is in netdevice.h. However, this compile will fail miserably if
    you attempt to include netdevice.h because it has so many references
@@ -124,6 +131,8 @@
 #include "pppd.h"
 #include "fsm.h"
 #include "ipcp.h"
+#include "lcp.h"
+#include "session.h"
 
 #ifdef IPX_CHANGE
 #include "ipxcp.h"
@@ -188,9 +197,76 @@ int ppp_dev_fd = -1;		/* fd for /dev/ppp (new style driver) */
 
 static int chindex;		/* channel index (new style driver) */
 
+/*
+ * ppp units created ahead of time for the unit-pool option, so that
+ * make_ppp_unit can hand one out without going to the driver.
+ */
+static struct pooled_unit {
+    int fd;			/* instance of /dev/ppp attached to it */
+    int unit;
+} unit_pool[MAX_UNIT_POOL];
+static int n_pooled_units;
+
 static fd_set in_fds;		/* set of fds that wait_input waits for */
 static int max_in_fd;		/* highest fd set in in_fds */
 
+#ifdef USE_EPOLL
+/*
+ * When the kernel supports it we wait with epoll, which has no limit
+ * on fd numbers and only reports the fds that are actually ready.
+ * If epoll_create1 fails we fall back to select on in_fds.
+ */
+#define MAX_EPOLL_EVENTS 16
+static int epoll_fd = -1;	/* epoll instance for wait_input */
+#endif
+
+#ifdef USE_NETLINK
+/*
+ * Where the kernel has rtnetlink we use it to look up routes and to
+ * set addresses, routes and interface flags, instead of parsing
+ * /proc/net/route and issuing several ioctls per change.  If the
+ * socket can't be created, or the kernel is too old to answer a
+ * request, we fall back to the ioctl and /proc code.
+ */
+static int nl_fd = -1;		/* rtnetlink socket */
+static unsigned int nl_seq;	/* sequence number of last request */
+static int nlmon_fd = -1;	/* for link/address change notifications */
+
+#define NL_BUFSIZE	1024
+
+/*
+ * The kernel treats a lookup for 0.0.0.0 as a local address, so to
+ * find the default route we look up an address from the reserved
+ * class E range, which nobody should have a more specific route to.
+ */
+#define NL_DEFAULT_PROBE	0xf0000001	/* 240.0.0.1 */
+
+struct nl_batch {
+    int		len;		/* # bytes of requests in buf */
+    int		nmsgs;		/* # requests in buf */
+    unsigned int first_seq;	/* sequence number of first request */
+    union {
+	struct nlmsghdr hdr;	/* for alignment */
+	char	buf[NL_BUFSIZE];
+    } u;
+};
+
+typedef int (*nl_reply_fn) __P((struct nlmsghdr *, void *));
+
+static struct nlmsghdr *nl_add_msg(struct nl_batch *b, int type, int flags,
+				   const void *body, int bodylen);
+static void nl_add_attr(struct nl_batch *b, struct nlmsghdr *n, int type,
+			const void *data, int len);
+static int nl_transact(struct nl_batch *b, nl_reply_fn fn, void *arg);
+static int nl_ifindex(void);
+static int nl_get_stats64(struct pppd_stats *stats);
+static int nl_route_lookup(u_int32_t addr, int fib_match,
+			   struct rtmsg *rtm, int *oif, u_int32_t *gw,
+			   int *metric);
+static int nl_route_change(int type, int flags, u_int32_t dst, int dst_len,
+			   int metric);
+#endif
+
 static int has_proxy_arp       = 0;
 static int driver_version      = 0;
 static int driver_modification = 0;
@@ -240,6 +316,17 @@ static void decode_version (char *buf, int *version, int *mod, int *patch);
 static int set_kdebugflag(int level);
 static int ppp_registered(void);
 static int make_ppp_unit(void);
+static void unit_pool_fill(void *arg);
+
+/*
+ * For extending the 32-bit counters from SIOCGPPPSTATS to 64 bits:
+ * the last raw reading and the running 64-bit totals.
+ */
+static u_int32_t stats_last_raw[4];
+static struct pppd_stats stats_ext;
+static int stats_unit = -1;
+static int stats_have_raw;	/* stats_last_raw is from the current unit */
+
 static int setifstate (int u, int state);
 
 extern u_char	inpacket_buf[];	/* borrowed from main.c */
@@ -324,6 +411,22 @@ void sys_init(void)
 
     FD_ZERO(&in_fds);
     max_in_fd = 0;
+
+#ifdef USE_EPOLL
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+	warn("Couldn't create epoll instance, using select: %m");
+#endif
+
+#ifdef USE_NETLINK
+    nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nl_fd < 0)
+	dbglog("Couldn't create rtnetlink socket, using ioctls: %m");
+    nl_seq = time(NULL);
+#endif
+
+    if (unit_pool_size > 0)
+	unit_pool_fill(NULL);
 }
 
 /********************************************************************
@@ -362,8 +465,12 @@ void sys_cleanup(void)
 void
 sys_close(void)
 {
+    int i;
+
     if (new_style_driver && ppp_dev_fd >= 0)
 	close(ppp_dev_fd);
+    for (i = 0; i < n_pooled_units; ++i)
+	close(unit_pool[i].fd);
     if (sock_fd >= 0)
 	close(sock_fd);
 #ifdef INET6
@@ -374,6 +481,16 @@ sys_close(void)
 	close(slave_fd);
     if (master_fd >= 0)
 	close(master_fd);
+#ifdef USE_EPOLL
+    if (epoll_fd >= 0)
+	close(epoll_fd);
+#endif
+#ifdef USE_NETLINK
+    if (nl_fd >= 0)
+	close(nl_fd);
+    if (nlmon_fd >= 0)
+	close(nlmon_fd);
+#endif
 }
 
 /********************************************************************
@@ -601,8 +718,8 @@ void generic_disestablish_ppp(int dev_fd)
 	    modify_flags(ppp_dev_fd, 0, SC_LOOP_TRAFFIC);
 	    looped = 1;
 	} else if (!doing_multilink && ppp_dev_fd >= 0) {
-	    close(ppp_dev_fd);
 	    remove_fd(ppp_dev_fd);
+	    close(ppp_dev_fd);
 	    ppp_dev_fd = -1;
 	}
     } else {
@@ -621,11 +738,25 @@ void generic_disestablish_ppp(int dev_fd)
 static int make_ppp_unit()
 {
 	int x, flags;
+	struct timeval t0, t1;
+	int pooled = 0;
 
 	if (ppp_dev_fd >= 0) {
 		dbglog("in make_ppp_unit, already had /dev/ppp open?");
 		close(ppp_dev_fd);
 	}
+	get_time(&t0);
+	if (n_pooled_units > 0 && req_unit < 0) {
+		--n_pooled_units;
+		ppp_dev_fd = unit_pool[n_pooled_units].fd;
+		ifunit = unit_pool[n_pooled_units].unit;
+		pooled = 1;
+		x = 0;
+		/* top the pool up again once this link is up */
+		UNTIMEOUT(unit_pool_fill, NULL);
+		TIMEOUT(unit_pool_fill, NULL, 1);
+		goto got_unit;
+	}
 	ppp_dev_fd = open("/dev/ppp", O_RDWR);
 	if (ppp_dev_fd < 0)
 		fatal("Couldn't open /dev/ppp: %m");
@@ -644,6 +775,18 @@ static int make_ppp_unit()
 	if (x < 0)
 		error("Couldn't create new ppp unit: %m");
 
+ got_unit:
+	if (x == 0) {
+		/* a new unit's statistics start again from 0 */
+		stats_have_raw = 0;
+		get_time(&t1);
+		dbglog("Got ppp unit %d in %ld us%s", ifunit,
+		       (long) ((t1.tv_sec - t0.tv_sec) * 1000000
+			       + t1.tv_usec - t0.tv_usec),
+		       (pooled? " from the pool": ""));
+		setup_event("UNIT", -1);
+	}
+
 	if (x == 0 && req_ifname[0] != '\0') {
 		struct ifreq ifr;
 		char t[MAXIFNAMELEN];
@@ -661,6 +804,63 @@ static int make_ppp_unit()
 	return x;
 }
 
+/*
+ * pool_make_unit - create a ppp unit for the pool and configure it
+ * as far as we can before we know anything about the link.
+ */
+static int pool_make_unit(void)
+{
+	struct pooled_unit *pu = &unit_pool[n_pooled_units];
+	struct ifreq ifr;
+	int flags;
+
+	pu->fd = open("/dev/ppp", O_RDWR);
+	if (pu->fd < 0) {
+		error("Couldn't open /dev/ppp for the unit pool: %m");
+		return 0;
+	}
+	(void) fcntl(pu->fd, F_SETFD, FD_CLOEXEC);
+	flags = fcntl(pu->fd, F_GETFL);
+	if (flags == -1
+	    || fcntl(pu->fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		warn("Couldn't set /dev/ppp to nonblock: %m");
+	pu->unit = -1;
+	if (ioctl(pu->fd, PPPIOCNEWUNIT, &pu->unit) < 0) {
+		error("Couldn't create ppp unit for the pool: %m");
+		close(pu->fd);
+		return 0;
+	}
+	if (kdebugflag && ioctl(pu->fd, PPPIOCSDEBUG, &kdebugflag) < 0)
+		warn("ioctl(PPPIOCSDEBUG): %m");
+
+	memset(&ifr, 0, sizeof(ifr));
+	slprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s%d",
+		 PPP_DRV_NAME, pu->unit);
+	ifr.ifr_mtu = MIN(lcp_allowoptions[0].mru, PPP_MRU);
+	if (ioctl(sock_fd, SIOCSIFMTU, &ifr) < 0)
+		warn("Couldn't set MTU on %s: %m", ifr.ifr_name);
+
+	++n_pooled_units;
+	return 1;
+}
+
+/*
+ * unit_pool_fill - create ppp units until the pool is full.
+ * Leave it until later if a link is in the middle of coming up.
+ */
+static void unit_pool_fill(void *arg)
+{
+	if (!new_style_driver)
+		return;
+	if (phase >= PHASE_ESTABLISH && phase <= PHASE_NETWORK) {
+		TIMEOUT(unit_pool_fill, NULL, 1);
+		return;
+	}
+	while (n_pooled_units < unit_pool_size)
+		if (!pool_make_unit())
+			break;
+}
+
 /*
  * cfg_bundle - configure the existing bundle.
  * Used in demand mode.
@@ -740,8 +940,8 @@ int bundle_attach(int ifnum)
 void destroy_bundle(void)
 {
 	if (ppp_dev_fd >= 0) {
-		close(ppp_dev_fd);
 		remove_fd(ppp_dev_fd);
+		close(ppp_dev_fd);
 		ppp_dev_fd = -1;
 	}
 }
@@ -1095,6 +1295,24 @@ void wait_input(struct timeval *timo)
     fd_set ready, exc;
     int n;
 
+#ifdef USE_EPOLL
+    if (epoll_fd >= 0) {
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	int ms = -1;
+
+	if (timo != NULL) {
+	    /* round up so that we don't wake just before the timeout */
+	    if (timo->tv_sec >= INT_MAX / 1000 - 1)
+		ms = INT_MAX;
+	    else
+		ms = timo->tv_sec * 1000 + (timo->tv_usec + 999) / 1000;
+	}
+	n = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, ms);
+	if (n < 0 && errno != EINTR)
+	    fatal("epoll_wait: %m");
+	return;
+    }
+#endif
     ready = in_fds;
     exc = in_fds;
     n = select(max_in_fd + 1, &ready, NULL, &exc, timo);
@@ -1107,6 +1325,18 @@ void wait_input(struct timeval *timo)
  */
 void add_fd(int fd)
 {
+#ifdef USE_EPOLL
+    if (epoll_fd >= 0) {
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLPRI;
+	ev.data.fd = fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0 && errno != EEXIST)
+	    error("epoll_ctl(EPOLL_CTL_ADD, %d): %m", fd);
+	return;
+    }
+#endif
     if (fd >= FD_SETSIZE)
 	fatal("internal error: file descriptor too large (%d)", fd);
     FD_SET(fd, &in_fds);
@@ -1119,7 +1349,17 @@ void add_fd(int fd)
  */
 void remove_fd(int fd)
 {
-    FD_CLR(fd, &in_fds);
+#ifdef USE_EPOLL
+    if (epoll_fd >= 0) {
+	/* ENOENT/EBADF just mean the fd was never added or already closed */
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0
+	    && errno != ENOENT && errno != EBADF)
+	    error("epoll_ctl(EPOLL_CTL_DEL, %d): %m", fd);
+	return;
+    }
+#endif
+    if (fd < FD_SETSIZE)
+	FD_CLR(fd, &in_fds);
 }
 
 
@@ -1387,6 +1627,12 @@ get_ppp_stats(u, stats)
     struct pppd_stats *stats;
 {
     struct ifpppstatsreq req;
+    u_int32_t raw[4];
+
+#ifdef USE_NETLINK
+    if (nl_get_stats64(stats))
+	return 1;
+#endif
 
     memset (&req, 0, sizeof (req));
 
@@ -1396,10 +1642,27 @@ get_ppp_stats(u, stats)
 	error("Couldn't get PPP statistics: %m");
 	return 0;
     }
-    stats->bytes_in = req.stats.p.ppp_ibytes;
-    stats->bytes_out = req.stats.p.ppp_obytes;
-    stats->pkts_in = req.stats.p.ppp_ipackets;
-    stats->pkts_out = req.stats.p.ppp_opackets;
+    raw[0] = req.stats.p.ppp_ibytes;
+    raw[1] = req.stats.p.ppp_obytes;
+    raw[2] = req.stats.p.ppp_ipackets;
+    raw[3] = req.stats.p.ppp_opackets;
+    if (!stats_have_raw || stats_unit != ifunit) {
+	/*
+	 * The kernel's counters belong to the ppp unit, and a new
+	 * unit (after a persist reconnect, say, even if it gets the
+	 * same number) starts them again from 0; take its first
+	 * reading as the baseline rather than as a wrapped counter.
+	 */
+	memcpy(stats_last_raw, raw, sizeof(stats_last_raw));
+	stats_unit = ifunit;
+	stats_have_raw = 1;
+    }
+    stats_ext.bytes_in += (u_int32_t) (raw[0] - stats_last_raw[0]);
+    stats_ext.bytes_out += (u_int32_t) (raw[1] - stats_last_raw[1]);
+    stats_ext.pkts_in += (u_int32_t) (raw[2] - stats_last_raw[2]);
+    stats_ext.pkts_out += (u_int32_t) (raw[3] - stats_last_raw[3]);
+    memcpy(stats_last_raw, raw, sizeof(stats_last_raw));
+    *stats = stats_ext;
     return 1;
 }
 
@@ -1457,6 +1720,625 @@ static char *path_to_procfs(const char *tail)
     return proc_path;
 }
 
+#ifdef USE_NETLINK
+/********************************************************************
+ *
+ * nl_add_msg - append a request to a netlink batch.  Every request
+ * asks for an acknowledgement so nl_transact knows when it's done.
+ */
+static struct nlmsghdr *
+nl_add_msg(struct nl_batch *b, int type, int flags, const void *body,
+	   int bodylen)
+{
+    struct nlmsghdr *n;
+
+    if (b->nmsgs == 0) {
+	b->len = 0;
+	b->first_seq = nl_seq + 1;
+    }
+    n = (struct nlmsghdr *) (b->u.buf + b->len);
+    if (b->len + NLMSG_SPACE(bodylen) > sizeof(b->u.buf))
+	fatal("netlink request too long");
+    memset(n, 0, NLMSG_SPACE(bodylen));
+    n->nlmsg_len = NLMSG_LENGTH(bodylen);
+    n->nlmsg_type = type;
+    n->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    n->nlmsg_seq = ++nl_seq;
+    memcpy(NLMSG_DATA(n), body, bodylen);
+    b->len += NLMSG_ALIGN(n->nlmsg_len);
+    ++b->nmsgs;
+    return n;
+}
+
+/********************************************************************
+ *
+ * nl_add_attr - append an attribute to the last request in a batch.
+ */
+static void
+nl_add_attr(struct nl_batch *b, struct nlmsghdr *n, int type,
+	    const void *data, int len)
+{
+    struct rtattr *rta;
+
+    if (NLMSG_ALIGN(n->nlmsg_len) + RTA_SPACE(len)
+	> sizeof(b->u.buf) - ((char *) n - b->u.buf))
+	fatal("netlink request too long");
+    rta = (struct rtattr *) ((char *) n + NLMSG_ALIGN(n->nlmsg_len));
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+    b->len = ((char *) n - b->u.buf) + NLMSG_ALIGN(n->nlmsg_len);
+}
+
+/********************************************************************
+ *
+ * nl_transact - send all the requests in a batch with one system
+ * call and wait until the kernel has answered all of them.  Replies
+ * other than acknowledgements are passed to fn.  Returns 0 if all
+ * the requests succeeded, otherwise minus the errno of the first one
+ * that failed.  The batch is emptied.
+ */
+static int
+nl_transact(struct nl_batch *b, nl_reply_fn fn, void *arg)
+{
+    static union {
+	struct nlmsghdr hdr;
+	char buf[32768];
+    } reply;
+    struct sockaddr_nl sa;
+    struct nlmsghdr *n;
+    struct nlmsgerr *e;
+    int len, pending, err;
+
+    pending = b->nmsgs;
+    b->nmsgs = 0;
+    if (nl_fd < 0)
+	return -EOPNOTSUPP;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    if (sendto(nl_fd, b->u.buf, b->len, 0, (struct sockaddr *) &sa,
+	       sizeof(sa)) < 0)
+	return -errno;
+
+    err = 0;
+    while (pending > 0) {
+	len = recv(nl_fd, reply.buf, sizeof(reply.buf), 0);
+	if (len < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -errno;
+	}
+	for (n = &reply.hdr; NLMSG_OK(n, len); n = NLMSG_NEXT(n, len)) {
+	    /* ignore stale replies to requests we gave up on */
+	    if (n->nlmsg_seq - b->first_seq >= nl_seq - b->first_seq + 1)
+		continue;
+	    if (n->nlmsg_type == NLMSG_DONE) {
+		--pending;
+	    } else if (n->nlmsg_type == NLMSG_ERROR) {
+		e = NLMSG_DATA(n);
+		if (e->error != 0 && err == 0)
+		    err = e->error;
+		--pending;
+	    } else if (fn != NULL) {
+		(*fn)(n, arg);
+	    }
+	}
+    }
+    return err;
+}
+
+/********************************************************************
+ *
+ * nl_ifindex - get the kernel's index for our ppp interface.
+ */
+static int
+nl_ifindex(void)
+{
+    return if_nametoindex(ifname);
+}
+
+static int
+nl_stats_reply(struct nlmsghdr *n, void *arg)
+{
+    struct pppd_stats *stats = arg;
+    struct ifinfomsg *ifi;
+    struct rtattr *rta;
+    struct rtnl_link_stats64 s;
+    int len;
+
+    if (n->nlmsg_type != RTM_NEWLINK)
+	return 0;
+    ifi = NLMSG_DATA(n);
+    len = IFLA_PAYLOAD(n);
+    for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+	if (rta->rta_type != IFLA_STATS64
+	    || RTA_PAYLOAD(rta) < sizeof(s))
+	    continue;
+	memcpy(&s, RTA_DATA(rta), sizeof(s));	/* may be unaligned */
+	stats->bytes_in = s.rx_bytes;
+	stats->bytes_out = s.tx_bytes;
+	stats->pkts_in = s.rx_packets;
+	stats->pkts_out = s.tx_packets;
+	return 1;
+    }
+    return 0;
+}
+
+/********************************************************************
+ *
+ * nl_get_stats64 - get the 64-bit counters for our interface.
+ * Returns 0 if they aren't available.
+ */
+static int
+nl_get_stats64(struct pppd_stats *stats)
+{
+    struct nl_batch b;
+    struct ifinfomsg ifi;
+    struct pppd_stats s;
+
+    if (nl_fd < 0)
+	return 0;
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_family = AF_UNSPEC;
+    ifi.ifi_index = nl_ifindex();
+    if (ifi.ifi_index == 0)
+	return 0;
+    s.bytes_in = ~(u_int64_t) 0;
+    b.nmsgs = 0;
+    nl_add_msg(&b, RTM_GETLINK, 0, &ifi, sizeof(ifi));
+    if (nl_transact(&b, nl_stats_reply, &s) < 0 || s.bytes_in == ~(u_int64_t) 0)
+	return 0;
+    *stats = s;
+    return 1;
+}
+
+struct nl_route {
+    int found;
+    struct rtmsg rtm;
+    int oif;
+    u_int32_t gw;
+    int metric;
+};
+
+static int
+nl_route_reply(struct nlmsghdr *n, void *arg)
+{
+    struct nl_route *r = arg;
+    struct rtmsg *rtm;
+    struct rtattr *rta;
+    int len;
+
+    if (n->nlmsg_type != RTM_NEWROUTE)
+	return 0;
+    rtm = NLMSG_DATA(n);
+    r->found = 1;
+    r->rtm = *rtm;
+    len = RTM_PAYLOAD(n);
+    for (rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+	switch (rta->rta_type) {
+	case RTA_OIF:
+	    r->oif = *(int *) RTA_DATA(rta);
+	    break;
+	case RTA_GATEWAY:
+	    r->gw = *(u_int32_t *) RTA_DATA(rta);
+	    break;
+	case RTA_PRIORITY:
+	    r->metric = *(int *) RTA_DATA(rta);
+	    break;
+	}
+    }
+    return 0;
+}
+
+/********************************************************************
+ *
+ * nl_route_lookup - ask the kernel which route it would use to reach
+ * addr (network byte order).  With fib_match, we get the routing
+ * table entry that matched (including its prefix length) rather than
+ * a host route.  Returns 1 if there is a route, 0 if there isn't,
+ * or -1 if we couldn't find out.
+ */
+static int
+nl_route_lookup(u_int32_t addr, int fib_match, struct rtmsg *rtm, int *oif,
+		u_int32_t *gw, int *metric)
+{
+    struct nl_batch b;
+    struct nlmsghdr *n;
+    struct rtmsg req;
+    struct nl_route r;
+    int err;
+
+    memset(&req, 0, sizeof(req));
+    req.rtm_family = AF_INET;
+    req.rtm_dst_len = 32;
+#ifdef RTM_F_FIB_MATCH
+    if (fib_match)
+	req.rtm_flags = RTM_F_FIB_MATCH;
+#else
+    if (fib_match)
+	return -1;
+#endif
+    b.nmsgs = 0;
+    n = nl_add_msg(&b, RTM_GETROUTE, 0, &req, sizeof(req));
+    nl_add_attr(&b, n, RTA_DST, &addr, sizeof(addr));
+
+    memset(&r, 0, sizeof(r));
+    err = nl_transact(&b, nl_route_reply, &r);
+    if (err == -ENETUNREACH || err == -EHOSTUNREACH)
+	return 0;
+    if (err < 0 || !r.found)
+	return -1;
+    *rtm = r.rtm;
+    *oif = r.oif;
+    *gw = r.gw;
+    *metric = r.metric;
+    return 1;
+}
+
+/********************************************************************
+ *
+ * nl_route_change - add or delete a route through our interface in
+ * the main table.
+ */
+static int
+nl_route_change(int type, int flags, u_int32_t dst, int dst_len, int metric)
+{
+    struct nl_batch b;
+    struct nlmsghdr *n;
+    struct rtmsg req;
+    int ifindex;
+
+    ifindex = nl_ifindex();
+    if (ifindex == 0)
+	return -ENODEV;
+    memset(&req, 0, sizeof(req));
+    req.rtm_family = AF_INET;
+    req.rtm_dst_len = dst_len;
+    req.rtm_table = RT_TABLE_MAIN;
+    if (type == RTM_NEWROUTE) {
+	req.rtm_protocol = RTPROT_BOOT;
+	req.rtm_scope = RT_SCOPE_LINK;
+	req.rtm_type = RTN_UNICAST;
+    } else {
+	req.rtm_scope = RT_SCOPE_NOWHERE;
+    }
+    b.nmsgs = 0;
+    n = nl_add_msg(&b, type, flags, &req, sizeof(req));
+    nl_add_attr(&b, n, RTA_DST, &dst, sizeof(dst));
+    nl_add_attr(&b, n, RTA_OIF, &ifindex, sizeof(ifindex));
+    nl_add_attr(&b, n, RTA_PRIORITY, &metric, sizeof(metric));
+    return nl_transact(&b, NULL, NULL);
+}
+
+/*
+ * Cache of the system's interfaces and IPv4 addresses, so that
+ * finding the interface for proxy ARP, or a hardware address, doesn't
+ * mean an SIOCGIFCONF and several ioctls per interface each time.
+ * It is filled by dumping the kernel's tables once and then kept up
+ * to date from rtnetlink notifications, which we read whenever we
+ * look something up.  The addresses are kept sorted by prefix length
+ * (longest first) and then by network, so that the interface on the
+ * most specific subnet containing an address can be found with a
+ * binary search for each prefix length.
+ */
+struct if_entry {
+    int		index;
+    unsigned int flags;
+    int		type;		/* ARPHRD_* */
+    int		hwlen;
+    unsigned char hwaddr[32];
+    char	name[IF_NAMESIZE];
+};
+
+struct if_addr {
+    u_int32_t	net;		/* network, host byte order */
+    int		prefixlen;
+    u_int32_t	local;		/* address, network byte order */
+    int		index;
+};
+
+static int ifc_valid;			/* cache has been loaded */
+static int ifc_sorted;			/* ifc_addrs is sorted */
+static struct if_entry *ifc_links;
+static int ifc_nlinks, ifc_maxlinks;
+static struct if_addr *ifc_addrs;
+static int ifc_naddrs, ifc_maxaddrs;
+
+#define PREFIX_MASK(len)	((len) == 0? 0: ~0U << (32 - (len)))
+
+/*
+ * ifc_link_pos - binary search for an interface index in ifc_links,
+ * which is kept sorted by index.  Returns the position where it is
+ * or should be inserted.
+ */
+static int
+ifc_link_pos(int index)
+{
+    int lo, hi, mid;
+
+    lo = 0;
+    hi = ifc_nlinks;
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (ifc_links[mid].index < index)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+static struct if_entry *
+ifc_find_link(int index)
+{
+    int i = ifc_link_pos(index);
+
+    if (i < ifc_nlinks && ifc_links[i].index == index)
+	return &ifc_links[i];
+    return NULL;
+}
+
+static void
+ifc_del_addrs(int index, u_int32_t local, int prefixlen)
+{
+    int i, j;
+
+    for (i = j = 0; i < ifc_naddrs; ++i) {
+	if (ifc_addrs[i].index == index && (local == 0
+	    || (ifc_addrs[i].local == local
+		&& ifc_addrs[i].prefixlen == prefixlen)))
+	    continue;
+	ifc_addrs[j++] = ifc_addrs[i];
+    }
+    ifc_naddrs = j;
+}
+
+/*
+ * ifc_msg - update the cache from an RTM_{NEW,DEL}{LINK,ADDR} message.
+ * arg is non-NULL while loading the cache from a dump, when we know
+ * there won't be any duplicate addresses to remove.
+ */
+static int
+ifc_msg(struct nlmsghdr *n, void *arg)
+{
+    struct ifinfomsg *ifi;
+    struct ifaddrmsg *ifa;
+    struct rtattr *rta;
+    struct if_entry *ife;
+    struct if_addr *ia;
+    u_int32_t local;
+    int i, len;
+
+    switch (n->nlmsg_type) {
+    case RTM_NEWLINK:
+    case RTM_DELLINK:
+	ifi = NLMSG_DATA(n);
+	i = ifc_link_pos(ifi->ifi_index);
+	ife = &ifc_links[i];
+	if (n->nlmsg_type == RTM_DELLINK) {
+	    if (i < ifc_nlinks && ife->index == ifi->ifi_index) {
+		--ifc_nlinks;
+		memmove(ife, ife + 1, (ifc_nlinks - i) * sizeof(*ife));
+	    }
+	    ifc_del_addrs(ifi->ifi_index, 0, 0);
+	    break;
+	}
+	if (i == ifc_nlinks || ife->index != ifi->ifi_index) {
+	    if (ifc_nlinks >= ifc_maxlinks) {
+		ifc_maxlinks = ifc_maxlinks? 2 * ifc_maxlinks: 16;
+		ifc_links = realloc(ifc_links,
+				    ifc_maxlinks * sizeof(*ifc_links));
+		if (ifc_links == NULL)
+		    novm("interface cache");
+	    }
+	    ife = &ifc_links[i];
+	    memmove(ife + 1, ife, (ifc_nlinks - i) * sizeof(*ife));
+	    ++ifc_nlinks;
+	    memset(ife, 0, sizeof(*ife));
+	    ife->index = ifi->ifi_index;
+	}
+	ife->flags = ifi->ifi_flags;
+	ife->type = ifi->ifi_type;
+	len = IFLA_PAYLOAD(n);
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+	    switch (rta->rta_type) {
+	    case IFLA_IFNAME:
+		strlcpy(ife->name, RTA_DATA(rta), sizeof(ife->name));
+		break;
+	    case IFLA_ADDRESS:
+		ife->hwlen = RTA_PAYLOAD(rta);
+		if (ife->hwlen > sizeof(ife->hwaddr))
+		    ife->hwlen = sizeof(ife->hwaddr);
+		memcpy(ife->hwaddr, RTA_DATA(rta), ife->hwlen);
+		break;
+	    }
+	}
+	break;
+
+    case RTM_NEWADDR:
+    case RTM_DELADDR:
+	ifa = NLMSG_DATA(n);
+	if (ifa->ifa_family != AF_INET)
+	    break;
+	local = 0;
+	len = IFA_PAYLOAD(n);
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+	    if (rta->rta_type == IFA_LOCAL
+		|| (rta->rta_type == IFA_ADDRESS && local == 0))
+		local = *(u_int32_t *) RTA_DATA(rta);
+	}
+	if (local == 0)
+	    break;
+	if (arg == NULL)
+	    ifc_del_addrs(ifa->ifa_index, local, ifa->ifa_prefixlen);
+	if (n->nlmsg_type == RTM_DELADDR)
+	    break;
+	if (ifc_naddrs >= ifc_maxaddrs) {
+	    ifc_maxaddrs = ifc_maxaddrs? 2 * ifc_maxaddrs: 16;
+	    ifc_addrs = realloc(ifc_addrs, ifc_maxaddrs * sizeof(*ifc_addrs));
+	    if (ifc_addrs == NULL)
+		novm("interface cache");
+	}
+	ia = &ifc_addrs[ifc_naddrs++];
+	ia->prefixlen = ifa->ifa_prefixlen;
+	ia->net = ntohl(local) & PREFIX_MASK(ia->prefixlen);
+	ia->local = local;
+	ia->index = ifa->ifa_index;
+	ifc_sorted = 0;
+	break;
+    }
+    return 0;
+}
+
+/*
+ * ifc_load - (re)load the cache from the kernel's tables.
+ */
+static int
+ifc_load(void)
+{
+    struct nl_batch b;
+    struct ifinfomsg ifi;
+    struct ifaddrmsg ifa;
+
+    ifc_nlinks = ifc_naddrs = 0;
+    ifc_valid = 0;
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_family = AF_UNSPEC;
+    b.nmsgs = 0;
+    nl_add_msg(&b, RTM_GETLINK, NLM_F_DUMP, &ifi, sizeof(ifi));
+    if (nl_transact(&b, ifc_msg, &ifc_valid) < 0)
+	return 0;
+    memset(&ifa, 0, sizeof(ifa));
+    ifa.ifa_family = AF_INET;
+    nl_add_msg(&b, RTM_GETADDR, NLM_F_DUMP, &ifa, sizeof(ifa));
+    if (nl_transact(&b, ifc_msg, &ifc_valid) < 0)
+	return 0;
+    ifc_valid = 1;
+    return 1;
+}
+
+/*
+ * ifc_update - bring the cache up to date.  Returns 0 if we can't
+ * use it, so the caller should fall back to ioctls.
+ */
+static int
+ifc_update(void)
+{
+    static union {
+	struct nlmsghdr hdr;
+	char buf[8192];
+    } ev;
+    struct sockaddr_nl sa;
+    struct nlmsghdr *n;
+    int len;
+
+    if (nl_fd < 0)
+	return 0;
+    if (nlmon_fd < 0) {
+	/* subscribe first so we don't miss changes made during the dump */
+	nlmon_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+			  NETLINK_ROUTE);
+	if (nlmon_fd < 0)
+	    return 0;
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+	if (bind(nlmon_fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+	    close(nlmon_fd);
+	    nlmon_fd = -1;
+	    return 0;
+	}
+    }
+
+    for (;;) {
+	len = recv(nlmon_fd, ev.buf, sizeof(ev.buf), MSG_DONTWAIT);
+	if (len < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == ENOBUFS) {
+		/* we missed some; start again */
+		ifc_valid = 0;
+		continue;
+	    }
+	    break;
+	}
+	if (!ifc_valid)
+	    continue;		/* will be reloaded anyway */
+	for (n = &ev.hdr; NLMSG_OK(n, len); n = NLMSG_NEXT(n, len))
+	    ifc_msg(n, NULL);
+    }
+    if (!ifc_valid && !ifc_load())
+	return 0;
+    return 1;
+}
+
+static int
+ifc_addr_cmp(const void *a, const void *b)
+{
+    const struct if_addr *x = a, *y = b;
+
+    if (x->prefixlen != y->prefixlen)
+	return y->prefixlen - x->prefixlen;
+    if (x->net != y->net)
+	return x->net < y->net? -1: 1;
+    return x->index - y->index;
+}
+
+/*
+ * ifc_subnet_lookup - find the broadcast (non point-to-point,
+ * non-loopback) interface that is up and has an address on the most
+ * specific subnet containing addr (network byte order).
+ */
+static struct if_entry *
+ifc_subnet_lookup(u_int32_t addr)
+{
+    struct if_entry *ife;
+    u_int32_t net;
+    int plen, lo, hi, mid;
+
+    if (!ifc_sorted) {
+	qsort(ifc_addrs, ifc_naddrs, sizeof(*ifc_addrs), ifc_addr_cmp);
+	ifc_sorted = 1;
+    }
+    addr = ntohl(addr);
+    for (plen = 32; plen >= 0; --plen) {
+	net = addr & PREFIX_MASK(plen);
+	/* find the first entry >= (plen, net) */
+	lo = 0;
+	hi = ifc_naddrs;
+	while (lo < hi) {
+	    mid = (lo + hi) / 2;
+	    if (ifc_addrs[mid].prefixlen > plen
+		|| (ifc_addrs[mid].prefixlen == plen
+		    && ifc_addrs[mid].net < net))
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+	for (; lo < ifc_naddrs && ifc_addrs[lo].prefixlen == plen
+		 && ifc_addrs[lo].net == net; ++lo) {
+	    ife = ifc_find_link(ifc_addrs[lo].index);
+	    if (ife != NULL
+		&& ((ife->flags ^ FLAGS_GOOD) & FLAGS_MASK) == 0)
+		return ife;
+	}
+    }
+    return NULL;
+}
+
+static struct if_entry *
+ifc_find_name(const char *name)
+{
+    int i;
+
+    for (i = 0; i < ifc_nlinks; ++i)
+	if (strcmp(ifc_links[i].name, name) == 0)
+	    return &ifc_links[i];
+    return NULL;
+}
+#endif /* USE_NETLINK */
+
 /*
  * /proc/net/route parsing stuff.
  */
@@ -1583,6 +2465,33 @@ static int read_route_table(struct rtentry *rt)
 static int defaultroute_exists (struct rtentry *rt, int metric)
 {
     int result = 0;
+#ifdef USE_NETLINK
+    static char rt_devname[IF_NAMESIZE];
+    struct rtmsg rtm;
+    u_int32_t gw;
+    int oif, m;
+
+    if (nl_fd >= 0) {
+	switch (nl_route_lookup(htonl(NL_DEFAULT_PROBE), 1,
+				&rtm, &oif, &gw, &m)) {
+	case 0:
+	    return 0;
+	case 1:
+	    /* if it's not the default route we wanted, look harder */
+	    if (rtm.rtm_dst_len != 0 || rtm.rtm_type != RTN_UNICAST
+		|| (metric >= 0 && m != metric))
+		break;
+	    memset(rt, 0, sizeof(*rt));
+	    SIN_ADDR(rt->rt_gateway) = gw;
+	    rt->rt_flags = RTF_UP | (gw != 0? RTF_GATEWAY: 0);
+	    rt->rt_metric = m;
+	    if (if_indextoname(oif, rt_devname) == NULL)
+		slprintf(rt_devname, sizeof(rt_devname), "if%d", oif);
+	    rt->rt_dev = rt_devname;
+	    return 1;
+	}
+    }
+#endif
 
     if (!open_route_table())
 	return 0;
@@ -1615,6 +2524,30 @@ int have_route_to(u_int32_t addr)
 {
     struct rtentry rt;
     int result = 0;
+#ifdef USE_NETLINK
+    struct rtmsg rtm;
+    u_int32_t gw;
+    int oif, m;
+
+    /*
+     * Ask the kernel which route it would use.  If that goes through
+     * our interface, or is a local or broadcast route, scan the table
+     * for one that doesn't.  For 0.0.0.0 we want to know whether
+     * there is a default route.
+     */
+    if (nl_fd >= 0) {
+	switch (nl_route_lookup(addr != 0? addr: htonl(NL_DEFAULT_PROBE),
+				addr == 0, &rtm, &oif, &gw, &m)) {
+	case 0:
+	    return 0;
+	case 1:
+	    if (rtm.rtm_type == RTN_UNICAST && oif != nl_ifindex()
+		&& (addr != 0 || rtm.rtm_dst_len == 0))
+		return 1;
+	    break;
+	}
+    }
+#endif
 
     if (!open_route_table())
 	return -1;		/* don't know */
@@ -1651,6 +2584,20 @@ int sifdefaultroute (int unit, u_int32_t ouraddr, u_int32_t gateway)
 	return 0;
     }
 
+#ifdef USE_NETLINK
+    if (nl_fd >= 0) {
+	/* the ioctl takes the metric + 1, netlink the metric itself */
+	int err = nl_route_change(RTM_NEWROUTE, NLM_F_CREATE, 0, 0,
+				  dfl_route_metric < 0? 0: dfl_route_metric);
+	if (err == 0) {
+	    have_default_route = 1;
+	    return 1;
+	}
+	errno = -err;
+	dbglog("default route (RTM_NEWROUTE): %m, trying ioctl");
+    }
+#endif
+
     memset (&rt, 0, sizeof (rt));
     SET_SA_FAMILY (rt.rt_dst, AF_INET);
 
@@ -1684,6 +2631,17 @@ int cifdefaultroute (int unit, u_int32_t ouraddr, u_int32_t gateway)
 
     have_default_route = 0;
 
+#ifdef USE_NETLINK
+    if (nl_fd >= 0) {
+	int err = nl_route_change(RTM_DELROUTE, 0, 0, 0,
+				  dfl_route_metric < 0? 0: dfl_route_metric);
+	if (err == 0 || err == -ESRCH)
+	    return 1;
+	errno = -err;
+	dbglog("default route (RTM_DELROUTE): %m, trying ioctl");
+    }
+#endif
+
     memset (&rt, '\0', sizeof (rt));
     SET_SA_FAMILY (rt.rt_dst,     AF_INET);
     SET_SA_FAMILY (rt.rt_gateway, AF_INET);
@@ -1806,6 +2764,22 @@ static int get_ether_addr (u_int32_t ipaddr,
 
     u_int32_t bestmask=0;
     int found_interface = 0;
+#ifdef USE_NETLINK
+    struct if_entry *ife;
+
+    if (ifc_update()) {
+	ife = ifc_subnet_lookup(ipaddr);
+	if (ife == NULL)
+	    return 0;
+	strlcpy(name, ife->name, namelen);
+	info("found interface %s for proxy arp", name);
+	memset(hwaddr, 0, sizeof(*hwaddr));
+	hwaddr->sa_family = ife->type;
+	memcpy(hwaddr->sa_data, ife->hwaddr,
+	       MIN(ife->hwlen, sizeof(hwaddr->sa_data)));
+	return 1;
+    }
+#endif
 
     ifc.ifc_len = sizeof(ifs);
     ifc.ifc_req = ifs;
@@ -1889,6 +2863,17 @@ get_if_hwaddr(u_char *addr, char *name)
 {
 	struct ifreq ifreq;
 	int ret, sock_fd;
+#ifdef USE_NETLINK
+	struct if_entry *ife;
+
+	if (ifc_update()) {
+		ife = ifc_find_name(name);
+		if (ife == NULL || ife->hwlen < 6)
+			return -1;
+		memcpy(addr, ife->hwaddr, 6);
+		return 0;
+	}
+#endif
 
 	sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
 	if (sock_fd < 0)
@@ -1909,6 +2894,16 @@ get_if_hwaddr(u_char *addr, char *name)
 char *
 get_first_ethernet()
 {
+#ifdef USE_NETLINK
+	int i;
+
+	/* prefer eth0, as always, but find another if there's none */
+	if (ifc_update() && ifc_find_name("eth0") == NULL)
+		for (i = 0; i < ifc_nlinks; ++i)
+			if (ifc_links[i].type == ARPHRD_ETHER
+			    && (ifc_links[i].flags & IFF_LOOPBACK) == 0)
+				return ifc_links[i].name;
+#endif
 	return "eth0";
 }
 
@@ -1940,6 +2935,24 @@ u_int32_t GetMask (u_int32_t addr)
 
     /* class D nets are disallowed by bad_ip_adrs */
     mask = netmask | htonl(nmask);
+
+#ifdef USE_NETLINK
+    if (ifc_update()) {
+	struct if_entry *ife;
+	int i;
+
+	for (i = 0; i < ifc_naddrs; ++i) {
+	    if (((ntohl(ifc_addrs[i].local) ^ addr) & nmask) != 0)
+		continue;
+	    ife = ifc_find_link(ifc_addrs[i].index);
+	    if (ife == NULL || ((ife->flags ^ FLAGS_GOOD) & FLAGS_MASK) != 0)
+		continue;
+	    mask |= htonl(PREFIX_MASK(ifc_addrs[i].prefixlen));
+	    break;
+	}
+	return mask;
+    }
+#endif
 /*
  * Scan through the system's network interfaces.
  */
@@ -2180,82 +3193,369 @@ int ppp_available(void)
     return ok;
 }
 
+/********************************************************************
+ *
+ * lock_utmp_file - wait for an exclusive lock on a utmp/wtmp file,
+ * the same kind of lock the C library takes on them.
+ */
+
+static int lock_utmp_file (int fd, int type)
+{
+    struct flock lk;
+
+    memset(&lk, 0, sizeof(lk));
+    lk.l_type = type;
+    lk.l_whence = SEEK_SET;
+    while (fcntl(fd, F_SETLKW, &lk) < 0)
+	if (errno != EINTR)
+	    return -1;
+    return 0;
+}
+
 #ifndef HAVE_LOGWTMP
+/*
+ * An index of utmp, so that finding the entry for a pid, or the one
+ * pututline would reuse for a line, doesn't take a pass over the
+ * file.  The shared wtmp writer (see session.c) updates utmp for the
+ * logins and logouts of every pppd on the system, so without it each
+ * of those would read through utmp.  The index is only trusted while
+ * utmp is as we left it (same file, size and modification time), and
+ * each entry it finds is checked before being overwritten; otherwise
+ * it is built again, with one pass over the file.
+ */
+#define UTMP_HASH	256	/* # hash chains; a power of 2 */
+
+/* where pututline would put a new entry for a line with this id */
+#define UTMP_REUSABLE(t)	((t) == INIT_PROCESS || (t) == LOGIN_PROCESS \
+				 || (t) == USER_PROCESS || (t) == DEAD_PROCESS)
+
+struct utmp_ent {
+    int		pid;
+    int		type;
+    char	id[sizeof(((struct utmp *)0)->ut_id)];
+    int		next_pid;	/* next entry on the same pid chain */
+    int		next_id;	/* next entry on the same id chain */
+};
+
+static struct utmp_ent *utmp_ents;
+static int utmp_nents, utmp_maxents;
+static int utmp_pid_hash[UTMP_HASH];
+static int utmp_id_hash[UTMP_HASH];
+static struct stat utmp_stat;	/* utmp when the index was last right */
+static int utmp_indexed;
+
+#define UTMP_PID_KEY(pid)	((pid) & (UTMP_HASH - 1))
+
+static int utmp_id_key (const char *id)
+{
+    unsigned int h = 0;
+    int i;
+
+    for (i = 0; i < sizeof(utmp_ents->id) && id[i] != 0; ++i)
+	h = h * 31 + (unsigned char) id[i];
+    return h & (UTMP_HASH - 1);
+}
+
+/*
+ * utmp_index_set - record that entry i of utmp is now *ut.
+ * i may be one past the end, for an entry being appended.
+ */
+static int utmp_index_set (int i, struct utmp *ut)
+{
+    struct utmp_ent *e;
+    int *p, n;
+
+    if (i == utmp_nents) {
+	if (utmp_nents == utmp_maxents) {
+	    n = utmp_maxents? utmp_maxents * 2: 64;
+	    e = realloc(utmp_ents, n * sizeof(*e));
+	    if (e == NULL)
+		return -1;
+	    utmp_ents = e;
+	    utmp_maxents = n;
+	}
+	++utmp_nents;
+    } else {
+	/* take it off the chains it is on now */
+	for (p = &utmp_pid_hash[UTMP_PID_KEY(utmp_ents[i].pid)]; *p >= 0;
+	     p = &utmp_ents[*p].next_pid)
+	    if (*p == i) {
+		*p = utmp_ents[i].next_pid;
+		break;
+	    }
+	for (p = &utmp_id_hash[utmp_id_key(utmp_ents[i].id)]; *p >= 0;
+	     p = &utmp_ents[*p].next_id)
+	    if (*p == i) {
+		*p = utmp_ents[i].next_id;
+		break;
+	    }
+    }
+    e = &utmp_ents[i];
+    e->pid = ut->ut_pid;
+    e->type = ut->ut_type;
+    memcpy(e->id, ut->ut_id, sizeof(e->id));
+    e->next_pid = utmp_pid_hash[UTMP_PID_KEY(e->pid)];
+    utmp_pid_hash[UTMP_PID_KEY(e->pid)] = i;
+    e->next_id = utmp_id_hash[utmp_id_key(e->id)];
+    utmp_id_hash[utmp_id_key(e->id)] = i;
+    return 0;
+}
+
+/*
+ * utmp_index_stamp - note that the index matches utmp as it is now.
+ */
+static void utmp_index_stamp (int fd)
+{
+    utmp_indexed = fstat(fd, &utmp_stat) == 0;
+}
+
+static int utmp_index_current (int fd)
+{
+    struct stat sbuf;
+
+    return utmp_indexed && fstat(fd, &sbuf) == 0
+	&& sbuf.st_dev == utmp_stat.st_dev
+	&& sbuf.st_ino == utmp_stat.st_ino
+	&& sbuf.st_size == utmp_stat.st_size
+	&& sbuf.st_mtim.tv_sec == utmp_stat.st_mtim.tv_sec
+	&& sbuf.st_mtim.tv_nsec == utmp_stat.st_mtim.tv_nsec;
+}
+
+/*
+ * utmp_index_build - build the index from one pass over utmp.
+ */
+static int utmp_index_build (int fd)
+{
+    struct utmp buf[64];
+    off_t off = 0;
+    int i, n;
+
+    utmp_indexed = 0;
+    utmp_nents = 0;
+    for (i = 0; i < UTMP_HASH; ++i)
+	utmp_pid_hash[i] = utmp_id_hash[i] = -1;
+    while ((n = pread(fd, buf, sizeof(buf), off)) > 0) {
+	n /= sizeof(buf[0]);
+	if (n == 0)
+	    break;
+	for (i = 0; i < n; ++i)
+	    if (utmp_index_set(utmp_nents, &buf[i]) < 0)
+		return -1;
+	off += n * sizeof(buf[0]);
+    }
+    utmp_index_stamp(fd);
+    return 0;
+}
+
+/*
+ * utmp_index_find - find where the entry for pid goes: the first
+ * entry with that pid, or failing that, the first one pututline
+ * would reuse for a line with this id (*byid is set), or failing
+ * that, a new entry at the end.
+ */
+static int utmp_index_find (int pid, const char *id, int *byid)
+{
+    struct utmp_ent *e;
+    int i, pos = -1;
+
+    *byid = 0;
+    for (i = utmp_pid_hash[UTMP_PID_KEY(pid)]; i >= 0; i = e->next_pid) {
+	e = &utmp_ents[i];
+	if (e->pid == pid && (pos < 0 || i < pos))
+	    pos = i;
+    }
+    if (pos >= 0)
+	return pos;
+    for (i = utmp_id_hash[utmp_id_key(id)]; i >= 0; i = e->next_id) {
+	e = &utmp_ents[i];
+	if (strncmp(e->id, id, sizeof(e->id)) == 0 && UTMP_REUSABLE(e->type)
+	    && (pos < 0 || i < pos))
+	    pos = i;
+    }
+    if (pos >= 0) {
+	*byid = 1;
+	return pos;
+    }
+    return utmp_nents;
+}
+
 /********************************************************************
  *
- * Update the wtmp file with the appropriate user name and tty device.
+ * update_utmp - update the utmp entry for a login or logout and fill
+ * in *ut with what was written.  fd is utmp, open and locked, or -1
+ * if we couldn't open it, in which case we just fill in *ut for wtmp.
  */
 
-void logwtmp (const char *line, const char *name, const char *host)
+static void update_utmp (int fd, struct session_record *r, struct utmp *ut)
 {
-    struct utmp ut, *utp;
-    pid_t  mypid = getpid();
-#if __GLIBC__ < 2
-    int    wtmp;
-#endif
+    char id[sizeof(ut->ut_id)];
+    int pos, byid = 0, tries;
 
 /*
  * Update the signon database for users.
  * Christoph Lameter: Copied from poeigl-1.36 Jan 3, 1996
  */
-    utmpname(_PATH_UTMP);
-    setutent();
-    while ((utp = getutent()) && (utp->ut_pid != mypid))
-	/* nothing */;
-
-    if (utp)
-	memcpy(&ut, utp, sizeof(ut));
-    else
+    memset(ut, 0, sizeof(*ut));
+    strncpy(id, r->line + 3, sizeof(id));
+
+    pos = -1;
+    if (fd >= 0 && (utmp_index_current(fd) || utmp_index_build(fd) == 0)) {
+	for (tries = 0; ; ++tries) {
+	    pos = utmp_index_find(r->pid, id, &byid);
+	    if (pos == utmp_nents)
+		break;
+	    /* check the entry is still what the index says */
+	    if (pread(fd, ut, sizeof(*ut), (off_t) pos * sizeof(*ut))
+		    == sizeof(*ut)
+		&& (byid? strncmp(ut->ut_id, id, sizeof(id)) == 0
+		          && UTMP_REUSABLE(ut->ut_type)
+		        : ut->ut_pid == r->pid))
+		break;
+	    if (tries > 0 || utmp_index_build(fd) < 0) {
+		pos = -1;
+		break;
+	    }
+	}
 	/* some gettys/telnetds don't initialize utmp... */
-	memset(&ut, 0, sizeof(ut));
+	if (pos == utmp_nents || byid)
+	    memset(ut, 0, sizeof(*ut));
+    }
+    if (fd >= 0 && pos < 0)
+	warn("Couldn't update %s", _PATH_UTMP);
 
-    if (ut.ut_id[0] == 0)
-	strncpy(ut.ut_id, line + 3, sizeof(ut.ut_id));
+    if (ut->ut_id[0] == 0)
+	strncpy(ut->ut_id, id, sizeof(ut->ut_id));
 
-    strncpy(ut.ut_user, name, sizeof(ut.ut_user));
-    strncpy(ut.ut_line, line, sizeof(ut.ut_line));
+    strncpy(ut->ut_user, r->name, sizeof(ut->ut_user));
+    strncpy(ut->ut_line, r->line, sizeof(ut->ut_line));
 
-    time(&ut.ut_time);
+    ut->ut_time = r->when;
 
-    ut.ut_type = USER_PROCESS;
-    ut.ut_pid  = mypid;
+    ut->ut_type = USER_PROCESS;
+    ut->ut_pid  = r->pid;
 
     /* Insert the host name if one is supplied */
-    if (*host)
-	strncpy (ut.ut_host, host, sizeof(ut.ut_host));
+    if (r->host[0])
+	strncpy (ut->ut_host, r->host, sizeof(ut->ut_host));
 
     /* Insert the IP address of the remote system if IP is enabled */
-    if (ipcp_protent.enabled_flag && ipcp_hisoptions[0].neg_addr)
-	memcpy(&ut.ut_addr, (char *) &ipcp_hisoptions[0].hisaddr,
-		 sizeof(ut.ut_addr));
+    if (r->addr)
+	memcpy(&ut->ut_addr, &r->addr, sizeof(ut->ut_addr));
 
     /* CL: Makes sure that the logout works */
-    if (*host == 0 && *name==0)
-	ut.ut_host[0]=0;
+    if (r->host[0] == 0 && r->name[0] == 0)
+	ut->ut_host[0]=0;
+
+    if (pos < 0)
+	return;
+    if (pwrite(fd, ut, sizeof(*ut), (off_t) pos * sizeof(*ut))
+	    != sizeof(*ut)) {
+	warn("error writing %s: %m", _PATH_UTMP);
+	utmp_indexed = 0;
+    } else if (utmp_index_set(pos, ut) < 0)
+	utmp_indexed = 0;
+    else
+	utmp_index_stamp(fd);
+}
 
-    pututline(&ut);
-    endutent();
 /*
- * Update the wtmp file.
+ * open_utmp - open and lock utmp for a batch of updates.
  */
-#if __GLIBC__ >= 2
-    updwtmp(_PATH_WTMP, &ut);
-#else
-    wtmp = open(_PATH_WTMP, O_APPEND|O_WRONLY);
-    if (wtmp >= 0) {
-	flock(wtmp, LOCK_EX);
+static int open_utmp (void)
+{
+    int fd;
+
+    fd = open(_PATH_UTMP, O_RDWR);
+    if (fd < 0) {
+	if (!ok_error(errno))
+	    warn("Couldn't open %s: %m", _PATH_UTMP);
+	return -1;
+    }
+    if (lock_utmp_file(fd, F_WRLCK) < 0) {
+	warn("Couldn't lock %s: %m", _PATH_UTMP);
+	close(fd);
+	return -1;
+    }
+    return fd;
+}
 
-	if (write (wtmp, (char *)&ut, sizeof(ut)) != sizeof(ut))
-	    warn("error writing %s: %m", _PATH_WTMP);
+/********************************************************************
+ *
+ * Update the wtmp file with the appropriate user name and tty device.
+ */
 
-	flock(wtmp, LOCK_UN);
+void logwtmp (const char *line, const char *name, const char *host)
+{
+    struct session_record r;
 
-	close (wtmp);
-    }
-#endif
+    memset(&r, 0, sizeof(r));
+    r.pid = getpid();
+    time(&r.when);
+    if (ipcp_protent.enabled_flag && ipcp_hisoptions[0].neg_addr)
+	r.addr = ipcp_hisoptions[0].hisaddr;
+    r.uid = -1;
+    strlcpy(r.line, line, sizeof(r.line));
+    strlcpy(r.name, name, sizeof(r.name));
+    strlcpy(r.host, host, sizeof(r.host));
+    logwtmp_records(&r, 1);
 }
 #endif /* HAVE_LOGWTMP */
 
+/********************************************************************
+ *
+ * logwtmp_records - update utmp (unless the C library's logwtmp is
+ * being used, which doesn't) for each of a batch of logins and
+ * logouts, under one lock, then append them all to wtmp in one write.
+ */
+
+void logwtmp_records (struct session_record *recs, int n)
+{
+    struct utmp uts[32];
+    struct utmp *ut;
+    struct stat sbuf;
+    int i, fd;
+
+    while (n > 0) {
+#ifndef HAVE_LOGWTMP
+	fd = open_utmp();
+#endif
+	for (i = 0; i < n && i < 32; ++i) {
+	    ut = &uts[i];
+#ifndef HAVE_LOGWTMP
+	    update_utmp(fd, &recs[i], ut);
+#else
+	    /* just what the C library's logwtmp would write */
+	    memset(ut, 0, sizeof(*ut));
+	    ut->ut_type = recs[i].name[0]? USER_PROCESS: DEAD_PROCESS;
+	    ut->ut_pid = recs[i].pid;
+	    strncpy(ut->ut_line, recs[i].line, sizeof(ut->ut_line));
+	    strncpy(ut->ut_user, recs[i].name, sizeof(ut->ut_user));
+	    strncpy(ut->ut_host, recs[i].host, sizeof(ut->ut_host));
+	    ut->ut_tv.tv_sec = recs[i].when;
+#endif
+	}
+#ifndef HAVE_LOGWTMP
+	if (fd >= 0)
+	    close(fd);		/* releases the lock */
+#endif
+	recs += i;
+	n -= i;
+
+	fd = open(_PATH_WTMP, O_WRONLY|O_APPEND);
+	if (fd < 0)
+	    continue;
+	if (lock_utmp_file(fd, F_WRLCK) == 0 && fstat(fd, &sbuf) == 0) {
+	    if (write(fd, uts, i * sizeof(uts[0])) != i * sizeof(uts[0])) {
+		warn("error writing %s: %m", _PATH_WTMP);
+		/* don't leave a partial record behind */
+		if (ftruncate(fd, sbuf.st_size) < 0)
+		    warn("Couldn't truncate %s: %m", _PATH_WTMP);
+	    }
+	}
+	close(fd);
+    }
+}
+
 /********************************************************************
  *
  * sifvjcomp - config tcp header compression
@@ -2353,6 +3653,23 @@ int sif6down (int u)
 static int setifstate (int u, int state)
 {
     struct ifreq ifr;
+#ifdef USE_NETLINK
+    struct nl_batch b;
+    struct ifinfomsg ifi;
+
+    /* one request instead of reading and then writing the flags */
+    if (nl_fd >= 0 && (ifi.ifi_index = nl_ifindex()) != 0) {
+	ifi.ifi_family = AF_UNSPEC;
+	ifi.__ifi_pad = 0;
+	ifi.ifi_type = 0;
+	ifi.ifi_flags = state? IFF_UP: 0;
+	ifi.ifi_change = IFF_UP;
+	b.nmsgs = 0;
+	nl_add_msg(&b, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+	if (nl_transact(&b, NULL, NULL) == 0)
+	    return 1;
+    }
+#endif
 
     memset (&ifr, '\0', sizeof (ifr));
     strlcpy(ifr.ifr_name, ifname, sizeof (ifr.ifr_name));
@@ -2385,6 +3702,37 @@ int sifaddr (int unit, u_int32_t our_adr, u_int32_t his_adr,
 {
     struct ifreq   ifr;
     struct rtentry rt;
+#ifdef USE_NETLINK
+    struct nl_batch b;
+    struct nlmsghdr *n;
+    struct ifaddrmsg ifa;
+    int err;
+
+    /*
+     * Set the local and peer addresses with a /32 mask in one request
+     * rather than three ioctls.
+     */
+    if (nl_fd >= 0 && kernel_version >= KVERSION(2,1,16)
+	&& (ifa.ifa_index = nl_ifindex()) != 0) {
+	ifa.ifa_family = AF_INET;
+	ifa.ifa_prefixlen = 32;
+	ifa.ifa_flags = IFA_F_PERMANENT;
+	ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+	b.nmsgs = 0;
+	n = nl_add_msg(&b, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE,
+		       &ifa, sizeof(ifa));
+	nl_add_attr(&b, n, IFA_LOCAL, &our_adr, sizeof(our_adr));
+	if (his_adr != 0)
+	    nl_add_attr(&b, n, IFA_ADDRESS, &his_adr, sizeof(his_adr));
+	else
+	    nl_add_attr(&b, n, IFA_ADDRESS, &our_adr, sizeof(our_adr));
+	err = nl_transact(&b, NULL, NULL);
+	if (err == 0)
+	    goto addr_set;
+	errno = -err;
+	dbglog("RTM_NEWADDR: %m, trying ioctl");
+    }
+#endif
 
     memset (&ifr, '\0', sizeof (ifr));
     memset (&rt,  '\0', sizeof (rt));
@@ -2457,6 +3805,9 @@ int sifaddr (int unit, u_int32_t our_adr, u_int32_t his_adr,
 	}
     }
 
+#ifdef USE_NETLINK
+ addr_set:
+#endif
     /* set ip_dynaddr in demand mode if address changes */
     if (demand && tune_kernel && !dynaddr_set
 	&& our_old_addr && our_old_addr != our_adr) {
@@ -2486,6 +3837,26 @@ int sifaddr (int unit, u_int32_t our_adr, u_int32_t his_adr,
 int cifaddr (int unit, u_int32_t our_adr, u_int32_t his_adr)
 {
     struct ifreq ifr;
+#ifdef USE_NETLINK
+    struct nl_batch b;
+    struct nlmsghdr *n;
+    struct ifaddrmsg ifa;
+
+    if (nl_fd >= 0 && our_adr != 0 && kernel_version >= KVERSION(2,1,16)
+	&& (ifa.ifa_index = nl_ifindex()) != 0) {
+	ifa.ifa_family = AF_INET;
+	ifa.ifa_prefixlen = 32;
+	ifa.ifa_flags = 0;
+	ifa.ifa_scope = 0;
+	b.nmsgs = 0;
+	n = nl_add_msg(&b, RTM_DELADDR, 0, &ifa, sizeof(ifa));
+	nl_add_attr(&b, n, IFA_LOCAL, &our_adr, sizeof(our_adr));
+	if (nl_transact(&b, NULL, NULL) == 0) {
+	    our_old_addr = our_adr;
+	    return 1;
+	}
+    }
+#endif
 
     if (kernel_version < KVERSION(2,1,16)) {
 /*
@@ -2879,6 +4250,33 @@ get_host_seed()
     return h;
 }
 
+/********************************************************************
+ *
+ * get_time - get the current time for timeouts and connect-time
+ * accounting.  We use the monotonic clock where it is available so
+ * that changes to the system time don't upset our timers.
+ */
+
+int
+get_time(struct timeval *tv)
+{
+#ifdef CLOCK_MONOTONIC
+    static int monotonic = 1;
+    struct timespec ts;
+
+    if (monotonic) {
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+	    tv->tv_sec = ts.tv_sec;
+	    tv->tv_usec = ts.tv_nsec / 1000;
+	    return 0;
+	}
+	monotonic = 0;
+	warn("Couldn't use monotonic clock source: %m");
+    }
+#endif
+    return gettimeofday(tv, NULL);
+}
+
 /********************************************************************
  *
  * sys_check_options - check the options that the user specified
@@ -2913,6 +4311,12 @@ sys_check_options(void)
 	warn("Warning: multilink is not supported by the kernel driver");
 	multilink = 0;
     }
+    if (unit_pool_size > 0 && (!new_style_driver || req_unit >= 0)) {
+	warn("Warning: unit-pool can't be used %s",
+	     (new_style_driver? "with the unit option":
+	      "with this kernel driver"));
+	unit_pool_size = 0;
+    }
     return 1;
 }
 
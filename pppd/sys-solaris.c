@@ -133,6 +133,7 @@
 #include "lcp.h"
 #include "ipcp.h"
 #include "ccp.h"
+#include "session.h"
 
 #if !defined(PPP_DRV_NAME)
 #define PPP_DRV_NAME	"ppp"
@@ -2484,6 +2485,21 @@ logwtmp(line, name, host)
     updwtmpx("/var/adm/wtmpx", &utmpx);
 }
 
+/*
+ * logwtmp_records - write accounting records for a batch of logins
+ * and logouts.
+ */
+void
+logwtmp_records(recs, n)
+    struct session_record *recs;
+    int n;
+{
+    int i;
+
+    for (i = 0; i < n; ++i)
+	logwtmp(recs[i].line, recs[i].name, recs[i].host);
+}
+
 /*
  * get_host_seed - return the serial number of this machine.
  */
@@ -2499,6 +2515,17 @@ get_host_seed()
     return (int) strtoul(buf, NULL, 16);
 }
 
+/*
+ * get_time - get the current time for timeouts and connect-time
+ * accounting.
+ */
+int
+get_time(tv)
+    struct timeval *tv;
+{
+    return gettimeofday(tv, NULL);
+}
+
 static int
 strioctl(fd, cmd, ptr, ilen, olen)
     int fd, cmd, ilen, olen;
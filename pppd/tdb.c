@@ -46,11 +46,15 @@
  * right time.  Probably too hard -- the process just doesn't know.
  */ 
 
+#ifdef __linux__
+#define _GNU_SOURCE	/* for F_SETLEASE */
+#endif
 #include <stdlib.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/mman.h>
@@ -58,9 +62,11 @@
 #include <signal.h>
 #include "tdb.h"
 #include "spinlock.h"
+#include "mutex.h"
 
 #define TDB_MAGIC_FOOD "TDB file\n"
-#define TDB_VERSION (0x26011967 + 6)
+#define TDB_VERSION (0x26011967 + 7)
+#define TDB_VERSION_V6 (0x26011967 + 6) /* single, singly linked free list */
 #define TDB_MAGIC (0x26011999U)
 #define TDB_FREE_MAGIC (~TDB_MAGIC)
 #define TDB_DEAD_MAGIC (0xFEE1DEAD)
@@ -69,6 +75,10 @@
 #define DEFAULT_HASH_SIZE 131
 #define TDB_PAGE_SIZE 0x2000
 #define FREELIST_TOP (sizeof(struct tdb_header))
+#define FREELIST_HEAD(c) (offsetof(struct tdb_header, freelists) + (c)*sizeof(tdb_off))
+#define FREE_PREV(off) ((off) + offsetof(struct list_struct, key_len))
+#define ALLOC_SEARCH 8
+#define TDB_GROW_CHAIN 4
 #define TDB_ALIGN(x,a) (((x) + (a)-1) & ~((a)-1))
 #define TDB_BYTEREV(x) (((((x)&0xff)<<24)|((x)&0xFF00)<<8)|(((x)>>8)&0xFF00)|((x)>>24))
 #define TDB_DEAD(r) ((r)->magic == TDB_DEAD_MAGIC)
@@ -85,6 +95,7 @@
 /* lock offsets */
 #define GLOBAL_LOCK 0
 #define ACTIVE_LOCK 4
+#define TRAVERSE_LOCK 8
 
 #ifndef MAP_FILE
 #define MAP_FILE 0
@@ -102,6 +113,10 @@
 #define BUCKET(hash) ((hash) % tdb->header.hash_size)
 TDB_DATA tdb_null;
 
+static u32 xxh32_tdb_hash(TDB_DATA *key);
+static int free_classes(TDB_CONTEXT *tdb);
+static tdb_off freelist_head(TDB_CONTEXT *tdb, int c);
+
 /* all contexts, to ensure no double-opens (fcntl locks don't nest!) */
 static TDB_CONTEXT *tdbs = NULL;
 
@@ -266,6 +281,20 @@ static int tdb_lock(TDB_CONTEXT *tdb, int list, int ltype)
 	/* Since fcntl locks don't nest, we do a lock for the first one,
 	   and simply bump the count for future ones */
 	if (tdb->locked[list+1].count == 0) {
+#ifdef USE_TDB_MUTEX
+		if (tdb->mutexes) {
+			int r = tdb_mutex_lock(tdb, list, 0);
+
+			if (r < 0) {
+				TDB_LOG((tdb, 0, "tdb_lock mutex failed on list %d (%s)\n",
+					 list, strerror(errno)));
+				return -1;
+			}
+			if (r > 0)
+				TDB_LOG((tdb, 0, "tdb_lock: holder of list %d died\n",
+					 list));
+		} else
+#endif
 		if (!tdb->read_only && tdb->header.rwlocks) {
 			if (tdb_spinlock(tdb, list, ltype)) {
 				TDB_LOG((tdb, 0, "tdb_lock spinlock failed on list %d ltype=%d\n", 
@@ -283,6 +312,34 @@ static int tdb_lock(TDB_CONTEXT *tdb, int list, int ltype)
 	return 0;
 }
 
+/* write-lock a list if that can be done without waiting */
+static int tdb_trylock(TDB_CONTEXT *tdb, int list)
+{
+	if (tdb->flags & TDB_NOLOCK)
+		return 0;
+	if (tdb->locked[list+1].count == 0) {
+#ifdef USE_TDB_MUTEX
+		if (tdb->mutexes) {
+			int r = tdb_mutex_lock(tdb, list, 1);
+
+			if (r < 0)
+				return -1;
+			if (r > 0)
+				TDB_LOG((tdb, 0, "tdb_trylock: holder of list %d died\n",
+					 list));
+		} else
+#endif
+		if (!tdb->read_only && tdb->header.rwlocks)
+			return -1;	/* spinlocks can only be waited for */
+		else if (tdb_brlock(tdb, FREELIST_TOP+4*list, F_WRLCK, F_SETLK, 1))
+			return -1;
+		tdb->locked[list+1].ltype = F_WRLCK;
+	} else if (tdb->locked[list+1].ltype != F_WRLCK)
+		return -1;
+	tdb->locked[list+1].count++;
+	return 0;
+}
+
 /* unlock the database: returns void because it's too late for errors. */
 	/* changed to return int it may be interesting to know there
 	   has been an error  --simo */
@@ -306,6 +363,11 @@ static int tdb_unlock(TDB_CONTEXT *tdb, int list, int ltype)
 
 	if (tdb->locked[list+1].count == 1) {
 		/* Down to last nested lock: unlock underneath */
+#ifdef USE_TDB_MUTEX
+		if (tdb->mutexes)
+			ret = tdb_mutex_unlock(tdb, list);
+		else
+#endif
 		if (!tdb->read_only && tdb->header.rwlocks) {
 			ret = tdb_spinunlock(tdb, list, ltype);
 		} else {
@@ -499,6 +561,80 @@ static int update_tailer(TDB_CONTEXT *tdb, tdb_off offset,
 			 &totalsize);
 }
 
+/* The hash table starts with hash_size buckets after the header and
+   grows by linear hashing: buckets are split one at a time, in order,
+   into a new bucket in an array allocated from the data area, until
+   the table has doubled.  A chain is only ever split into the bucket
+   that is hash_size multiples away from it, so the chain lock for a
+   hash is always BUCKET(hash), however big the table gets. */
+
+/* number of buckets in use; the chain lock for the hash must be held
+   if the result is used to find its bucket */
+static u32 hash_buckets(TDB_CONTEXT *tdb)
+{
+	u32 n;
+
+	if (tdb_read(tdb, offsetof(struct tdb_header, hash_buckets), &n,
+		     sizeof(n), DOCONV()) == -1 || n == 0)
+		return tdb->header.hash_size;
+	return n;
+}
+
+/* bucket number for a hash when nbuckets buckets are in use */
+static u32 hash_bucket(TDB_CONTEXT *tdb, u32 hash, u32 nbuckets)
+{
+	u32 n = tdb->header.hash_size, b;
+
+	while (n * 2 <= nbuckets)
+		n *= 2;
+	b = hash % n;
+	if (b < nbuckets - n)
+		b = hash % (2 * n);
+	return b;
+}
+
+/* offset of the chain head for bucket b, or 0 on error */
+static tdb_off bucket_top(TDB_CONTEXT *tdb, u32 b)
+{
+	tdb_off seg;
+	int i;
+
+	if (b < tdb->header.hash_size)
+		return FREELIST_TOP + (b+1)*sizeof(tdb_off);
+	for (i = 1; (tdb->header.hash_size << i) <= b; i++)
+		;
+	if (i > TDB_HASH_SEGS
+	    || ofs_read(tdb, offsetof(struct tdb_header, hash_segs)
+			+ (i-1)*sizeof(tdb_off), &seg) == -1 || seg == 0) {
+		TDB_LOG((tdb, 0, "bucket_top: no bucket array for %u\n", b));
+		return TDB_ERRCODE(TDB_ERR_CORRUPT, 0);
+	}
+	return seg + (b - (tdb->header.hash_size << (i-1))) * sizeof(tdb_off);
+}
+
+/* offset of the chain head for a hash; needs the chain lock */
+static tdb_off hash_top(TDB_CONTEXT *tdb, u32 hash)
+{
+	return bucket_top(tdb, hash_bucket(tdb, hash, hash_buckets(tdb)));
+}
+
+/* Traversals hold a shared lock so that the table is not split
+   under them, which could show them a record twice. */
+static int traverse_start(TDB_CONTEXT *tdb)
+{
+	if (tdb->traversals == 0
+	    && tdb_brlock(tdb, TRAVERSE_LOCK, F_RDLCK, F_SETLKW, 0) == -1)
+		return -1;
+	tdb->traversals++;
+	return 0;
+}
+
+static void traverse_end(TDB_CONTEXT *tdb)
+{
+	if (tdb->traversals > 0 && --tdb->traversals == 0)
+		tdb_brlock(tdb, TRAVERSE_LOCK, F_UNLCK, F_SETLKW, 0);
+}
+
 static tdb_off tdb_dump_record(TDB_CONTEXT *tdb, tdb_off offset)
 {
 	struct list_struct rec;
@@ -525,74 +661,86 @@ static tdb_off tdb_dump_record(TDB_CONTEXT *tdb, tdb_off offset)
 	return rec.next;
 }
 
-static int tdb_dump_chain(TDB_CONTEXT *tdb, int i)
+static int tdb_dump_chain(TDB_CONTEXT *tdb, u32 i)
 {
 	tdb_off rec_ptr, top;
 
-	top = TDB_HASH_TOP(i);
-
-	if (tdb_lock(tdb, i, F_WRLCK) != 0)
+	if (tdb_lock(tdb, BUCKET(i), F_WRLCK) != 0)
 		return -1;
 
-	if (ofs_read(tdb, top, &rec_ptr) == -1)
-		return tdb_unlock(tdb, i, F_WRLCK);
+	if ((top = bucket_top(tdb, i)) == 0 || ofs_read(tdb, top, &rec_ptr) == -1)
+		return tdb_unlock(tdb, BUCKET(i), F_WRLCK);
 
 	if (rec_ptr)
-		printf("hash=%d\n", i);
+		printf("hash=%u\n", i);
 
 	while (rec_ptr) {
 		rec_ptr = tdb_dump_record(tdb, rec_ptr);
 	}
 
-	return tdb_unlock(tdb, i, F_WRLCK);
+	return tdb_unlock(tdb, BUCKET(i), F_WRLCK);
 }
 
 void tdb_dump_all(TDB_CONTEXT *tdb)
 {
+	u32 b;
 	int i;
-	for (i=0;i<tdb->header.hash_size;i++) {
-		tdb_dump_chain(tdb, i);
+
+	for (b = 0; b < hash_buckets(tdb); b++) {
+		tdb_dump_chain(tdb, b);
 	}
 	printf("freelist:\n");
-	tdb_dump_chain(tdb, -1);
+	if (tdb_lock(tdb, -1, F_WRLCK) != 0)
+		return;
+	for (i = 0; i < free_classes(tdb); i++) {
+		tdb_off rec_ptr;
+
+		if (ofs_read(tdb, freelist_head(tdb, i), &rec_ptr) == -1)
+			break;
+		if (rec_ptr)
+			printf("class=%d\n", i);
+		while (rec_ptr)
+			rec_ptr = tdb_dump_record(tdb, rec_ptr);
+	}
+	tdb_unlock(tdb, -1, F_WRLCK);
 }
 
 int tdb_printfreelist(TDB_CONTEXT *tdb)
 {
-	int ret;
+	int ret, i;
 	long total_free = 0;
-	tdb_off offset, rec_ptr;
+	tdb_off rec_ptr;
 	struct list_struct rec;
 
 	if ((ret = tdb_lock(tdb, -1, F_WRLCK)) != 0)
 		return ret;
 
-	offset = FREELIST_TOP;
-
-	/* read in the freelist top */
-	if (ofs_read(tdb, offset, &rec_ptr) == -1) {
-		tdb_unlock(tdb, -1, F_WRLCK);
-		return 0;
-	}
-
-	printf("freelist top=[0x%08x]\n", rec_ptr );
-	while (rec_ptr) {
-		if (tdb_read(tdb, rec_ptr, (char *)&rec, sizeof(rec), DOCONV()) == -1) {
+	for (i = 0; i < free_classes(tdb); i++) {
+		/* read in the freelist top */
+		if (ofs_read(tdb, freelist_head(tdb, i), &rec_ptr) == -1) {
 			tdb_unlock(tdb, -1, F_WRLCK);
-			return -1;
+			return 0;
 		}
 
-		if (rec.magic != TDB_FREE_MAGIC) {
-			printf("bad magic 0x%08x in free list\n", rec.magic);
-			tdb_unlock(tdb, -1, F_WRLCK);
-			return -1;
-		}
+		printf("freelist class %d top=[0x%08x]\n", i, rec_ptr );
+		while (rec_ptr) {
+			if (tdb_read(tdb, rec_ptr, (char *)&rec, sizeof(rec), DOCONV()) == -1) {
+				tdb_unlock(tdb, -1, F_WRLCK);
+				return -1;
+			}
 
-		printf("entry offset=[0x%08x], rec.rec_len = [0x%08x (%d)]\n", rec.next, rec.rec_len, rec.rec_len );
-		total_free += rec.rec_len;
+			if (rec.magic != TDB_FREE_MAGIC) {
+				printf("bad magic 0x%08x in free list\n", rec.magic);
+				tdb_unlock(tdb, -1, F_WRLCK);
+				return -1;
+			}
 
-		/* move to the next record */
-		rec_ptr = rec.next;
+			printf("entry offset=[0x%08x], rec.rec_len = [0x%08x (%d)]\n", rec.next, rec.rec_len, rec.rec_len );
+			total_free += rec.rec_len;
+
+			/* move to the next record */
+			rec_ptr = rec.next;
+		}
 	}
 	printf("total rec_len = [0x%08x (%d)]\n", (int)total_free, 
                (int)total_free);
@@ -600,23 +748,147 @@ int tdb_printfreelist(TDB_CONTEXT *tdb)
 	return tdb_unlock(tdb, -1, F_WRLCK);
 }
 
-/* Remove an element from the freelist.  Must have alloc lock. */
-static int remove_from_freelist(TDB_CONTEXT *tdb, tdb_off off, tdb_off next)
+/* Free space is kept on TDB_FREE_CLASSES lists, list i holding
+   records with rec_len < 64 << i (the last one takes the rest).
+   The lists are doubly linked: in a free record the key_len field
+   holds the offset of the word that points at it, which is either a
+   list head in the header or the next field of the previous record.
+
+   A version 6 database has a single free list at FREELIST_TOP, linked
+   one way only, and code that knows nothing else may have it open.
+   Unless it can be upgraded (see tdb_upgrade_freelists), we use that
+   list just as that code does. */
+static int free_classes(TDB_CONTEXT *tdb)
 {
-	tdb_off last_ptr, i;
+	return tdb->header.version == TDB_VERSION_V6 ? 1 : TDB_FREE_CLASSES;
+}
 
-	/* read in the freelist top */
-	last_ptr = FREELIST_TOP;
-	while (ofs_read(tdb, last_ptr, &i) != -1 && i != 0) {
-		if (i == off) {
-			/* We've found it! */
-			return ofs_write(tdb, last_ptr, &next);
-		}
-		/* Follow chain (next offset is at start of record) */
-		last_ptr = i;
+static tdb_off freelist_head(TDB_CONTEXT *tdb, int c)
+{
+	return tdb->header.version == TDB_VERSION_V6 ? FREELIST_TOP
+		: FREELIST_HEAD(c);
+}
+
+static int free_class(TDB_CONTEXT *tdb, tdb_len len)
+{
+	int i;
+
+	for (i = 0; i < free_classes(tdb) - 1; i++)
+		if (len < (64U << i))
+			break;
+	return i;
+}
+
+/* Put a record at the head of its free list.  Must have alloc lock. */
+static int freelist_push(TDB_CONTEXT *tdb, tdb_off off, struct list_struct *rec)
+{
+	tdb_off head = freelist_head(tdb, free_class(tdb, rec->rec_len));
+
+	rec->magic = TDB_FREE_MAGIC;
+	if (tdb->header.version != TDB_VERSION_V6)
+		rec->key_len = head;
+	if (ofs_read(tdb, head, &rec->next) == -1 ||
+	    rec_write(tdb, off, rec) == -1)
+		return -1;
+	if (tdb->header.version != TDB_VERSION_V6 && rec->next
+	    && ofs_write(tdb, FREE_PREV(rec->next), &off) == -1)
+		return -1;
+	return ofs_write(tdb, head, &off);
+}
+
+/* Remove an element from its free list.  Must have alloc lock. */
+static int freelist_remove(TDB_CONTEXT *tdb, tdb_off off, struct list_struct *rec)
+{
+	tdb_off prev = rec->key_len, i;
+
+	if (tdb->header.version == TDB_VERSION_V6) {
+		/* no back pointers: find whatever points at it */
+		for (prev = FREELIST_TOP; ofs_read(tdb, prev, &i) != -1 && i;
+		     prev = i)
+			if (i == off)
+				return ofs_write(tdb, prev, &rec->next);
+		TDB_LOG((tdb, 0,"freelist_remove: not on list at off=%d\n", off));
+		return TDB_ERRCODE(TDB_ERR_CORRUPT, -1);
+	}
+
+	if (prev < FREELIST_HEAD(0) || ofs_read(tdb, prev, &i) == -1
+	    || i != off) {
+		TDB_LOG((tdb, 0,"freelist_remove: not on list at off=%d\n", off));
+		return TDB_ERRCODE(TDB_ERR_CORRUPT, -1);
 	}
-	TDB_LOG((tdb, 0,"remove_from_freelist: not on list at off=%d\n", off));
-	return TDB_ERRCODE(TDB_ERR_CORRUPT, -1);
+	if (ofs_write(tdb, prev, &rec->next) == -1)
+		return -1;
+	if (rec->next && ofs_write(tdb, FREE_PREV(rec->next), &prev) == -1)
+		return -1;
+	return 0;
+}
+
+/* Move the free records of a version 6 database, which had a single
+   free list at FREELIST_TOP, onto the size-class lists.  Code that
+   knows only version 6 would go on using the single list, so this is
+   only done while no other process has the file open: only then can
+   we get a write lease on it, and anyone who opens it meanwhile waits
+   until we give the lease up.  Otherwise, or where there are no
+   leases, the database stays at version 6. */
+static int tdb_upgrade_freelists(TDB_CONTEXT *tdb)
+{
+#ifdef F_SETLEASE
+	tdb_off rec_ptr, zero = 0;
+	u32 version = TDB_VERSION;
+	struct list_struct rec;
+	struct sigaction sa, osa;
+	int ret = -1;
+
+	/* an open elsewhere signals us to give the lease up, which we
+	   do once we are finished anyway */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGIO, &sa, &osa);
+	if (fcntl(tdb->fd, F_SETLEASE, F_WRLCK) == -1) {
+		sigaction(SIGIO, &osa, NULL);
+		return 0;
+	}
+	if (tdb_lock(tdb, -1, F_WRLCK) == -1)
+		goto out;
+
+	/* someone else may have got here first */
+	if (tdb_read(tdb, offsetof(struct tdb_header, version), &version,
+		     sizeof(version), DOCONV()) == -1)
+		goto fail;
+	if (version != TDB_VERSION_V6)
+		goto done;
+
+	/* from here on freelist_push uses the size-class lists; if we
+	   fail, tdb_open_ex fails too */
+	tdb->header.version = TDB_VERSION;
+	if (ofs_read(tdb, FREELIST_TOP, &rec_ptr) == -1)
+		goto fail;
+	while (rec_ptr) {
+		if (rec_free_read(tdb, rec_ptr, &rec) == -1)
+			goto fail;
+		if (ofs_write(tdb, FREELIST_TOP, &rec.next) == -1 ||
+		    freelist_push(tdb, rec_ptr, &rec) == -1)
+			goto fail;
+		if (ofs_read(tdb, FREELIST_TOP, &rec_ptr) == -1)
+			goto fail;
+	}
+	if (ofs_write(tdb, FREELIST_TOP, &zero) == -1)
+		goto fail;
+	version = TDB_VERSION;
+	if (ofs_write(tdb, offsetof(struct tdb_header, version), &version) == -1)
+		goto fail;
+ done:
+	tdb->header.version = TDB_VERSION;
+	ret = 0;
+ fail:
+	tdb_unlock(tdb, -1, F_WRLCK);
+ out:
+	fcntl(tdb->fd, F_SETLEASE, F_UNLCK);
+	sigaction(SIGIO, &osa, NULL);
+	return ret;
+#else
+	return 0;
+#endif
 }
 
 /* Add an element into the freelist. Merge adjacent records if
@@ -647,7 +919,7 @@ static int tdb_free(TDB_CONTEXT *tdb, tdb_off offset, struct list_struct *rec)
 
 		/* If it's free, expand to include it. */
 		if (r.magic == TDB_FREE_MAGIC) {
-			if (remove_from_freelist(tdb, right, r.next) == -1) {
+			if (freelist_remove(tdb, right, &r) == -1) {
 				TDB_LOG((tdb, 0, "tdb_free: right free failed at %u\n", right));
 				goto left;
 			}
@@ -677,7 +949,7 @@ left:
 
 		/* If it's free, expand to include it. */
 		if (l.magic == TDB_FREE_MAGIC) {
-			if (remove_from_freelist(tdb, left, l.next) == -1) {
+			if (freelist_remove(tdb, left, &l) == -1) {
 				TDB_LOG((tdb, 0, "tdb_free: left free failed at %u\n", left));
 				goto update;
 			} else {
@@ -693,12 +965,8 @@ update:
 		goto fail;
 	}
 
-	/* Now, prepend to free list */
-	rec->magic = TDB_FREE_MAGIC;
-
-	if (ofs_read(tdb, FREELIST_TOP, &rec->next) == -1 ||
-	    rec_write(tdb, offset, rec) == -1 ||
-	    ofs_write(tdb, FREELIST_TOP, &offset) == -1) {
+	/* Now, prepend to the free list for its size */
+	if (freelist_push(tdb, offset, rec) == -1) {
 		TDB_LOG((tdb, 0, "tdb_free record write failed at offset=%d\n", offset));
 		goto fail;
 	}
@@ -834,12 +1102,16 @@ static int tdb_expand(TDB_CONTEXT *tdb, tdb_off size)
    least length bytes of total data
 
    0 is returned if the space could not be allocated
+
+   Only the first ALLOC_SEARCH records of the list for the requested
+   size are looked at; any record on a higher list is big enough.
  */
 static tdb_off tdb_allocate(TDB_CONTEXT *tdb, tdb_len length,
 			    struct list_struct *rec)
 {
-	tdb_off rec_ptr, last_ptr, newrec_ptr;
+	tdb_off rec_ptr, newrec_ptr;
 	struct list_struct newrec;
+	int c, n;
 
 	memset(&newrec, '\0', sizeof(newrec));
 
@@ -850,64 +1122,65 @@ static tdb_off tdb_allocate(TDB_CONTEXT *tdb, tdb_len length,
 	length += sizeof(tdb_off);
 
  again:
-	last_ptr = FREELIST_TOP;
-
-	/* read in the freelist top */
-	if (ofs_read(tdb, FREELIST_TOP, &rec_ptr) == -1)
-		goto fail;
-
-	/* keep looking until we find a freelist record big enough */
-	while (rec_ptr) {
-		if (rec_free_read(tdb, rec_ptr, rec) == -1)
+	for (c = free_class(tdb, length); c < free_classes(tdb); c++) {
+		/* read in the freelist top */
+		if (ofs_read(tdb, freelist_head(tdb, c), &rec_ptr) == -1)
 			goto fail;
 
-		if (rec->rec_len >= length) {
-			/* found it - now possibly split it up  */
-			if (rec->rec_len > length + MIN_REC_SIZE) {
-				/* Length of left piece */
-				length = TDB_ALIGN(length, TDB_ALIGNMENT);
-
-				/* Right piece to go on free list */
-				newrec.rec_len = rec->rec_len
-					- (sizeof(*rec) + length);
-				newrec_ptr = rec_ptr + sizeof(*rec) + length;
-
-				/* And left record is shortened */
-				rec->rec_len = length;
-			} else
-				newrec_ptr = 0;
-
-			/* Remove allocated record from the free list */
-			if (ofs_write(tdb, last_ptr, &rec->next) == -1)
-				goto fail;
-
-			/* Update header: do this before we drop alloc
-                           lock, otherwise tdb_free() might try to
-                           merge with us, thinking we're free.
-                           (Thanks Jeremy Allison). */
-			rec->magic = TDB_MAGIC;
-			if (rec_write(tdb, rec_ptr, rec) == -1)
+		/* look for a freelist record big enough */
+		for (n = 0; rec_ptr; n++) {
+			if (n == ALLOC_SEARCH && c < free_classes(tdb) - 1)
+				break;
+			if (rec_free_read(tdb, rec_ptr, rec) == -1)
 				goto fail;
 
-			/* Did we create new block? */
-			if (newrec_ptr) {
-				/* Update allocated record tailer (we
-                                   shortened it). */
-				if (update_tailer(tdb, rec_ptr, rec) == -1)
+			if (rec->rec_len >= length) {
+				/* Remove allocated record from the free list */
+				if (freelist_remove(tdb, rec_ptr, rec) == -1)
 					goto fail;
 
-				/* Free new record */
-				if (tdb_free(tdb, newrec_ptr, &newrec) == -1)
+				/* found it - now possibly split it up  */
+				if (rec->rec_len > length + MIN_REC_SIZE) {
+					/* Length of left piece */
+					length = TDB_ALIGN(length, TDB_ALIGNMENT);
+
+					/* Right piece to go on free list */
+					newrec.rec_len = rec->rec_len
+						- (sizeof(*rec) + length);
+					newrec_ptr = rec_ptr + sizeof(*rec) + length;
+
+					/* And left record is shortened */
+					rec->rec_len = length;
+				} else
+					newrec_ptr = 0;
+
+				/* Update header: do this before we drop alloc
+				   lock, otherwise tdb_free() might try to
+				   merge with us, thinking we're free.
+				   (Thanks Jeremy Allison). */
+				rec->magic = TDB_MAGIC;
+				if (rec_write(tdb, rec_ptr, rec) == -1)
 					goto fail;
-			}
 
-			/* all done - return the new record offset */
-			tdb_unlock(tdb, -1, F_WRLCK);
-			return rec_ptr;
+				/* Did we create new block? */
+				if (newrec_ptr) {
+					/* Update allocated record tailer (we
+					   shortened it). */
+					if (update_tailer(tdb, rec_ptr, rec) == -1)
+						goto fail;
+
+					/* Free new record */
+					if (tdb_free(tdb, newrec_ptr, &newrec) == -1)
+						goto fail;
+				}
+
+				/* all done - return the new record offset */
+				tdb_unlock(tdb, -1, F_WRLCK);
+				return rec_ptr;
+			}
+			/* move to the next record */
+			rec_ptr = rec->next;
 		}
-		/* move to the next record */
-		last_ptr = rec_ptr;
-		rec_ptr = rec->next;
 	}
 	/* we didn't find enough space. See if we can expand the
 	   database and if we can then try again */
@@ -923,6 +1196,11 @@ static int tdb_new_database(TDB_CONTEXT *tdb, int hash_size)
 {
 	struct tdb_header *newdb;
 	int size, ret = -1;
+#ifdef USE_TDB_MUTEX
+	struct list_struct *mrec = NULL;
+	tdb_off moff = 0;
+	tdb_len mlen = 0;
+#endif
 
 	/* We make it up in memory, then write it out if not internal */
 	size = sizeof(struct tdb_header) + (hash_size+1)*sizeof(tdb_off);
@@ -932,6 +1210,29 @@ static int tdb_new_database(TDB_CONTEXT *tdb, int hash_size)
 	/* Fill in the header */
 	newdb->version = TDB_VERSION;
 	newdb->hash_size = hash_size;
+	if (tdb->hash_fn == xxh32_tdb_hash)
+		newdb->hash_flags = TDB_HASH_XXH32;
+#ifdef USE_TDB_MUTEX
+	/* The mutexes go in an allocated record after the hash table,
+	   so that the free space code never looks inside them. */
+	if ((tdb->flags & TDB_MUTEX_LOCKING)
+	    && !(tdb->flags & (TDB_INTERNAL | TDB_NOLOCK | TDB_CONVERT))) {
+		moff = size + TDB_SPINLOCK_SIZE(hash_size);
+		mlen = TDB_ALIGN(tdb_mutex_size(hash_size) + sizeof(tdb_off),
+				 TDB_ALIGNMENT);
+		if (!(mrec = calloc(sizeof(*mrec) + mlen, 1))) {
+			SAFE_FREE(newdb);
+			return TDB_ERRCODE(TDB_ERR_OOM, -1);
+		}
+		mrec->rec_len = mlen;
+		mrec->data_len = mlen - sizeof(tdb_off);
+		mrec->magic = TDB_MAGIC;
+		*(tdb_off *)((char *)(mrec + 1) + mlen - sizeof(tdb_off))
+			= sizeof(*mrec) + mlen;
+		newdb->lock_type = TDB_LOCK_MUTEX;
+		newdb->mutexes = tdb_mutex_offset(moff + sizeof(*mrec));
+	}
+#endif
 	if (tdb->flags & TDB_INTERNAL) {
 		tdb->map_size = size;
 		tdb->map_ptr = (char *)newdb;
@@ -955,9 +1256,24 @@ static int tdb_new_database(TDB_CONTEXT *tdb, int hash_size)
 		ret = -1;
 	else
 		ret = tdb_create_rwlocks(tdb->fd, hash_size);
+#ifdef USE_TDB_MUTEX
+	if (ret == 0 && mrec) {
+		if (write(tdb->fd, mrec, sizeof(*mrec) + mlen)
+		    != sizeof(*mrec) + mlen
+		    || tdb_mutex_open(tdb) != 0 || tdb_mutex_init(tdb) != 0) {
+			TDB_LOG((tdb, 0, "tdb_new_database: "
+				 "failed to set up mutexes (%s)\n",
+				 strerror(errno)));
+			ret = -1;
+		}
+	}
+#endif
 
   fail:
 	SAFE_FREE(newdb);
+#ifdef USE_TDB_MUTEX
+	SAFE_FREE(mrec);
+#endif
 	return ret;
 }
 
@@ -966,16 +1282,19 @@ static int tdb_new_database(TDB_CONTEXT *tdb, int hash_size)
 static tdb_off tdb_find(TDB_CONTEXT *tdb, TDB_DATA key, u32 hash,
 			struct list_struct *r)
 {
-	tdb_off rec_ptr;
+	tdb_off rec_ptr, top;
+	u32 len = 0;
 	
 	/* read in the hash top */
-	if (ofs_read(tdb, TDB_HASH_TOP(hash), &rec_ptr) == -1)
+	tdb->chain_len = 0;
+	if ((top = hash_top(tdb, hash)) == 0 || ofs_read(tdb, top, &rec_ptr) == -1)
 		return 0;
 
 	/* keep looking until we find the right record */
 	while (rec_ptr) {
 		if (rec_read(tdb, rec_ptr, r) == -1)
 			return 0;
+		len++;
 
 		if (!TDB_DEAD(r) && hash==r->full_hash && key.dsize==r->key_len) {
 			char *k;
@@ -993,6 +1312,7 @@ static tdb_off tdb_find(TDB_CONTEXT *tdb, TDB_DATA key, u32 hash,
 		}
 		rec_ptr = r->next;
 	}
+	tdb->chain_len = len;
 	return TDB_ERRCODE(TDB_ERR_NOEXIST, 0);
 }
 
@@ -1165,7 +1485,7 @@ static int unlock_record(TDB_CONTEXT *tdb, tdb_off off)
 /* actually delete an entry in the database given the offset */
 static int do_delete(TDB_CONTEXT *tdb, tdb_off rec_ptr, struct list_struct*rec)
 {
-	tdb_off last_ptr, i;
+	tdb_off last_ptr, i, top;
 	struct list_struct lastrec;
 
 	if (tdb->read_only) return -1;
@@ -1179,7 +1499,8 @@ static int do_delete(TDB_CONTEXT *tdb, tdb_off rec_ptr, struct list_struct*rec)
 		return -1;
 
 	/* find previous record in hash chain */
-	if (ofs_read(tdb, TDB_HASH_TOP(rec->full_hash), &i) == -1)
+	if ((top = hash_top(tdb, rec->full_hash)) == 0
+	    || ofs_read(tdb, top, &i) == -1)
 		return -1;
 	for (last_ptr = 0; i != rec_ptr; last_ptr = i, i = lastrec.next)
 		if (rec_read(tdb, i, &lastrec) == -1)
@@ -1187,7 +1508,7 @@ static int do_delete(TDB_CONTEXT *tdb, tdb_off rec_ptr, struct list_struct*rec)
 
 	/* unlink it: next ptr is at start of record. */
 	if (last_ptr == 0)
-		last_ptr = TDB_HASH_TOP(rec->full_hash);
+		last_ptr = top;
 	if (ofs_write(tdb, last_ptr, &rec->next) == -1)
 		return -1;
 
@@ -1202,16 +1523,17 @@ static int tdb_next_lock(TDB_CONTEXT *tdb, struct tdb_traverse_lock *tlock,
 			 struct list_struct *rec)
 {
 	int want_next = (tlock->off != 0);
+	tdb_off top;
 
 	/* Lock each chain from the start one. */
-	for (; tlock->hash < tdb->header.hash_size; tlock->hash++) {
-		if (tdb_lock(tdb, tlock->hash, F_WRLCK) == -1)
+	for (; tlock->hash < hash_buckets(tdb); tlock->hash++) {
+		if (tdb_lock(tdb, BUCKET(tlock->hash), F_WRLCK) == -1)
 			return -1;
 
 		/* No previous record?  Start at top of chain. */
 		if (!tlock->off) {
-			if (ofs_read(tdb, TDB_HASH_TOP(tlock->hash),
-				     &tlock->off) == -1)
+			if ((top = bucket_top(tdb, tlock->hash)) == 0
+			    || ofs_read(tdb, top, &tlock->off) == -1)
 				goto fail;
 		} else {
 			/* Otherwise unlock the previous record. */
@@ -1244,7 +1566,7 @@ static int tdb_next_lock(TDB_CONTEXT *tdb, struct tdb_traverse_lock *tlock,
 			    do_delete(tdb, current, rec) != 0)
 				goto fail;
 		}
-		tdb_unlock(tdb, tlock->hash, F_WRLCK);
+		tdb_unlock(tdb, BUCKET(tlock->hash), F_WRLCK);
 		want_next = 0;
 	}
 	/* We finished iteration without finding anything */
@@ -1252,7 +1574,7 @@ static int tdb_next_lock(TDB_CONTEXT *tdb, struct tdb_traverse_lock *tlock,
 
  fail:
 	tlock->off = 0;
-	if (tdb_unlock(tdb, tlock->hash, F_WRLCK) != 0)
+	if (tdb_unlock(tdb, BUCKET(tlock->hash), F_WRLCK) != 0)
 		TDB_LOG((tdb, 0, "tdb_next_lock: On error unlock failed!\n"));
 	return -1;
 }
@@ -1274,6 +1596,9 @@ int tdb_traverse(TDB_CONTEXT *tdb, tdb_traverse_func fn, void *private)
 	 */
 	tl.next = tdb->travlocks.next;
 
+	if (traverse_start(tdb) == -1)
+		return -1;
+
 	/* fcntl locks don't stack: beware traverse inside traverse */
 	tdb->travlocks.next = &tl;
 
@@ -1285,7 +1610,7 @@ int tdb_traverse(TDB_CONTEXT *tdb, tdb_traverse_func fn, void *private)
 					  rec.key_len + rec.data_len);
 		if (!key.dptr) {
 			ret = -1;
-			if (tdb_unlock(tdb, tl.hash, F_WRLCK) != 0)
+			if (tdb_unlock(tdb, BUCKET(tl.hash), F_WRLCK) != 0)
 				goto out;
 			if (unlock_record(tdb, tl.off) != 0)
 				TDB_LOG((tdb, 0, "tdb_traverse: key.dptr == NULL and unlock_record failed!\n"));
@@ -1296,7 +1621,7 @@ int tdb_traverse(TDB_CONTEXT *tdb, tdb_traverse_func fn, void *private)
 		dbuf.dsize = rec.data_len;
 
 		/* Drop chain lock, call out */
-		if (tdb_unlock(tdb, tl.hash, F_WRLCK) != 0) {
+		if (tdb_unlock(tdb, BUCKET(tl.hash), F_WRLCK) != 0) {
 			ret = -1;
 			goto out;
 		}
@@ -1308,6 +1633,7 @@ int tdb_traverse(TDB_CONTEXT *tdb, tdb_traverse_func fn, void *private)
 				ret = -1;
 			}
 			tdb->travlocks.next = tl.next;
+			traverse_end(tdb);
 			SAFE_FREE(key.dptr);
 			return count;
 		}
@@ -1315,6 +1641,7 @@ int tdb_traverse(TDB_CONTEXT *tdb, tdb_traverse_func fn, void *private)
 	}
 out:
 	tdb->travlocks.next = tl.next;
+	traverse_end(tdb);
 	if (ret < 0)
 		return -1;
 	else
@@ -1332,8 +1659,18 @@ TDB_DATA tdb_firstkey(TDB_CONTEXT *tdb)
 		return tdb_null;
 	tdb->travlocks.off = tdb->travlocks.hash = 0;
 
-	if (tdb_next_lock(tdb, &tdb->travlocks, &rec) <= 0)
+	/* the key traversal lasts until tdb_nextkey runs out */
+	if (!tdb->key_traverse) {
+		if (traverse_start(tdb) == -1)
+			return tdb_null;
+		tdb->key_traverse = 1;
+	}
+
+	if (tdb_next_lock(tdb, &tdb->travlocks, &rec) <= 0) {
+		tdb->key_traverse = 0;
+		traverse_end(tdb);
 		return tdb_null;
+	}
 	/* now read the key */
 	key.dsize = rec.key_len;
 	key.dptr =tdb_alloc_read(tdb,tdb->travlocks.off+sizeof(rec),key.dsize);
@@ -1352,7 +1689,7 @@ TDB_DATA tdb_nextkey(TDB_CONTEXT *tdb, TDB_DATA oldkey)
 
 	/* Is locked key the old key?  If so, traverse will be reliable. */
 	if (tdb->travlocks.off) {
-		if (tdb_lock(tdb,tdb->travlocks.hash,F_WRLCK))
+		if (tdb_lock(tdb,BUCKET(tdb->travlocks.hash),F_WRLCK))
 			return tdb_null;
 		if (rec_read(tdb, tdb->travlocks.off, &rec) == -1
 		    || !(k = tdb_alloc_read(tdb,tdb->travlocks.off+sizeof(rec),
@@ -1361,7 +1698,7 @@ TDB_DATA tdb_nextkey(TDB_CONTEXT *tdb, TDB_DATA oldkey)
 			/* No, it wasn't: unlock it and start from scratch */
 			if (unlock_record(tdb, tdb->travlocks.off) != 0)
 				return tdb_null;
-			if (tdb_unlock(tdb, tdb->travlocks.hash, F_WRLCK) != 0)
+			if (tdb_unlock(tdb, BUCKET(tdb->travlocks.hash), F_WRLCK) != 0)
 				return tdb_null;
 			tdb->travlocks.off = 0;
 		}
@@ -1374,7 +1711,8 @@ TDB_DATA tdb_nextkey(TDB_CONTEXT *tdb, TDB_DATA oldkey)
 		tdb->travlocks.off = tdb_find_lock_hash(tdb, oldkey, tdb->hash_fn(&oldkey), F_WRLCK, &rec);
 		if (!tdb->travlocks.off)
 			return tdb_null;
-		tdb->travlocks.hash = BUCKET(rec.full_hash);
+		tdb->travlocks.hash = hash_bucket(tdb, rec.full_hash,
+						  hash_buckets(tdb));
 		if (lock_record(tdb, tdb->travlocks.off) != 0) {
 			TDB_LOG((tdb, 0, "tdb_nextkey: lock_record failed (%s)!\n", strerror(errno)));
 			return tdb_null;
@@ -1389,8 +1727,11 @@ TDB_DATA tdb_nextkey(TDB_CONTEXT *tdb, TDB_DATA oldkey)
 		key.dptr = tdb_alloc_read(tdb, tdb->travlocks.off+sizeof(rec),
 					  key.dsize);
 		/* Unlock the chain of this new record */
-		if (tdb_unlock(tdb, tdb->travlocks.hash, F_WRLCK) != 0)
+		if (tdb_unlock(tdb, BUCKET(tdb->travlocks.hash), F_WRLCK) != 0)
 			TDB_LOG((tdb, 0, "tdb_nextkey: WARNING tdb_unlock failed!\n"));
+	} else if (tdb->key_traverse) {
+		tdb->key_traverse = 0;
+		traverse_end(tdb);
 	}
 	/* Unlock the chain of old record */
 	if (tdb_unlock(tdb, BUCKET(oldhash), F_WRLCK) != 0)
@@ -1419,6 +1760,109 @@ int tdb_delete(TDB_CONTEXT *tdb, TDB_DATA key)
 	return tdb_delete_hash(tdb, key, hash);
 }
 
+/* make the bucket array that buckets [n, 2n) live in */
+static tdb_off new_bucket_array(TDB_CONTEXT *tdb, u32 n, int seg)
+{
+	struct list_struct rec;
+	tdb_off off, ofs, zero[256];
+	tdb_len len = n * sizeof(tdb_off), l;
+
+	if (!(off = tdb_allocate(tdb, len, &rec)))
+		return 0;
+	rec.key_len = 0;
+	rec.data_len = len;
+	rec.full_hash = 0;
+	rec.next = 0;
+	memset(zero, 0, sizeof(zero));
+	if (rec_write(tdb, off, &rec) == -1)
+		return 0;
+	for (ofs = 0; ofs < len; ofs += l) {
+		l = len - ofs > sizeof(zero) ? sizeof(zero) : len - ofs;
+		if (tdb_write(tdb, off + sizeof(rec) + ofs, zero, l) == -1)
+			return 0;
+	}
+	off += sizeof(rec);
+	if (ofs_write(tdb, offsetof(struct tdb_header, hash_segs)
+		      + seg*sizeof(tdb_off), &off) == -1)
+		return 0;
+	return off;
+}
+
+/* Split the next bucket in line, moving the records that now hash to
+   the new bucket onto its chain.  Nothing is done if some process is
+   traversing the database or if someone else is already splitting,
+   or in a version 6 database, which code that doesn't know about
+   split buckets may have open. */
+static void tdb_grow_hash(TDB_CONTEXT *tdb)
+{
+	u32 nbuckets, n, b, lock;
+	tdb_off last_ptr, rec_ptr, new_ptr, top;
+	struct list_struct rec;
+	int seg;
+
+	if (tdb->read_only || tdb->traversals > 0
+	    || tdb->header.version == TDB_VERSION_V6)
+		return;
+	nbuckets = hash_buckets(tdb);
+	for (n = tdb->header.hash_size, seg = 0; n * 2 <= nbuckets; n *= 2)
+		seg++;
+	if (seg >= TDB_HASH_SEGS)
+		return;
+	b = nbuckets - n;
+	lock = BUCKET(b);
+
+	/* don't wait for the chain: we may already hold other chains */
+	if (tdb_trylock(tdb, lock) == -1)
+		return;
+	if (tdb_brlock(tdb, TRAVERSE_LOCK, F_WRLCK, F_SETLK, 1) == -1) {
+		tdb_unlock(tdb, lock, F_WRLCK);
+		return;
+	}
+	if (tdb_lock(tdb, -1, F_WRLCK) == -1)
+		goto out;
+	if (hash_buckets(tdb) != nbuckets)
+		goto out_alloc;		/* lost the race */
+
+	if (ofs_read(tdb, offsetof(struct tdb_header, hash_segs)
+		     + seg*sizeof(tdb_off), &top) == -1)
+		goto out_alloc;
+	if (top == 0 && !new_bucket_array(tdb, n, seg))
+		goto out_alloc;
+	if ((top = bucket_top(tdb, b)) == 0
+	    || (new_ptr = bucket_top(tdb, b + n)) == 0)
+		goto out_alloc;
+
+	/* move records that belong in b + n, keeping their order */
+	last_ptr = top;
+	if (ofs_read(tdb, top, &rec_ptr) == -1)
+		goto out_alloc;
+	while (rec_ptr) {
+		if (rec_read(tdb, rec_ptr, &rec) == -1)
+			goto out_alloc;
+		if (rec.full_hash % (2 * n) == b) {
+			last_ptr = rec_ptr;
+		} else {
+			tdb_off zero = 0;
+
+			if (ofs_write(tdb, last_ptr, &rec.next) == -1
+			    || ofs_write(tdb, rec_ptr, &zero) == -1
+			    || ofs_write(tdb, new_ptr, &rec_ptr) == -1)
+				goto out_alloc;
+			new_ptr = rec_ptr;
+		}
+		rec_ptr = rec.next;
+	}
+
+	nbuckets++;
+	ofs_write(tdb, offsetof(struct tdb_header, hash_buckets), &nbuckets);
+
+ out_alloc:
+	tdb_unlock(tdb, -1, F_WRLCK);
+ out:
+	tdb_brlock(tdb, TRAVERSE_LOCK, F_UNLCK, F_SETLK, 0);
+	tdb_unlock(tdb, lock, F_WRLCK);
+}
+
 /* store an element in the database, replacing any existing element
    with the same key 
 
@@ -1427,8 +1871,8 @@ int tdb_delete(TDB_CONTEXT *tdb, TDB_DATA key)
 int tdb_store(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA dbuf, int flag)
 {
 	struct list_struct rec;
-	u32 hash;
-	tdb_off rec_ptr;
+	u32 hash, chain_len;
+	tdb_off rec_ptr, top;
 	char *p = NULL;
 	int ret = 0;
 
@@ -1456,6 +1900,7 @@ int tdb_store(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA dbuf, int flag)
 	}
 	/* reset the error code potentially set by the tdb_update() */
 	tdb->ecode = TDB_SUCCESS;
+	chain_len = tdb->chain_len;
 
 	/* delete any existing record - if it doesn't exist we don't
            care.  Doing this first reduces fragmentation, and avoids
@@ -1480,7 +1925,8 @@ int tdb_store(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA dbuf, int flag)
 		goto fail;
 
 	/* Read hash top into next ptr */
-	if (ofs_read(tdb, TDB_HASH_TOP(hash), &rec.next) == -1)
+	if ((top = hash_top(tdb, hash)) == 0
+	    || ofs_read(tdb, top, &rec.next) == -1)
 		goto fail;
 
 	rec.key_len = key.dsize;
@@ -1491,10 +1937,17 @@ int tdb_store(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA dbuf, int flag)
 	/* write out and point the top of the hash chain at it */
 	if (rec_write(tdb, rec_ptr, &rec) == -1
 	    || tdb_write(tdb, rec_ptr+sizeof(rec), p, key.dsize+dbuf.dsize)==-1
-	    || ofs_write(tdb, TDB_HASH_TOP(hash), &rec_ptr) == -1) {
+	    || ofs_write(tdb, top, &rec_ptr) == -1) {
 		/* Need to tdb_unallocate() here */
 		goto fail;
 	}
+	SAFE_FREE(p);
+	tdb_unlock(tdb, BUCKET(hash), F_WRLCK);
+
+	/* a new key that had to pass a long chain: split a bucket */
+	if (chain_len >= TDB_GROW_CHAIN)
+		tdb_grow_hash(tdb);
+	return 0;
  out:
 	SAFE_FREE(p); 
 	tdb_unlock(tdb, BUCKET(hash), F_WRLCK);
@@ -1547,6 +2000,7 @@ int tdb_append(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA new_dbuf)
 	char *p = NULL;
 	int ret = 0;
 	size_t new_data_size = 0;
+	tdb_off top;
 
 	/* find which hash bucket it is in */
 	hash = tdb->hash_fn(&key);
@@ -1603,7 +2057,8 @@ int tdb_append(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA new_dbuf)
 		goto fail;
 
 	/* Read hash top into next ptr */
-	if (ofs_read(tdb, TDB_HASH_TOP(hash), &rec.next) == -1)
+	if ((top = hash_top(tdb, hash)) == 0
+	    || ofs_read(tdb, top, &rec.next) == -1)
 		goto fail;
 
 	rec.key_len = key.dsize;
@@ -1614,7 +2069,7 @@ int tdb_append(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA new_dbuf)
 	/* write out and point the top of the hash chain at it */
 	if (rec_write(tdb, rec_ptr, &rec) == -1
 	    || tdb_write(tdb, rec_ptr+sizeof(rec), p, key.dsize+new_data_size)==-1
-	    || ofs_write(tdb, TDB_HASH_TOP(hash), &rec_ptr) == -1) {
+	    || ofs_write(tdb, top, &rec_ptr) == -1) {
 		/* Need to tdb_unallocate() here */
 		goto fail;
 	}
@@ -1656,6 +2111,54 @@ static u32 default_tdb_hash(TDB_DATA *key)
 	return (1103515243 * value + 12345);  
 }
 
+/* xxh32 (seed 0) by Yann Collet, used for new databases */
+#define XXH_PRIME1 2654435761U
+#define XXH_PRIME2 2246822519U
+#define XXH_PRIME3 3266489917U
+#define XXH_PRIME4 668265263U
+#define XXH_PRIME5 374761393U
+#define XXH_ROTL(x,r) (((x) << (r)) | ((x) >> (32 - (r))))
+#define XXH_GET32(p) ((u32)(p)[0] | ((u32)(p)[1] << 8) | \
+		      ((u32)(p)[2] << 16) | ((u32)(p)[3] << 24))
+#define XXH_ROUND(v,p) ((v) = XXH_ROTL((v) + XXH_GET32(p) * XXH_PRIME2, 13) \
+			* XXH_PRIME1)
+
+static u32 xxh32_tdb_hash(TDB_DATA *key)
+{
+	const unsigned char *p = (const unsigned char *)key->dptr;
+	const unsigned char *end = p + key->dsize;
+	u32 h;
+
+	if (key->dsize >= 16) {
+		u32 v1 = XXH_PRIME1 + XXH_PRIME2, v2 = XXH_PRIME2;
+		u32 v3 = 0, v4 = -XXH_PRIME1;
+
+		do {
+			XXH_ROUND(v1, p);
+			XXH_ROUND(v2, p + 4);
+			XXH_ROUND(v3, p + 8);
+			XXH_ROUND(v4, p + 12);
+			p += 16;
+		} while (p + 16 <= end);
+		h = XXH_ROTL(v1, 1) + XXH_ROTL(v2, 7) + XXH_ROTL(v3, 12)
+			+ XXH_ROTL(v4, 18);
+	} else
+		h = XXH_PRIME5;
+	h += (u32) key->dsize;
+
+	for (; p + 4 <= end; p += 4)
+		h = XXH_ROTL(h + XXH_GET32(p) * XXH_PRIME3, 17) * XXH_PRIME4;
+	for (; p < end; p++)
+		h = XXH_ROTL(h + *p * XXH_PRIME5, 11) * XXH_PRIME1;
+
+	h ^= h >> 15;
+	h *= XXH_PRIME2;
+	h ^= h >> 13;
+	h *= XXH_PRIME3;
+	h ^= h >> 16;
+	return h;
+}
+
 /* open the database, creating it if necessary 
 
    The open_flags and mode are passed straight to the open call on the
@@ -1695,7 +2198,7 @@ TDB_CONTEXT *tdb_open_ex(const char *name, int hash_size, int tdb_flags,
 	tdb->flags = tdb_flags;
 	tdb->open_flags = open_flags;
 	tdb->log_fn = log_fn;
-	tdb->hash_fn = hash_fn ? hash_fn : default_tdb_hash;
+	tdb->hash_fn = hash_fn ? hash_fn : xxh32_tdb_hash;
 
 	if ((open_flags & O_ACCMODE) == O_WRONLY) {
 		TDB_LOG((tdb, 0, "tdb_open_ex: can't open tdb %s write-only\n",
@@ -1752,7 +2255,9 @@ TDB_CONTEXT *tdb_open_ex(const char *name, int hash_size, int tdb_flags,
 	if (read(tdb->fd, &tdb->header, sizeof(tdb->header)) != sizeof(tdb->header)
 	    || strcmp(tdb->header.magic_food, TDB_MAGIC_FOOD) != 0
 	    || (tdb->header.version != TDB_VERSION
-		&& !(rev = (tdb->header.version==TDB_BYTEREV(TDB_VERSION))))) {
+		&& tdb->header.version != TDB_VERSION_V6
+		&& !(rev = (tdb->header.version==TDB_BYTEREV(TDB_VERSION)
+			    || tdb->header.version==TDB_BYTEREV(TDB_VERSION_V6))))) {
 		/* its not a valid database - possibly initialise it */
 		if (!(open_flags & O_CREAT) || tdb_new_database(tdb, hash_size) == -1) {
 			errno = EIO; /* ie bad format or something */
@@ -1763,13 +2268,30 @@ TDB_CONTEXT *tdb_open_ex(const char *name, int hash_size, int tdb_flags,
 	vp = (unsigned char *)&tdb->header.version;
 	vertest = (((u32)vp[0]) << 24) | (((u32)vp[1]) << 16) |
 		  (((u32)vp[2]) << 8) | (u32)vp[3];
-	tdb->flags |= (vertest==TDB_VERSION) ? TDB_BIGENDIAN : 0;
+	tdb->flags |= (vertest==TDB_VERSION || vertest==TDB_VERSION_V6)
+		? TDB_BIGENDIAN : 0;
 	if (!rev)
 		tdb->flags &= ~TDB_CONVERT;
 	else {
 		tdb->flags |= TDB_CONVERT;
 		convert(&tdb->header, sizeof(tdb->header));
 	}
+	/* databases made before xxh32 keep the old hash */
+	if (!hash_fn && !(tdb->header.hash_flags & TDB_HASH_XXH32))
+		tdb->hash_fn = default_tdb_hash;
+	/* everyone must lock the way the database was made to */
+	if (tdb->header.lock_type > TDB_LOCK_MUTEX
+	    || (tdb->header.lock_type == TDB_LOCK_MUTEX
+		&& !(tdb->flags & TDB_NOLOCK)
+#ifdef USE_TDB_MUTEX
+		&& ((tdb->flags & TDB_CONVERT) || tdb_mutex_open(tdb) != 0)
+#endif
+		)) {
+		TDB_LOG((tdb, 0, "tdb_open_ex: can't use lock type %u in %s\n",
+			 tdb->header.lock_type, name));
+		errno = EINVAL;
+		goto fail;
+	}
 	if (fstat(tdb->fd, &st) == -1)
 		goto fail;
 
@@ -1825,6 +2347,34 @@ TDB_CONTEXT *tdb_open_ex(const char *name, int hash_size, int tdb_flags,
 			goto fail;
 	}
 
+#ifdef USE_TDB_MUTEX
+	/* Mutexes in the file outlive the processes that used them (a
+	   crash, or a /var/run that isn't cleared at boot), and may be
+	   left looking held or in a state no new process can recover.
+	   Everyone using them holds ACTIVE_LOCK shared, so if we can get
+	   it exclusively, nobody else has the database open and we set
+	   the mutexes up afresh. */
+	if (tdb->mutexes && !(tdb_flags & TDB_CLEAR_IF_FIRST)) {
+		if (tdb_brlock(tdb, ACTIVE_LOCK, F_WRLCK, F_SETLK, 1) == 0
+		    && (tdb_mutex_init(tdb) != 0
+			|| tdb_brlock(tdb, ACTIVE_LOCK, F_UNLCK, F_SETLK, 0) == -1)) {
+			TDB_LOG((tdb, 0, "tdb_open_ex: "
+				 "failed to reset mutexes in %s\n", name));
+			goto fail;
+		}
+		if (tdb_brlock(tdb, ACTIVE_LOCK, F_RDLCK, F_SETLKW, 0) == -1)
+			goto fail;
+	}
+#endif
+
+	/* databases written by older code have a single free list */
+	if (tdb->header.version == TDB_VERSION_V6 && !tdb->read_only
+	    && tdb_upgrade_freelists(tdb) != 0) {
+		TDB_LOG((tdb, 0, "tdb_open_ex: "
+			 "failed to upgrade free lists in %s\n", name));
+		goto fail;
+	}
+
 
  internal:
 	/* Internal (memory-only) databases skip all the code above to
@@ -1848,6 +2398,9 @@ TDB_CONTEXT *tdb_open_ex(const char *name, int hash_size, int tdb_flags,
 		else
 			tdb_munmap(tdb);
 	}
+#ifdef USE_TDB_MUTEX
+	tdb_mutex_close(tdb);
+#endif
 	SAFE_FREE(tdb->name);
 	if (tdb->fd != -1)
 		if (close(tdb->fd) != 0)
@@ -1875,6 +2428,9 @@ int tdb_close(TDB_CONTEXT *tdb)
 		else
 			tdb_munmap(tdb);
 	}
+#ifdef USE_TDB_MUTEX
+	tdb_mutex_close(tdb);
+#endif
 	SAFE_FREE(tdb->name);
 	if (tdb->fd != -1)
 		ret = close(tdb->fd);
@@ -1958,6 +2514,7 @@ void tdb_logging_function(TDB_CONTEXT *tdb, void (*fn)(TDB_CONTEXT *, int , cons
 int tdb_reopen(TDB_CONTEXT *tdb)
 {
 	struct stat st;
+	int fd;
 
 	if (tdb->flags & TDB_INTERNAL)
 		return 0; /* Nothing to do. */
@@ -1965,13 +2522,16 @@ int tdb_reopen(TDB_CONTEXT *tdb)
 		TDB_LOG((tdb, 0, "tdb_reopen: munmap failed (%s)\n", strerror(errno)));
 		goto fail;
 	}
-	if (close(tdb->fd) != 0)
-		TDB_LOG((tdb, 0, "tdb_reopen: WARNING closing tdb->fd failed!\n"));
-	tdb->fd = open(tdb->name, tdb->open_flags & ~(O_CREAT|O_TRUNC), 0);
-	if (tdb->fd == -1) {
+	/* open before closing, so that the file is never without us
+	   having it open (see tdb_upgrade_freelists) */
+	fd = open(tdb->name, tdb->open_flags & ~(O_CREAT|O_TRUNC), 0);
+	if (fd == -1) {
 		TDB_LOG((tdb, 0, "tdb_reopen: open failed (%s)\n", strerror(errno)));
 		goto fail;
 	}
+	if (close(tdb->fd) != 0)
+		TDB_LOG((tdb, 0, "tdb_reopen: WARNING closing tdb->fd failed!\n"));
+	tdb->fd = fd;
 	if (fstat(tdb->fd, &st) != 0) {
 		TDB_LOG((tdb, 0, "tdb_reopen: fstat failed (%s)\n", strerror(errno)));
 		goto fail;
@@ -1981,7 +2541,8 @@ int tdb_reopen(TDB_CONTEXT *tdb)
 		goto fail;
 	}
 	tdb_mmap(tdb);
-	if ((tdb->flags & TDB_CLEAR_IF_FIRST) && (tdb_brlock(tdb, ACTIVE_LOCK, F_RDLCK, F_SETLKW, 0) == -1)) {
+	if (((tdb->flags & TDB_CLEAR_IF_FIRST) || tdb->mutexes)
+	    && (tdb_brlock(tdb, ACTIVE_LOCK, F_RDLCK, F_SETLKW, 0) == -1)) {
 		TDB_LOG((tdb, 0, "tdb_reopen: failed to obtain active lock\n"));
 		goto fail;
 	}
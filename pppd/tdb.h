@@ -56,6 +56,7 @@ extern "C" {
 #define TDB_NOMMAP   8 /* don't use mmap */
 #define TDB_CONVERT 16 /* convert endian (internal use) */
 #define TDB_BIGENDIAN 32 /* header is big-endian (internal use) */
+#define TDB_MUTEX_LOCKING 64 /* chain locks are robust mutexes, if new */
 
 #define TDB_ERRCODE(code, ret) ((tdb->ecode = (code)), ret)
 
@@ -76,13 +77,33 @@ typedef struct {
 typedef u32 tdb_len;
 typedef u32 tdb_off;
 
+/* number of size-class free lists */
+#define TDB_FREE_CLASSES 12
+
+/* number of extra bucket arrays the hash table can grow into; each
+   one doubles the number of buckets */
+#define TDB_HASH_SEGS 12
+
+/* flags in tdb_header.hash_flags */
+#define TDB_HASH_XXH32 1 /* keys are hashed with xxh32 */
+
+/* values of tdb_header.lock_type */
+#define TDB_LOCK_FCNTL 0 /* chain locks are fcntl byte-range locks */
+#define TDB_LOCK_MUTEX 1 /* chain locks are mutexes in the file */
+
 /* this is stored at the front of every database */
 struct tdb_header {
 	char magic_food[32]; /* for /etc/magic */
 	u32 version; /* version of the code */
 	u32 hash_size; /* number of hash entries */
 	tdb_off rwlocks;
-	tdb_off reserved[31];
+	tdb_off freelists[TDB_FREE_CLASSES]; /* heads of the free lists */
+	u32 hash_flags; /* which hash function the keys use */
+	u32 hash_buckets; /* buckets in use, 0 meaning hash_size */
+	tdb_off hash_segs[TDB_HASH_SEGS]; /* bucket arrays past hash_size */
+	u32 lock_type; /* how the chains are locked */
+	tdb_off mutexes; /* offset of the chain mutexes */
+	tdb_off reserved[27 - TDB_FREE_CLASSES - TDB_HASH_SEGS];
 };
 
 struct tdb_lock_type {
@@ -114,6 +135,12 @@ typedef struct tdb_context {
 	void (*log_fn)(struct tdb_context *tdb, int level, const char *, ...) PRINTF_ATTRIBUTE(3,4); /* logging function */
 	u32 (*hash_fn)(TDB_DATA *key);
 	int open_flags; /* flags used in the open - needed by reopen */
+	int traversals; /* traversals in progress in this process */
+	int key_traverse; /* tdb_firstkey traversal in progress */
+	u32 chain_len; /* records passed by the last failed tdb_find */
+	void *mutex_map; /* mapping of the chain mutexes */
+	size_t mutex_map_size;
+	void *mutexes; /* the chain mutexes within mutex_map */
 } TDB_CONTEXT;
 
 typedef int (*tdb_traverse_func)(TDB_CONTEXT *, TDB_DATA, TDB_DATA, void *);
@@ -0,0 +1,229 @@
+/*
+ * desbench - time the DES in pppcrypt.c against the setkey()/encrypt()
+ * of crypt(3) that it replaced, for one MS-CHAP ChallengeResponse
+ * (three keys, one block each) and for setting a key and encrypting
+ * a block alone.
+ *
+ * Usage: desbench [-n responses]
+ *
+ * Current libcrypt keeps setkey and encrypt only for old binaries, so
+ * they are looked up at run time; if they can't be found only the
+ * new DES is timed.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <sys/types.h>
+#include "pppd.h"
+#include "pppcrypt.h"
+
+#define ROUNDS	5
+
+static int nresp = 200000;
+
+static void (*crypt_setkey)(const char *);
+static void (*crypt_encrypt)(char *, int);
+
+static u_char hash[21] = {		/* an NT hash, padded to 21 */
+    0x44, 0xeb, 0xba, 0x8d, 0x53, 0x12, 0xb8, 0xd6,
+    0x11, 0x47, 0x44, 0x11, 0xf5, 0x69, 0x89, 0xae
+};
+static u_char challenge[8] = {
+    0xd0, 0x2e, 0x43, 0x86, 0xbc, 0xe9, 0x12, 0x26
+};
+static u_char result[2][24];
+
+/*
+ * The crypt(3) path as pppcrypt.c had it, with each key and block
+ * expanded to one bit per byte.
+ */
+static u_char
+Get7Bits(u_char *input, int startBit)
+{
+    unsigned int word;
+
+    word  = (unsigned)input[startBit / 8] << 8;
+    word |= (unsigned)input[startBit / 8 + 1];
+    word >>= 15 - (startBit % 8 + 7);
+    return word & 0xFE;
+}
+
+static void
+Expand(u_char *in, u_char *out)
+{
+    int i, j;
+
+    for (i = 0; i < 8; ++i)
+	for (j = 7; j >= 0; j--)
+	    *out++ = (in[i] >> j) & 01;
+}
+
+static void
+Collapse(u_char *in, u_char *out)
+{
+    int i, j;
+    unsigned int c;
+
+    for (i = 0; i < 8; ++i) {
+	c = 0;
+	for (j = 7; j >= 0; j--)
+	    c |= *in++ << j;
+	*out++ = c;
+    }
+}
+
+static void
+old_setkey(u_char *key)
+{
+    u_char des_key[8], crypt_key[66];
+    int i;
+
+    for (i = 0; i < 8; ++i)
+	des_key[i] = Get7Bits(key, 7 * i);
+    Expand(des_key, crypt_key);
+    (*crypt_setkey)((const char *) crypt_key);
+}
+
+static void
+old_encrypt(u_char *clear, u_char *cipher)
+{
+    u_char des_input[66];
+
+    Expand(clear, des_input);
+    (*crypt_encrypt)((char *) des_input, 0);
+    Collapse(des_input, cipher);
+}
+
+static void
+old_response(int i)
+{
+    int k;
+
+    hash[0] = i;
+    for (k = 0; k < 3; ++k) {
+	old_setkey(hash + 7 * k);
+	old_encrypt(challenge, result[0] + 8 * k);
+    }
+}
+
+static void
+old_key(int i)
+{
+    hash[0] = i;
+    old_setkey(hash);
+}
+
+static void
+old_block(int i)
+{
+    old_encrypt(challenge, result[0]);
+}
+
+static DesKeySchedule ks;
+
+static void
+new_response(int i)
+{
+    int k;
+
+    hash[0] = i;
+    for (k = 0; k < 3; ++k) {
+	DesSetkey(hash + 7 * k, &ks);
+	DesEncrypt(challenge, &ks, result[1] + 8 * k);
+    }
+}
+
+static void
+new_key(int i)
+{
+    hash[0] = i;
+    DesSetkey(hash, &ks);
+}
+
+static void
+new_block(int i)
+{
+    DesEncrypt(challenge, &ks, result[1]);
+}
+
+static struct {
+    char *name;
+    void (*op)(int);
+    int old;
+} methods[] = {
+    { "crypt(3) ChallengeResponse",	old_response,	1 },
+    { "DES ChallengeResponse",		new_response,	0 },
+    { "crypt(3) setkey",		old_key,	1 },
+    { "DesSetkey",			new_key,	0 },
+    { "crypt(3) encrypt",		old_block,	1 },
+    { "DesEncrypt",			new_block,	0 },
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int ac, char **av)
+{
+    void *h;
+    double t, best;
+    int c, i, m, r;
+
+    while ((c = getopt(ac, av, "n:")) != -1) {
+	if (c != 'n') {
+	    fprintf(stderr, "Usage: %s [-n responses]\n", av[0]);
+	    exit(2);
+	}
+	nresp = atoi(optarg);
+    }
+
+    h = dlopen("libcrypt.so.1", RTLD_NOW);
+    if (h != NULL) {
+	crypt_setkey = dlsym(h, "setkey");
+	crypt_encrypt = dlsym(h, "encrypt");
+#ifdef __GLIBC__
+	if (crypt_setkey == NULL || crypt_encrypt == NULL) {
+	    crypt_setkey = dlvsym(h, "setkey", "GLIBC_2.2.5");
+	    crypt_encrypt = dlvsym(h, "encrypt", "GLIBC_2.2.5");
+	}
+#endif
+    }
+    if (crypt_setkey == NULL || crypt_encrypt == NULL)
+	printf("setkey/encrypt not found in libcrypt; timing DES only\n");
+
+    /* the best of a few rounds, to see past other load */
+    for (m = 0; m < sizeof(methods) / sizeof(methods[0]); ++m) {
+	if (methods[m].old && crypt_encrypt == NULL)
+	    continue;
+	best = 0;
+	for (r = 0; r < ROUNDS; ++r) {
+	    t = now();
+	    for (i = 0; i < nresp; ++i)
+		(*methods[m].op)(i);
+	    t = now() - t;
+	    if (r == 0 || t < best)
+		best = t;
+	}
+	printf("%-28s %8.3f us\n", methods[m].name, best * 1e6 / nresp);
+    }
+
+    if (crypt_encrypt != NULL) {
+	old_response(0);
+	new_response(0);
+	if (memcmp(result[0], result[1], sizeof(result[0])) != 0) {
+	    printf("DES and crypt(3) give different responses\n");
+	    return 1;
+	}
+    }
+    return 0;
+}
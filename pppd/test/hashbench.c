@@ -0,0 +1,161 @@
+/*
+ * hashbench - time the hashing (and DES) that each authentication
+ * method does for one login, as the authenticator.
+ *
+ * Usage: hashbench [-n logins]
+ *
+ * Linked with the rest of pppd, so that MS-CHAP goes through the
+ * same ChapMS/ChapMS2 code (including MPPE key derivation, where
+ * that is built in) as a real login does.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include "pppd.h"
+#include "md5.h"
+#include "md4.h"
+#include "chap_ms.h"
+
+#define ROUNDS	5
+
+static int nlogins = 20000;
+
+static u_char challenge[16] = "0123456789abcdef";
+static u_char peer_challenge[16] = "fedcba9876543210";
+static char secret[] = "clientPass";
+static char username[] = "User";
+/* the NT hash of "clientPass", stored in place of the password */
+static char nt_secret[] = "$NT$44ebba8d5312b8d611474411f56989ae";
+
+/* CHAP-MD5 and EAP-MD5: MD5 of id, secret and challenge */
+static void
+chap_md5(int id)
+{
+    MD5_CTX ctx;
+    u_char idbyte = id;
+    u_char digest[16];
+
+    MD5_Init(&ctx);
+    MD5_Update(&ctx, &idbyte, 1);
+    MD5_Update(&ctx, (u_char *) secret, strlen(secret));
+    MD5_Update(&ctx, challenge, sizeof(challenge));
+    MD5_Final(digest, &ctx);
+}
+
+/*
+ * RADIUS Access-Request: hide a 16-byte User-Password with MD5 of
+ * the shared secret and request authenticator, then check the
+ * response authenticator, MD5 over the reply and the secret.
+ */
+static void
+radius_login(int i)
+{
+    static u_char reply[120];
+    static char rsecret[] = "testing123";
+    MD5_CTX ctx;
+    u_char buf[sizeof(reply) + sizeof(rsecret)];
+    u_char digest[16];
+
+    MD5_Init(&ctx);
+    MD5_Update(&ctx, (u_char *) rsecret, strlen(rsecret));
+    MD5_Update(&ctx, challenge, sizeof(challenge));
+    MD5_Final(digest, &ctx);
+
+    memcpy(buf, reply, sizeof(reply));
+    memcpy(buf + sizeof(reply), rsecret, strlen(rsecret));
+    MD5_Init(&ctx);
+    MD5_Update(&ctx, buf, sizeof(reply) + strlen(rsecret));
+    MD5_Final(digest, &ctx);
+}
+
+static void
+mschap(int i)
+{
+    u_char response[MS_CHAP_RESPONSE_LEN];
+
+    ChapMS(challenge, secret, strlen(secret), response);
+}
+
+static void
+mschap_nt(int i)
+{
+    u_char response[MS_CHAP_RESPONSE_LEN];
+
+    ChapMS(challenge, nt_secret, strlen(nt_secret), response);
+}
+
+static void
+mschap2(int i)
+{
+    u_char response[MS_CHAP2_RESPONSE_LEN];
+    u_char auth_response[MS_AUTH_RESPONSE_LENGTH + 1];
+
+    ChapMS2(challenge, peer_challenge, username, secret, strlen(secret),
+	    response, auth_response, MS_CHAP2_AUTHENTICATOR);
+}
+
+static void
+mschap2_nt(int i)
+{
+    u_char response[MS_CHAP2_RESPONSE_LEN];
+    u_char auth_response[MS_AUTH_RESPONSE_LENGTH + 1];
+
+    ChapMS2(challenge, peer_challenge, username, nt_secret,
+	    strlen(nt_secret), response, auth_response,
+	    MS_CHAP2_AUTHENTICATOR);
+}
+
+static struct {
+    char *name;
+    void (*login)(int);
+} methods[] = {
+    { "CHAP-MD5, EAP-MD5",		chap_md5 },
+    { "MS-CHAP",			mschap },
+    { "MS-CHAP, stored NT hash",	mschap_nt },
+    { "MS-CHAPv2",			mschap2 },
+    { "MS-CHAPv2, stored NT hash",	mschap2_nt },
+    { "RADIUS Access-Request",		radius_login },
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int ac, char **av)
+{
+    double t, best;
+    int c, i, m, r;
+
+    while ((c = getopt(ac, av, "n:")) != -1) {
+	if (c != 'n') {
+	    fprintf(stderr, "Usage: %s [-n logins]\n", av[0]);
+	    exit(2);
+	}
+	nlogins = atoi(optarg);
+    }
+
+    /* the best of a few rounds, to see past other load */
+    for (m = 0; m < sizeof(methods) / sizeof(methods[0]); ++m) {
+	best = 0;
+	for (r = 0; r < ROUNDS; ++r) {
+	    t = now();
+	    for (i = 0; i < nlogins; ++i)
+		(*methods[m].login)(i);
+	    t = now() - t;
+	    if (r == 0 || t < best)
+		best = t;
+	}
+	printf("%-28s %8.2f us per login\n", methods[m].name,
+	       best * 1e6 / nlogins);
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * hashtest - check MD4, MD5 and SHA-1 against the RFC 1320, RFC 1321
+ * and FIPS 180-1 test vectors, feeding each message in two pieces
+ * split at every possible point so that the buffering of partial
+ * blocks is exercised too.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "md4.h"
+#include "md5.h"
+#include "sha1.h"
+
+static struct {
+    char *msg;
+    char *md4;
+    char *md5;
+} vectors[] = {
+    { "",
+      "31d6cfe0d16ae931b73c59d7e0c089c0",
+      "d41d8cd98f00b204e9800998ecf8427e" },
+    { "a",
+      "bde52cb31de33e46245e05fbdbd6fb24",
+      "0cc175b9c0f1b6a831c399e269772661" },
+    { "abc",
+      "a448017aaf21d8525fc10ae87aa6729d",
+      "900150983cd24fb0d6963f7d28e17f72" },
+    { "message digest",
+      "d9130a8164549fe818874806e1c7014b",
+      "f96b697d7cb7938d525a2f31aaf161d0" },
+    { "abcdefghijklmnopqrstuvwxyz",
+      "d79e1c308aa5bbcdeea8ed63df412da9",
+      "c3fcd3d76192e4007dfb496cca67e13b" },
+    { "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+      "043f8582f241db351ce627e153e7f0e4",
+      "d174ab98d277d9f5a5611c2c9f419d9f" },
+    { "123456789012345678901234567890123456789012345678901234567890"
+      "12345678901234567890",
+      "e33b4ddc9c38f2199c3e7b164fcc0536",
+      "57edf4a22be3c955ac49da2e2107b67a" },
+};
+
+static struct {
+    char *msg;
+    char *sha1;
+} sha1_vectors[] = {
+    { "abc",
+      "a9993e364706816aba3e25717850c26c9cd0d89d" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+      "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+};
+
+static char *
+hex(unsigned char *p, int n)
+{
+    static char buf[41];
+    int i;
+
+    for (i = 0; i < n; ++i)
+	sprintf(buf + 2 * i, "%02x", p[i]);
+    return buf;
+}
+
+int
+main(int ac, char **av)
+{
+    MD4_CTX md4;
+    MD5_CTX md5;
+    SHA1_CTX sha1;
+    unsigned char digest[20], *buf;
+    unsigned char *m;
+    int i, len, split, bad = 0;
+
+    for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); ++i) {
+	m = (unsigned char *) vectors[i].msg;
+	len = strlen(vectors[i].msg);
+	for (split = 0; split <= len; ++split) {
+	    MD4_Init(&md4);
+	    MD4_Update(&md4, m, split);
+	    MD4_Update(&md4, m + split, len - split);
+	    MD4_Final(digest, &md4);
+	    if (strcmp(hex(digest, 16), vectors[i].md4) != 0) {
+		printf("MD4(\"%s\") split at %d: got %s\n",
+		       vectors[i].msg, split, hex(digest, 16));
+		++bad;
+	    }
+	    MD5_Init(&md5);
+	    MD5_Update(&md5, m, split);
+	    MD5_Update(&md5, m + split, len - split);
+	    MD5_Final(digest, &md5);
+	    if (strcmp(hex(digest, 16), vectors[i].md5) != 0) {
+		printf("MD5(\"%s\") split at %d: got %s\n",
+		       vectors[i].msg, split, hex(digest, 16));
+		++bad;
+	    }
+	}
+    }
+
+    for (i = 0; i < sizeof(sha1_vectors) / sizeof(sha1_vectors[0]); ++i) {
+	m = (unsigned char *) sha1_vectors[i].msg;
+	len = strlen(sha1_vectors[i].msg);
+	for (split = 0; split <= len; ++split) {
+	    SHA1_Init(&sha1);
+	    SHA1_Update(&sha1, m, split);
+	    SHA1_Update(&sha1, m + split, len - split);
+	    SHA1_Final(digest, &sha1);
+	    if (strcmp(hex(digest, 20), sha1_vectors[i].sha1) != 0) {
+		printf("SHA1(\"%s\") split at %d: got %s\n",
+		       sha1_vectors[i].msg, split, hex(digest, 20));
+		++bad;
+	    }
+	}
+    }
+
+    /* a million a's, in pieces that don't line up with the blocks */
+    buf = malloc(1000000);
+    if (buf == NULL) {
+	perror("hashtest");
+	exit(1);
+    }
+    memset(buf, 'a', 1000000);
+    SHA1_Init(&sha1);
+    for (i = 0; i < 1000000; i += 997)
+	SHA1_Update(&sha1, buf + i, (1000000 - i < 997)? 1000000 - i: 997);
+    SHA1_Final(digest, &sha1);
+    if (strcmp(hex(digest, 20),
+	       "34aa973cd4c4daa4f61eeb2bdbad27316534016f") != 0) {
+	printf("SHA1(a million a's): got %s\n", hex(digest, 20));
+	++bad;
+    }
+    free(buf);
+
+    if (bad) {
+	printf("%d hash tests failed\n", bad);
+	return 1;
+    }
+    printf("MD4, MD5 and SHA-1 test vectors OK\n");
+    return 0;
+}
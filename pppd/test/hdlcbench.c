@@ -0,0 +1,166 @@
+/*
+ * hdlcbench - compare the throughput of hdlc_decode from
+ * common/hdlc.c with the byte-at-a-time loop it replaced, on
+ * 1500-byte frames of random data framed with an ACCM of 0 (about
+ * 1 byte in 128 escaped) and of 0xffffffff (about 1 in 7).
+ *
+ * Usage: hdlcbench [-m megabytes]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include "hdlc.h"
+
+#define PPP_FLAG	0x7e
+#define PPP_ESCAPE	0x7d
+#define PPP_TRANS	0x20
+
+#define ROUNDS		5
+#define FRAMELEN	1500
+#define NFRAMES		64	/* frames in the stream we decode */
+
+static int mbytes = 200;	/* stream to decode per measurement */
+
+static unsigned char frame[FRAMELEN + 2];
+static int nframes;
+
+/* The old decoder, from loop_chars() in demand.c */
+static void
+old_decode(unsigned char *p, int n)
+{
+    int c, framelen = 0, escape_flag = 0, flush_flag = 0;
+
+    for (; n > 0; --n) {
+	c = *p++;
+	if (c == PPP_FLAG) {
+	    if (framelen > 0 && !escape_flag && !flush_flag)
+		++nframes;
+	    framelen = 0;
+	    flush_flag = 0;
+	    escape_flag = 0;
+	    continue;
+	}
+	if (flush_flag)
+	    continue;
+	if (escape_flag) {
+	    c ^= PPP_TRANS;
+	    escape_flag = 0;
+	} else if (c == PPP_ESCAPE) {
+	    escape_flag = 1;
+	    continue;
+	}
+	if (framelen >= sizeof(frame)) {
+	    flush_flag = 1;
+	    continue;
+	}
+	frame[framelen++] = c;
+    }
+}
+
+static void
+count_frame(void *arg, unsigned char *p, int len, int flags)
+{
+    if (flags == 0)
+	++nframes;
+}
+
+static void
+new_decode(unsigned char *p, int n)
+{
+    static struct hdlc_decoder d;
+
+    d.buf = frame;
+    d.maxlen = sizeof(frame);
+    hdlc_decode(&d, p, n, count_frame, NULL);
+}
+
+/*
+ * make_stream - frame NFRAMES frames of random data with accm.
+ * Returns the length of the stream.
+ */
+static int
+make_stream(unsigned char *s, u_int32_t accm)
+{
+    unsigned char *q = s;
+    int i, j, c;
+
+    for (i = 0; i < NFRAMES; ++i) {
+	*q++ = PPP_FLAG;
+	for (j = 0; j < FRAMELEN + 2; ++j) {
+	    c = random() & 0xff;
+	    if (c == PPP_FLAG || c == PPP_ESCAPE
+		|| (c < 0x20 && (accm >> c) & 1)) {
+		*q++ = PPP_ESCAPE;
+		c ^= PPP_TRANS;
+	    }
+	    *q++ = c;
+	}
+    }
+    *q++ = PPP_FLAG;
+    return q - s;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct {
+    char *name;
+    void (*decode)(unsigned char *, int);
+} methods[] = {
+    { "byte-at-a-time",		old_decode },
+    { "hdlc_decode",		new_decode },
+};
+
+static u_int32_t accms[] = { 0, 0xffffffff };
+
+int
+main(int ac, char **av)
+{
+    static unsigned char stream[NFRAMES * (2 * (FRAMELEN + 2) + 1) + 1];
+    double t, best;
+    int a, c, i, m, r, n, len;
+
+    while ((c = getopt(ac, av, "m:")) != -1) {
+	if (c != 'm') {
+	    fprintf(stderr, "Usage: %s [-m megabytes]\n", av[0]);
+	    exit(2);
+	}
+	mbytes = atoi(optarg);
+    }
+
+    srandom(1);
+    for (a = 0; a < sizeof(accms) / sizeof(accms[0]); ++a) {
+	len = make_stream(stream, accms[a]);
+	n = mbytes * 1000000.0 / len + 1;
+	for (m = 0; m < sizeof(methods) / sizeof(methods[0]); ++m) {
+	    /* the best of a few rounds, to see past other load */
+	    best = 0;
+	    for (r = 0; r < ROUNDS; ++r) {
+		nframes = 0;
+		t = now();
+		for (i = 0; i < n; ++i)
+		    (*methods[m].decode)(stream, len);
+		t = now() - t;
+		if (nframes != n * NFRAMES) {
+		    fprintf(stderr, "%s: decoded %d frames, want %d\n",
+			    methods[m].name, nframes, n * NFRAMES);
+		    exit(1);
+		}
+		if (r == 0 || t < best)
+		    best = t;
+	    }
+	    printf("%-16s accm %08x %8.1f MB/s\n", methods[m].name,
+		   accms[a], (double) n * len / best / 1e6);
+	}
+    }
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * hdlctest - check hdlc_decode from common/hdlc.c against the
+ * byte-at-a-time loop the demand-dial loopback used before.
+ *
+ * The input is a stream of random frames, framed with a random ACCM
+ * and with flag, escape and control characters made common, mixed
+ * with aborted frames, frames too long for the buffer, frames with
+ * no opening flag and stray escapes.  It is fed to hdlc_decode in
+ * pieces split at random points, and the frames it delivers must be
+ * the same, with the same flags, as the old loop's.  Whole frames
+ * must also come back as they were sent, with a good FCS.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "hdlc.h"
+#include "fcs.h"
+
+#define PPP_FLAG	0x7e
+#define PPP_ESCAPE	0x7d
+#define PPP_TRANS	0x20
+
+#define NSTREAMS	2000
+#define NFRAMES		50	/* frames per stream */
+#define MAXFRAME	300	/* longest frame we send */
+#define BUFLEN		256	/* decoder's buffer; longer frames overrun */
+
+struct frame {
+    int		len;
+    int		flags;
+    unsigned char data[BUFLEN];
+};
+
+static struct frame got[NFRAMES * 2], want[NFRAMES * 2];
+static int ngot, nwant;
+
+static unsigned char sent[NFRAMES][MAXFRAME + 2];
+static int sentlen[NFRAMES];
+static int intact[NFRAMES];	/* frame wasn't spoilt on purpose */
+
+static void
+save(struct frame *f, unsigned char *p, int len, int flags)
+{
+    f->len = len;
+    f->flags = flags;
+    memcpy(f->data, p, len);
+}
+
+static void
+got_frame(void *arg, unsigned char *p, int len, int flags)
+{
+    if (ngot < NFRAMES * 2)
+	save(&got[ngot], p, len, flags);
+    ++ngot;
+}
+
+/*
+ * The old decoder, from loop_chars() in demand.c, delivering what
+ * it has instead of checking the FCS and dropping bad frames.
+ */
+static void
+old_decode(unsigned char *p, int n)
+{
+    static unsigned char frame[BUFLEN];
+    int c, framelen = 0, escape_flag = 0, flush_flag = 0;
+
+    for (; n > 0; --n) {
+	c = *p++;
+	if (c == PPP_FLAG) {
+	    if (framelen > 0 && nwant < NFRAMES * 2)
+		save(&want[nwant++], frame, framelen,
+		     (escape_flag? HDLC_ABORTED: 0)
+		     | (flush_flag? HDLC_OVERRUN: 0));
+	    framelen = 0;
+	    flush_flag = 0;
+	    escape_flag = 0;
+	    continue;
+	}
+	if (flush_flag)
+	    continue;
+	if (escape_flag) {
+	    c ^= PPP_TRANS;
+	    escape_flag = 0;
+	} else if (c == PPP_ESCAPE) {
+	    escape_flag = 1;
+	    continue;
+	}
+	if (framelen >= BUFLEN) {
+	    flush_flag = 1;
+	    continue;
+	}
+	frame[framelen++] = c;
+    }
+}
+
+/* a byte that is often one that needs escaping */
+static unsigned char
+random_byte(void)
+{
+    switch (random() % 8) {
+    case 0:
+	return PPP_FLAG;
+    case 1:
+	return PPP_ESCAPE;
+    case 2:
+	return random() % 0x20;
+    default:
+	return random();
+    }
+}
+
+static unsigned char *
+put_escaped(unsigned char *q, unsigned char c, u_int32_t accm)
+{
+    if (c == PPP_FLAG || c == PPP_ESCAPE || (c < 0x20 && (accm >> c) & 1)) {
+	*q++ = PPP_ESCAPE;
+	c ^= PPP_TRANS;
+    }
+    *q++ = c;
+    return q;
+}
+
+/*
+ * make_stream - fill s with NFRAMES frames, some spoilt, and return
+ * its length.
+ */
+static int
+make_stream(unsigned char *s)
+{
+    unsigned char *q = s;
+    u_int32_t accm;
+    u_int16_t fcs;
+    int i, j, len;
+
+    accm = (random() & 1)? ((u_int32_t) random() << 1) ^ random(): 0;
+    for (i = 0; i < NFRAMES; ++i) {
+	if (random() % 10 != 0)
+	    *q++ = PPP_FLAG;
+	len = 1 + random() % ((random() % 5 == 0)? MAXFRAME: 64);
+	for (j = 0; j < len; ++j)
+	    sent[i][j] = random_byte();
+	fcs = ~fcs16(FCS16_INIT, sent[i], len);
+	sent[i][len] = fcs;
+	sent[i][len+1] = fcs >> 8;
+	sentlen[i] = len + 2;
+	for (j = 0; j < len + 2; ++j)
+	    q = put_escaped(q, sent[i][j], accm);
+	intact[i] = sentlen[i] <= BUFLEN;
+	switch (random() % 20) {
+	case 0:
+	    *q++ = PPP_ESCAPE;		/* abort the frame */
+	    intact[i] = 0;
+	    break;
+	case 1:
+	    *q++ = PPP_ESCAPE;		/* a stray escape */
+	    *q++ = random_byte();
+	    intact[i] = 0;
+	    break;
+	}
+	*q++ = PPP_FLAG;
+	if (random() % 10 == 0)
+	    *q++ = PPP_FLAG;		/* an empty frame */
+    }
+    return q - s;
+}
+
+int
+main(int ac, char **av)
+{
+    static unsigned char stream[NFRAMES * (2 * (MAXFRAME + 2) + 6)];
+    static unsigned char buf[BUFLEN];
+    struct hdlc_decoder d;
+    int i, j, n, off, k, len, bad = 0;
+
+    srandom(1);
+    for (n = 0; n < NSTREAMS && bad < 10; ++n) {
+	len = make_stream(stream);
+
+	ngot = nwant = 0;
+	old_decode(stream, len);
+	memset(&d, 0, sizeof(d));
+	d.buf = buf;
+	d.maxlen = BUFLEN;
+	for (off = 0; off < len; off += k) {
+	    k = 1 + random() % ((random() & 1)? 16: 512);
+	    if (k > len - off)
+		k = len - off;
+	    hdlc_decode(&d, stream + off, k, got_frame, NULL);
+	}
+
+	if (ngot != nwant) {
+	    printf("stream %d: got %d frames, want %d\n", n, ngot, nwant);
+	    ++bad;
+	    continue;
+	}
+	for (i = 0; i < ngot; ++i) {
+	    if (got[i].len != want[i].len || got[i].flags != want[i].flags
+		|| memcmp(got[i].data, want[i].data, got[i].len) != 0) {
+		printf("stream %d frame %d: got %d bytes flags %d,"
+		       " want %d bytes flags %d\n", n, i, got[i].len,
+		       got[i].flags, want[i].len, want[i].flags);
+		++bad;
+		break;
+	    }
+	}
+	if (i < ngot)
+	    continue;
+
+	/* the frames that weren't spoilt come through as they were sent */
+	for (i = j = 0; i < ngot; ++i) {
+	    if (got[i].flags != 0
+		|| fcs16(FCS16_INIT, got[i].data, got[i].len) != FCS16_GOOD)
+		continue;
+	    while (j < NFRAMES && !intact[j])
+		++j;
+	    if (j == NFRAMES || got[i].len != sentlen[j]
+		|| memcmp(got[i].data, sent[j], sentlen[j]) != 0) {
+		printf("stream %d: frame %d isn't the one sent\n", n, i);
+		++bad;
+		break;
+	    }
+	    ++j;
+	}
+	while (j < NFRAMES && !intact[j])
+	    ++j;
+	if (i == ngot && j < NFRAMES) {
+	    printf("stream %d: frame %d sent wasn't received\n", n, j);
+	    ++bad;
+	}
+    }
+
+    if (bad) {
+	printf("%d HDLC tests failed\n", bad);
+	return 1;
+    }
+    printf("HDLC decoder matches the byte-at-a-time decoder\n");
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * magictest - check the ChaCha20 block function in magic.c against
+ * the test vector in RFC 8439 section 2.3.2, and that a child process
+ * doesn't get the same random numbers as its parent.
+ *
+ * magic.c is included rather than linked, to get at chacha20_block.
+ */
+#include <sys/wait.h>
+#include "magic.c"
+
+static u_char rfc8439_block[64] = {
+    0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15,
+    0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+    0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03,
+    0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+    0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09,
+    0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+    0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9,
+    0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e,
+};
+
+int
+main(int ac, char **av)
+{
+    u_int32_t in[16], saved[16];
+    u_char out[64], mine[16], childs[16];
+    int i, p[2], bad = 0;
+    pid_t pid;
+
+    /* key 00:01:02:..:1f, counter 1, nonce 00:00:00:09:00:00:00:4a:00:00:00:00 */
+    in[0] = 0x61707865;
+    in[1] = 0x3320646e;
+    in[2] = 0x79622d32;
+    in[3] = 0x6b206574;
+    for (i = 0; i < 8; ++i)
+	in[4 + i] = (4 * i) | (4 * i + 1) << 8 | (4 * i + 2) << 16
+	    | (u_int32_t)(4 * i + 3) << 24;
+    in[12] = 1;
+    in[13] = 0x09000000;
+    in[14] = 0x4a000000;
+    in[15] = 0;
+    memcpy(saved, in, sizeof(in));
+    chacha20_block(in, out);
+    if (memcmp(out, rfc8439_block, sizeof(out)) != 0) {
+	printf("ChaCha20 block doesn't match RFC 8439 section 2.3.2\n");
+	++bad;
+    }
+    if (memcmp(in, saved, sizeof(in)) != 0) {
+	printf("ChaCha20 block changed its input\n");
+	++bad;
+    }
+
+    /* the parent and a child each take the next 16 bytes */
+    magic_init();
+    if (pipe(p) < 0 || (pid = fork()) < 0) {
+	perror("magictest");
+	exit(1);
+    }
+    if (pid == 0) {
+	random_bytes(childs, sizeof(childs));
+	write(p[1], childs, sizeof(childs));
+	_exit(0);
+    }
+    random_bytes(mine, sizeof(mine));
+    if (read(p[0], childs, sizeof(childs)) != sizeof(childs)) {
+	printf("child didn't send its random bytes\n");
+	++bad;
+    } else if (memcmp(mine, childs, sizeof(mine)) == 0) {
+	printf("child got the same random bytes as its parent\n");
+	++bad;
+    }
+    waitpid(pid, NULL, 0);
+
+    if (bad) {
+	printf("%d random number tests failed\n", bad);
+	return 1;
+    }
+    printf("ChaCha20 test vector OK, child reseeded\n");
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * mschaptest - check the DES in pppcrypt.c against the FIPS 81 and
+ * NBS known answers, and MS-CHAP and MS-CHAPv2 against the example in
+ * RFC 2759 section 9.2, with the password given in the clear and as
+ * a stored NT hash.
+ *
+ * Linked with the rest of pppd, so that the responses come from the
+ * same ChapMS/ChapMS2 code a real login uses.  A stored hash of the
+ * NT hash that is wrong must be ignored, not used.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "pppd.h"
+#include "pppcrypt.h"
+#include "chap_ms.h"
+
+static struct {
+    char *key;
+    char *plain;
+    char *cipher;
+} des_vectors[] = {
+    { "133457799BBCDFF1", "0123456789ABCDEF", "85E813540F0AB405" },
+    { "0123456789ABCDEF", "4E6F772069732074", "3FA40E8A984D4815" },
+    { "0101010101010101", "95F8A5E5DD31D900", "8000000000000000" },
+    { "8001010101010101", "0000000000000000", "95A8D72813DAA94D" },
+    { "7CA110454A1A6E57", "01A1D6D039776742", "690F5B0D9A26939B" },
+    { "FEDCBA9876543210", "0123456789ABCDEF", "ED39D950FA74BCC4" },
+};
+
+/* RFC 2759 section 9.2 */
+static char username[] = "User";
+static char *secrets[] = {
+    "clientPass",
+    "$NT$44ebba8d5312b8d611474411f56989ae",
+    "$NT$44ebba8d5312b8d611474411f56989ae$41c00c584bd2d91c4017a2a12fa59f3f",
+    "$NT$44ebba8d5312b8d611474411f56989ae$00000000000000000000000000000000",
+};
+static char auth_challenge[] = "5B5D7C7D7B3F2F3E3C2C602132262628";
+static char peer_challenge[] = "21402324255E262A28295F2B3A337C7E";
+static char challenge[] = "D02E4386BCE91226";	/* from the two above */
+static char nt_response[] = "82309ECD8D708B5EA08FAA3981CD83544233114A3D85D6DF";
+/* without the "S=", which is put on when the Success packet is sent */
+static char auth_response[] = "407A5589115FD0D6209F510FE9C04566932CDA56";
+
+static void
+unhex(char *s, u_char *p)
+{
+    for (; s[0] && s[1]; s += 2)
+	sscanf(s, "%2hhx", p++);
+}
+
+static char *
+hex(u_char *p, int n)
+{
+    static char buf[64];
+    int i;
+
+    for (i = 0; i < n; ++i)
+	sprintf(buf + 2 * i, "%02X", p[i]);
+    return buf;
+}
+
+/* Drop the parity bits from an 8-octet DES key, leaving 7 octets */
+static void
+pack_key(u_char *k8, u_char *k7)
+{
+    int i, b;
+
+    memset(k7, 0, 7);
+    for (i = b = 0; i < 64; ++i) {
+	if (i % 8 == 7)
+	    continue;
+	if ((k8[i/8] >> (7 - i % 8)) & 1)
+	    k7[b/8] |= 0x80 >> (b % 8);
+	++b;
+    }
+}
+
+int
+main(int ac, char **av)
+{
+    DesKeySchedule ks;
+    u_char k8[8], k7[7], plain[8], cipher[8], out[8];
+    u_char rchallenge[16], pchallenge[16];
+    u_char response[MS_CHAP2_RESPONSE_LEN];
+    u_char authr[MS_AUTH_RESPONSE_LENGTH + 1];
+    char *secret;
+    int i, bad = 0;
+
+    for (i = 0; i < sizeof(des_vectors) / sizeof(des_vectors[0]); ++i) {
+	unhex(des_vectors[i].key, k8);
+	unhex(des_vectors[i].plain, plain);
+	unhex(des_vectors[i].cipher, cipher);
+	pack_key(k8, k7);
+	DesSetkey(k7, &ks);
+	DesEncrypt(plain, &ks, out);
+	if (memcmp(out, cipher, 8) != 0) {
+	    printf("DES key %s: encrypt gave %s\n", des_vectors[i].key,
+		   hex(out, 8));
+	    ++bad;
+	}
+	DesDecrypt(cipher, &ks, out);
+	if (memcmp(out, plain, 8) != 0) {
+	    printf("DES key %s: decrypt gave %s\n", des_vectors[i].key,
+		   hex(out, 8));
+	    ++bad;
+	}
+    }
+
+    for (i = 0; i < sizeof(secrets) / sizeof(secrets[0]); ++i) {
+	secret = secrets[i];
+
+	/* MS-CHAP's NT-Response is MS-CHAPv2's without the hashing
+	   of the challenges, so the same answer serves for both */
+	unhex(challenge, rchallenge);
+	ChapMS(rchallenge, secret, strlen(secret), response);
+	if (strcmp(hex(response + MS_CHAP_NTRESP, MS_CHAP_NTRESP_LEN),
+		   nt_response) != 0) {
+	    printf("MS-CHAP, secret %s: NT-Response %s\n", secret,
+		   hex(response + MS_CHAP_NTRESP, MS_CHAP_NTRESP_LEN));
+	    ++bad;
+	}
+
+	unhex(auth_challenge, rchallenge);
+	unhex(peer_challenge, pchallenge);
+	ChapMS2(rchallenge, pchallenge, username, secret, strlen(secret),
+		response, authr, MS_CHAP2_AUTHENTICATOR);
+	if (strcmp(hex(response + MS_CHAP2_NTRESP, MS_CHAP2_NTRESP_LEN),
+		   nt_response) != 0) {
+	    printf("MS-CHAPv2, secret %s: NT-Response %s\n", secret,
+		   hex(response + MS_CHAP2_NTRESP, MS_CHAP2_NTRESP_LEN));
+	    ++bad;
+	}
+	if (strcmp((char *) authr, auth_response) != 0) {
+	    printf("MS-CHAPv2, secret %s: authenticator response %s\n",
+		   secret, authr);
+	    ++bad;
+	}
+    }
+
+    if (bad) {
+	printf("%d MS-CHAP tests failed\n", bad);
+	return 1;
+    }
+    printf("DES and MS-CHAP known answers OK\n");
+    return 0;
+}
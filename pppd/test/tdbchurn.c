@@ -0,0 +1,174 @@
+/*
+ * tdbchurn - replay the kind of churn the pppdb sees, with many
+ * sessions each rewriting an entry of varying size as variables are
+ * set and unset, and some sessions going away, to time allocation
+ * from the free lists.
+ *
+ * Usage: tdbchurn [-k sessions] [-n ops] [-f file]
+ *
+ * It runs once on a database as made now, with free space on
+ * size-class lists, and once on one marked as version 6, which is
+ * kept on the old single free list because another descriptor is
+ * held open on it throughout, as an older pppd would.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "tdb.h"
+
+#define TDB_VERSION	(0x26011967 + 7)
+#define TDB_VERSION_V6	(0x26011967 + 6)
+
+static char *file = "/tmp/tdbchurn.tdb";
+static int nkeys = 10000;
+static int nops = 100000;
+
+static int *lens;		/* length of each session's entry, or 0 */
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+set_key(TDB_DATA *key, char *buf, int i)
+{
+    sprintf(buf, "pppd%d", 1000 + i);
+    key->dptr = buf;
+    key->dsize = strlen(buf);
+}
+
+/*
+ * run - make a new database, as version 6 if v6 is set, and time
+ * nops stores and deletes on it.
+ */
+static int
+run(char *name, int v6)
+{
+    TDB_CONTEXT *db;
+    TDB_DATA key, val;
+    char kbuf[32], vbuf[1600];
+    struct stat st;
+    u_int32_t version;
+    int i, k, fd = -1, bad = 0;
+    double t;
+
+    unlink(file);
+    db = tdb_open(file, 0, 0, O_RDWR | O_CREAT, 0644);
+    if (db == NULL) {
+	perror(file);
+	exit(1);
+    }
+    tdb_close(db);
+    if (v6) {
+	/* mark it version 6, and keep it open as older code would */
+	fd = open(file, O_RDWR);
+	version = TDB_VERSION_V6;
+	if (fd < 0 || pwrite(fd, &version, sizeof(version),
+			     offsetof(struct tdb_header, version))
+		      != sizeof(version)) {
+	    perror(file);
+	    exit(1);
+	}
+    }
+    db = tdb_open(file, 0, 0, O_RDWR, 0644);
+    if (db == NULL) {
+	perror(file);
+	exit(1);
+    }
+    if (db->header.version != (v6? TDB_VERSION_V6: TDB_VERSION)) {
+	fprintf(stderr, "%s: database is version %#x\n", name,
+		db->header.version);
+	exit(1);
+    }
+
+    memset(lens, 0, nkeys * sizeof(int));
+    memset(vbuf, 'x', sizeof(vbuf));
+    srandom(1);
+    t = now();
+    for (i = 0; i < nops; ++i) {
+	k = random() % nkeys;
+	set_key(&key, kbuf, k);
+	if (random() % 10 == 0) {
+	    /* the session ends */
+	    if (lens[k] && tdb_delete(db, key) != 0)
+		++bad;
+	    lens[k] = 0;
+	    continue;
+	}
+	/* a variable is set or unset: the entry is rewritten */
+	lens[k] = 100 + random() % 1400;
+	val.dptr = vbuf;
+	val.dsize = lens[k];
+	if (tdb_store(db, key, val, TDB_REPLACE) != 0)
+	    ++bad;
+    }
+    t = now() - t;
+
+    /* check that every session's entry is intact */
+    for (k = 0; k < nkeys; ++k) {
+	set_key(&key, kbuf, k);
+	val = tdb_fetch(db, key);
+	if (val.dsize != lens[k] || (lens[k] && val.dptr == NULL))
+	    ++bad;
+	free(val.dptr);
+    }
+    fstat(db->fd, &st);
+    tdb_close(db);
+    if (fd >= 0)
+	close(fd);
+    if (bad) {
+	fprintf(stderr, "%s: %d operations failed or entries wrong\n",
+		name, bad);
+	exit(1);
+    }
+    printf("%-26s %8.2f us per op, %6ld KB file\n", name,
+	   t * 1e6 / nops, (long) st.st_size / 1024);
+    return 0;
+}
+
+int
+main(int ac, char **av)
+{
+    int c;
+
+    while ((c = getopt(ac, av, "k:n:f:")) != -1) {
+	switch (c) {
+	case 'k':
+	    nkeys = atoi(optarg);
+	    break;
+	case 'n':
+	    nops = atoi(optarg);
+	    break;
+	case 'f':
+	    file = optarg;
+	    break;
+	default:
+	    fprintf(stderr, "Usage: %s [-k sessions] [-n ops] [-f file]\n",
+		    av[0]);
+	    exit(2);
+	}
+    }
+    lens = malloc(nkeys * sizeof(int));
+    if (nkeys <= 0 || lens == NULL) {
+	fprintf(stderr, "%s: bad number of sessions\n", av[0]);
+	exit(2);
+    }
+
+    printf("%d sessions, %d operations\n", nkeys, nops);
+    run("single free list (v6)", 1);
+    run("size-class free lists", 0);
+    unlink(file);
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * tdblock - compare tdb chain locking with fcntl locks against
+ * locking with robust mutexes in the file, with several processes
+ * updating one database the way pppds update the pppdb.
+ *
+ * Usage: tdblock [-p procs] [-n ops] [-f file]
+ *
+ * Each process repeatedly stores its own entry, with a value of
+ * varying size, and fetches the entry of another process, so that
+ * the processes contend for the same chains and the free list.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "tdb.h"
+
+static char *file = "/tmp/tdblock.tdb";
+static int nprocs = 8;
+static int nops = 20000;
+
+static int worker(int, int);
+static double run(char *, int);
+
+int
+main(int ac, char **av)
+{
+    int c;
+    double tf, tm;
+
+    while ((c = getopt(ac, av, "p:n:f:")) != -1) {
+	switch (c) {
+	case 'p':
+	    nprocs = atoi(optarg);
+	    break;
+	case 'n':
+	    nops = atoi(optarg);
+	    break;
+	case 'f':
+	    file = optarg;
+	    break;
+	default:
+	    fprintf(stderr, "Usage: %s [-p procs] [-n ops] [-f file]\n",
+		    av[0]);
+	    exit(2);
+	}
+    }
+
+    tf = run("fcntl", 0);
+    tm = run("mutex", TDB_MUTEX_LOCKING);
+    if (tf > 0 && tm > 0)
+	printf("mutex locking takes %.2f times as long as fcntl\n", tm / tf);
+    unlink(file);
+    return 0;
+}
+
+/*
+ * run - time nprocs processes doing nops updates each on a new
+ * database made with `flags'.  Returns the time in seconds.
+ */
+static double
+run(char *name, int flags)
+{
+    TDB_CONTEXT *db;
+    struct timeval t0, t1;
+    int i, status, failed = 0;
+    double t;
+
+    unlink(file);
+    db = tdb_open(file, 0, flags, O_RDWR | O_CREAT, 0644);
+    if (db == NULL) {
+	perror(file);
+	exit(1);
+    }
+    if ((flags & TDB_MUTEX_LOCKING) && db->header.lock_type != TDB_LOCK_MUTEX) {
+	printf("%s: not supported in this build\n", name);
+	tdb_close(db);
+	return 0;
+    }
+    tdb_close(db);
+
+    fflush(stdout);
+    gettimeofday(&t0, NULL);
+    for (i = 0; i < nprocs; ++i) {
+	switch (fork()) {
+	case -1:
+	    perror("fork");
+	    exit(1);
+	case 0:
+	    exit(worker(i, flags));
+	}
+    }
+    while (wait(&status) > 0)
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	    failed = 1;
+    gettimeofday(&t1, NULL);
+    if (failed) {
+	fprintf(stderr, "%s: a worker failed\n", name);
+	exit(1);
+    }
+    t = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+    printf("%s: %d processes x %d updates in %.3f s, %.2f us per update\n",
+	   name, nprocs, nops, t, t * 1e6 / ((double) nprocs * nops));
+    return t;
+}
+
+static int
+worker(int n, int flags)
+{
+    TDB_CONTEXT *db;
+    TDB_DATA key, val;
+    char kbuf[32], vbuf[512];
+    int i, len, bad = 0;
+
+    db = tdb_open(file, 0, flags, O_RDWR, 0644);
+    if (db == NULL) {
+	perror(file);
+	return 1;
+    }
+    srandom(n + 1);
+    memset(vbuf, 'x', sizeof(vbuf));
+    for (i = 0; i < nops; ++i) {
+	/* our entry grows and shrinks as variables come and go */
+	sprintf(kbuf, "pppd%d", n);
+	key.dptr = kbuf;
+	key.dsize = strlen(kbuf);
+	len = 64 + random() % (sizeof(vbuf) - 64);
+	sprintf(vbuf, "IFNAME=ppp%d;COUNT=%d;", n, i);
+	val.dptr = vbuf;
+	val.dsize = len;
+	if (tdb_store(db, key, val, TDB_REPLACE) != 0)
+	    ++bad;
+
+	/* and we look at somebody else's */
+	sprintf(kbuf, "pppd%d", (int) (random() % nprocs));
+	key.dsize = strlen(kbuf);
+	val = tdb_fetch(db, key);
+	free(val.dptr);
+    }
+    tdb_close(db);
+    if (bad)
+	fprintf(stderr, "worker %d: %d stores failed\n", n, bad);
+    return bad != 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * timerbench - time scheduling and cancelling timeouts with many
+ * pending, as with many sessions each running LCP, CHAP and RADIUS
+ * timers.
+ *
+ * Usage: timerbench [-n timers]
+ *
+ * Linked with the rest of pppd, so that it times the real timeout()
+ * and untimeout().  For comparison it also times the sorted list
+ * they used to keep, on a tenth as many timers, since that takes
+ * time quadratic in the number pending.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include "pppd.h"
+
+#define ROUNDS	5
+
+static int ntimers = 100000;
+
+static int *order;		/* a random permutation of 0 .. n-1 */
+static char *args;		/* arg for timer i is args + i */
+
+static void
+expired(void *arg)
+{
+}
+
+/*
+ * The sorted list that timeout() and untimeout() used before.
+ */
+struct old_callout {
+    struct timeval	c_time;
+    void		*c_arg;
+    void		(*c_func) __P((void *));
+    struct old_callout	*c_next;
+};
+
+static struct old_callout *old_list;
+
+static void
+old_timeout(void (*func) __P((void *)), void *arg, int secs, int usecs)
+{
+    struct old_callout *newp, *p, **pp;
+    struct timeval now;
+
+    if ((newp = malloc(sizeof(struct old_callout))) == NULL) {
+	perror("timerbench");
+	exit(1);
+    }
+    newp->c_arg = arg;
+    newp->c_func = func;
+    gettimeofday(&now, NULL);
+    newp->c_time.tv_sec = now.tv_sec + secs;
+    newp->c_time.tv_usec = now.tv_usec + usecs;
+    if (newp->c_time.tv_usec >= 1000000) {
+	newp->c_time.tv_sec += newp->c_time.tv_usec / 1000000;
+	newp->c_time.tv_usec %= 1000000;
+    }
+    for (pp = &old_list; (p = *pp); pp = &p->c_next)
+	if (newp->c_time.tv_sec < p->c_time.tv_sec
+	    || (newp->c_time.tv_sec == p->c_time.tv_sec
+		&& newp->c_time.tv_usec < p->c_time.tv_usec))
+	    break;
+    newp->c_next = p;
+    *pp = newp;
+}
+
+static void
+old_untimeout(void (*func) __P((void *)), void *arg)
+{
+    struct old_callout **copp, *freep;
+
+    for (copp = &old_list; (freep = *copp); copp = &freep->c_next)
+	if (freep->c_func == func && freep->c_arg == arg) {
+	    *copp = freep->c_next;
+	    free(freep);
+	    break;
+	}
+}
+
+static struct {
+    char *name;
+    void (*schedule)(void (*) __P((void *)), void *, int, int);
+    void (*cancel)(void (*) __P((void *)), void *);
+    int div;			/* run on ntimers / div timers */
+} methods[] = {
+    { "heap",		timeout,	untimeout,	1 },
+    { "sorted list",	old_timeout,	old_untimeout,	10 },
+};
+
+static char *phases[] = { "schedule", "reschedule", "cancel" };
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * run - schedule n timers with delays of up to 5 minutes, then
+ * reschedule each in random order, as a restart timer is, then cancel
+ * them all in random order.  Puts the time each phase took in t[].
+ */
+static void
+run(int m, int n, double *t)
+{
+    int i;
+
+    srandom(1);
+    t[0] = now();
+    for (i = 0; i < n; ++i)
+	(*methods[m].schedule)(expired, args + i, random() % 300,
+			       random() % 1000000);
+    t[1] = now();
+    for (i = 0; i < n; ++i) {
+	(*methods[m].cancel)(expired, args + order[i]);
+	(*methods[m].schedule)(expired, args + order[i], random() % 300,
+			       random() % 1000000);
+    }
+    t[2] = now();
+    for (i = n; i > 0; --i)
+	(*methods[m].cancel)(expired, args + order[i-1]);
+    t[3] = now();
+    for (i = 0; i < 3; ++i)
+	t[i] = t[i+1] - t[i];
+}
+
+int
+main(int ac, char **av)
+{
+    double t[4], best[3];
+    int c, i, j, m, n, r;
+
+    while ((c = getopt(ac, av, "n:")) != -1) {
+	if (c != 'n') {
+	    fprintf(stderr, "Usage: %s [-n timers]\n", av[0]);
+	    exit(2);
+	}
+	ntimers = atoi(optarg);
+    }
+    order = malloc(ntimers * sizeof(int));
+    args = malloc(ntimers);
+    if (ntimers < 10 || order == NULL || args == NULL) {
+	fprintf(stderr, "%s: bad number of timers\n", av[0]);
+	exit(2);
+    }
+
+    for (m = 0; m < sizeof(methods) / sizeof(methods[0]); ++m) {
+	n = ntimers / methods[m].div;
+	srandom(2);
+	for (i = 0; i < n; ++i)
+	    order[i] = i;
+	for (i = n - 1; i > 0; --i) {
+	    j = random() % (i + 1);
+	    c = order[i];
+	    order[i] = order[j];
+	    order[j] = c;
+	}
+	/* the best of a few rounds, to see past other load */
+	for (r = 0; r < ROUNDS; ++r) {
+	    run(m, n, t);
+	    for (i = 0; i < 3; ++i)
+		if (r == 0 || t[i] < best[i])
+		    best[i] = t[i];
+	}
+	for (i = 0; i < 3; ++i)
+	    printf("%-12s %-11s %d timers %10.3f us per timer\n",
+		   methods[m].name, phases[i], n, best[i] * 1e6 / n);
+    }
+    return 0;
+}
@@ -0,0 +1,230 @@
+/*
+ * pppdb - look up running pppd processes in the database that pppd
+ * keeps in /var/run/pppd2.tdb.
+ *
+ * Each pppd stores its script environment under the key "pppd<pid>",
+ * and stores lookup keys of the form VAR=value pointing at that
+ * entry.  Most lookup keys belong to one pppd and hold its entry key;
+ * shared ones (such as PEERNAME) hold a list of entry keys, each
+ * followed by a semicolon.  The links of a multilink bundle are
+ * listed the same way under BUNDLE_LINKS=<bundle id>.  So a query is
+ * a couple of fetches, whatever the size of the database.
+ */
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include "tdb.h"
+#include "pathnames.h"
+
+int show_env;		/* print the whole entry, not just its key */
+int all;		/* include entries of pppds that have gone */
+TDB_CONTEXT *db;
+
+static int query(char *, char *);
+static int show(char *, int, char *);
+static int has_var(char *, char *);
+static void usage(char *);
+
+static struct {
+    char *name;
+    char *var;
+} queries[] = {
+    { "ip",	"IPREMOTE" },
+    { "if",	"IFNAME" },
+    { "user",	"PEERNAME" },
+    { "bundle",	"BUNDLE" },
+    { NULL, NULL }
+};
+
+int
+main(int ac, char **av)
+{
+    char *file = _PATH_PPPDB;
+    char *p;
+    int i, j, found = 0;
+
+    while ((i = getopt(ac, av, "ef:a")) != -1) {
+	switch (i) {
+	case 'e':
+	    show_env = 1;
+	    break;
+	case 'f':
+	    file = optarg;
+	    break;
+	case 'a':
+	    all = 1;
+	    break;
+	default:
+	    usage(av[0]);
+	}
+    }
+    if (optind >= ac)
+	usage(av[0]);
+
+    /*
+     * Read-only, so that we never take write locks on, or upgrade the
+     * format of, a database that running pppds are using; read-only
+     * opens don't lock at all, so mutex chain locks don't matter.
+     */
+    db = tdb_open(file, 0, 0, O_RDONLY, 0);
+    if (db == NULL) {
+	perror(file);
+	exit(2);
+    }
+
+    for (i = optind; i < ac; ++i) {
+	p = av[i];
+	if (strchr(p, '=') != NULL) {
+	    found += query(p, NULL);
+	    continue;
+	}
+	for (j = 0; queries[j].name != NULL; ++j)
+	    if (strcmp(p, queries[j].name) == 0)
+		break;
+	if (queries[j].name == NULL || i + 1 >= ac)
+	    usage(av[0]);
+	found += query(queries[j].var, av[++i]);
+    }
+    tdb_close(db);
+    exit(found? 0: 1);
+}
+
+static void
+usage(char *prog)
+{
+    fprintf(stderr, "Usage: %s [-e] [-a] [-f file] query ...\n", prog);
+    fprintf(stderr, "where query is ip <address>, if <interface>, "
+	    "user <name>,\nbundle <id> or VAR=value\n");
+    exit(2);
+}
+
+/*
+ * query - print the pppds found by the key VAR=value, given either
+ * as `var' and `value' or as `var' alone.  Returns the number found.
+ */
+static int
+query(char *var, char *value)
+{
+    TDB_DATA key, list;
+    char *kv, *p, *q, *end;
+    int n = 0;
+
+    kv = malloc(strlen(var) + (value? strlen(value): 0) + 8);
+    if (kv == NULL) {
+	perror("pppdb");
+	exit(2);
+    }
+    if (value != NULL)
+	sprintf(kv, "%s=%s", var, value);
+    else
+	strcpy(kv, var);
+
+    key.dptr = kv;
+    key.dsize = strlen(kv);
+    list.dptr = NULL;
+    if (strncmp(kv, "BUNDLE=", 7) == 0) {
+	/* all the links of a bundle, not just the one that made it */
+	p = malloc(key.dsize + 7);
+	if (p == NULL) {
+	    perror("pppdb");
+	    exit(2);
+	}
+	sprintf(p, "BUNDLE_LINKS=%s", kv + 7);
+	key.dptr = p;
+	key.dsize = strlen(p);
+	list = tdb_fetch(db, key);
+	free(p);
+	key.dptr = kv;
+	key.dsize = strlen(kv);
+    }
+    if (list.dptr == NULL)
+	list = tdb_fetch(db, key);
+    if (list.dptr == NULL) {
+	free(kv);
+	return 0;
+    }
+
+    /* an entry key, or a list of them each ending in ';' */
+    end = list.dptr + list.dsize;
+    for (p = list.dptr; p < end && *p != 0; p = q + 1) {
+	if ((q = memchr(p, ';', end - p)) == NULL)
+	    q = end;
+	if (q > p)
+	    n += show(p, q - p, kv);
+    }
+    free(list.dptr);
+    free(kv);
+    return n;
+}
+
+/*
+ * show - print the entry with key `name' (`len' chars) if it still
+ * has `kv' in it and its pppd is still running.  Returns 1 if printed.
+ */
+static int
+show(char *name, int len, char *kv)
+{
+    TDB_DATA key, rec;
+    char *entry, *p, *q;
+    int i, pid, ret = 0;
+
+    key.dptr = name;
+    key.dsize = len;
+    rec = tdb_fetch(db, key);
+    if (rec.dptr == NULL)
+	return 0;
+    entry = realloc(rec.dptr, rec.dsize + 1);
+    if (entry == NULL) {
+	perror("pppdb");
+	exit(2);
+    }
+    entry[rec.dsize] = 0;
+
+    /* a key left behind by a pppd that died may point anywhere */
+    if (has_var(entry, kv)) {
+	/* `name' is not NUL-terminated, so parse the pid in bounds */
+	pid = 0;
+	for (i = 4; i < len && isdigit((unsigned char) name[i])
+		 && pid < 100000000; ++i)
+	    pid = pid * 10 + name[i] - '0';
+	if (all || len < 4 || strncmp(name, "pppd", 4) != 0 || pid <= 0
+	    || kill(pid, 0) == 0 || errno != ESRCH) {
+	    printf("%.*s\n", len, name);
+	    if (show_env) {
+		for (p = entry; *p != 0; p = q + 1) {
+		    if ((q = strchr(p, ';')) == NULL)
+			q = p + strlen(p);
+		    printf("\t%.*s\n", (int)(q - p), p);
+		    if (*q == 0)
+			break;
+		}
+		printf("\n");
+	    }
+	    ret = 1;
+	}
+    }
+    free(entry);
+    return ret;
+}
+
+/*
+ * has_var - see if the VAR=value string `kv' is one of the
+ * semicolon-separated settings in `entry'.
+ */
+static int
+has_var(char *entry, char *kv)
+{
+    int l = strlen(kv);
+    char *p;
+
+    for (p = entry; (p = strstr(p, kv)) != NULL; ++p)
+	if ((p == entry || p[-1] == ';') && (p[l] == ';' || p[l] == 0))
+	    return 1;
+    return 0;
+}